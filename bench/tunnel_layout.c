@@ -0,0 +1,290 @@
+/**
+ * Benchmark of the layout of the tunnels on the ESP path. Replays the memory accesses handle_esp makes for a
+ * packet of an indexed child SA, at random tunnels: the slot of the ESP SA index, the tunnel (its addresses,
+ * encapsulation and deadline) and the replay window of the child SA. The same accesses are made with the tunnels
+ * laid out as before struct tunnel was split, one record holding the IKE part as well, and with the 64 byte
+ * struct tunnel of today, so that only the layout of the tunnel differs.
+ * Runs without EAL:
+ *     ./build/tunnel_layout [old|new|both] [TUNNELS] [PACKETS]
+ * One layout at a time can be run under perf stat to count its cache misses.
+ */
+#include "../include/ike.h"
+#include "../include/sa_index.h"
+#include "../include/replay.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <rte_memory.h>
+
+/// Tunnels unless given, the number the layout was to be measured at
+#define BENCH_TUNNELS 100000
+/// Packets of a run unless given
+#define BENCH_PACKETS 20000000
+/// Runs of each layout, the fastest is reported
+#define BENCH_RUNS 3
+/// Sequence numbers of each replay window, the default of --replay-window
+#define BENCH_REPLAY_WINDOW 64
+
+/**
+ * @struct tunnel_unsplit
+ * @brief A tunnel laid out as before struct tunnel was split: the fields of struct tunnel and struct tunnel_ike
+ * in one record, in the order they had then, the child SAs where the ESP spis and sequence numbers were
+ */
+struct tunnel_unsplit{
+    uint64_t initiator_spi;
+    uint64_t responder_spi;
+    struct ip_addr client_ip;
+    struct ip_addr host_ip;
+    struct child_sa children[TUNNEL_CHILD_SAS];
+    bool dpd;
+    bool auth;
+    bool deleting;
+    uint8_t encap;
+    uint8_t timer_class;
+    uint64_t deadline;
+    struct timer_node timer;
+    int dpd_count;
+    struct skf_state skf[2];
+    uint16_t next_serial;
+    bool saved;
+};
+
+/// Gets the addresses and spis of the packets of a tunnel, computed so that packets are not read from memory
+static inline void
+bench_pair(uint32_t t, struct ip_addr *client, struct ip_addr *host, rte_be32_t spi[2]){
+    *client = ip_addr_from_ipv4(rte_cpu_to_be_32(0x0A000000 | t));
+    *host = ip_addr_from_ipv4(rte_cpu_to_be_32(0xC0A80001 + (t & 0xFF)));
+    spi[ESP_DIR_CLIENT] = rte_cpu_to_be_32(t * 2 + 1);
+    spi[ESP_DIR_HOST] = rte_cpu_to_be_32(t * 2 + 2);
+}
+
+/**
+ * Allocates an empty ESP SA index as esp_sa_index_create does: twice as many slots as the SAs it holds rounded up
+ * to a power of two, on transparent huge pages where the kernel allows it
+ * @param capacity most ESP SAs the index holds
+ * @returns the index, NULL if it cannot be allocated
+ */
+static struct esp_sa_index *
+bench_index_create(uint32_t capacity){
+    const uint64_t size = rte_align64pow2((uint64_t)capacity * 2);
+    const size_t bytes = RTE_ALIGN_CEIL(size * sizeof(struct esp_sa_slot),RTE_PGSIZE_2M);
+    struct esp_sa_index *index = calloc(1,sizeof(struct esp_sa_index));
+    if(index == NULL){
+        return NULL;
+    }
+    index->slots = aligned_alloc(RTE_PGSIZE_2M,bytes);
+    if(index->slots == NULL){
+        free(index);
+        return NULL;
+    }
+    madvise(index->slots,bytes,MADV_HUGEPAGE);
+    memset(index->slots,0,bytes);
+    index->mask = size - 1;
+    index->seed = 0x5EED;
+    return index;
+}
+
+/// Adds an entry to the slots of an index as esp_sa_index_add does, for a tunnel of either layout
+static void
+bench_index_add(struct esp_sa_index *index, void *tunnel, const struct ip_addr *src, const struct ip_addr *dst,
+uint8_t dir, rte_be32_t spi){
+    uint32_t s = esp_sa_hash(index,src,dst,spi) & index->mask;
+    while(index->slots[s].tunnel != NULL){
+        s = (s + 1) & index->mask;
+    }
+    index->slots[s].tunnel = tunnel;
+    index->slots[s].spi = spi;
+    index->slots[s].dir = dir;
+    index->slots[s].child = 0;
+    index->count++;
+}
+
+/**
+ * Runs packets at random tunnels through the accesses of handle_esp. Always inlined with constant offsets, so
+ * that each layout gets the code a struct of its own would
+ * @param index ESP SA index of the tunnels
+ * @param replays replay windows of the child SAs
+ * @param tunnels first tunnel
+ * @param stride bytes of a tunnel
+ * @param client_offset offset of client_ip in a tunnel, host_ip follows it
+ * @param encap_offset offset of encap
+ * @param deadline_offset offset of deadline
+ * @param nb_tunnels tunnels indexed
+ * @param nb_packets packets to run
+ * @param first_seq sequence number of the first packet, each packet has the next
+ * @returns the packets found new to their replay window, printed so that the loop is not optimised away
+ */
+static inline __attribute__((always_inline)) uint64_t
+bench_run(const struct esp_sa_index *index, const struct replay_table *replays, uint8_t *tunnels, size_t stride,
+size_t client_offset, size_t encap_offset, size_t deadline_offset, uint32_t nb_tunnels, uint64_t nb_packets,
+uint64_t first_seq){
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    uint64_t found = 0;
+    for(uint64_t p = 0; p < nb_packets; p++){
+        struct ip_addr client, host;
+        rte_be32_t spi[2];
+        const struct ip_addr *src, *dst;
+        uint32_t t, s;
+        uint8_t dir;
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        t = (uint32_t)(state % nb_tunnels);
+        dir = (state >> 40) & 1;
+        bench_pair(t,&client,&host,spi);
+        src = dir == ESP_DIR_CLIENT ? &client : &host;
+        dst = dir == ESP_DIR_CLIENT ? &host : &client;
+        s = esp_sa_hash(index,src,dst,spi[dir]) & index->mask;
+        while(index->slots[s].tunnel != NULL){
+            const struct esp_sa_slot *slot = &index->slots[s];
+            uint8_t *tunnel = (uint8_t *)slot->tunnel;
+            const struct ip_addr *tunnel_ips = (const struct ip_addr *)(tunnel + client_offset);
+            if(slot->spi == spi[dir] && ip_addr_equal(tunnel_ips[slot->dir],*src) &&
+            ip_addr_equal(tunnel_ips[!slot->dir],*dst)){
+                const uint32_t handle = (tunnel - tunnels) / stride;
+                struct replay_window *window = replay_window(replays,handle,slot->dir);
+                uint64_t *deadline = (uint64_t *)(tunnel + deadline_offset);
+                if(tunnel[encap_offset] == ESP_ENCAP_UDP && replay_check(replays,window,(uint32_t)(first_seq + p)) == REPLAY_NEW){
+                    found++;
+                }
+                //as tunnel_touch pushes the deadline back
+                *deadline = p + TUNNEL_IDLE_TIMEOUT;
+                break;
+            }
+            s = (s + 1) & index->mask;
+        }
+    }
+    return found;
+}
+
+/// Gets the nanoseconds of the monotonic clock
+static uint64_t
+bench_now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Allocates the tunnels of one layout with their index and replay windows, all sized as a worker with
+ * --max-tunnels set to the number of tunnels sizes them
+ * @param stride bytes of a tunnel
+ * @param client_offset offset of client_ip in a tunnel, host_ip follows it
+ * @param encap_offset offset of encap
+ * @param nb_tunnels tunnels to add
+ * @param index set to the index
+ * @param replays set to the replay windows
+ * @returns the tunnels, NULL if they cannot be allocated
+ */
+static uint8_t *
+bench_setup(size_t stride, size_t client_offset, size_t encap_offset, uint32_t nb_tunnels,
+struct esp_sa_index **index, struct replay_table **replays){
+    uint8_t *tunnels = aligned_alloc(RTE_CACHE_LINE_SIZE,RTE_ALIGN_CEIL((size_t)nb_tunnels * stride,RTE_CACHE_LINE_SIZE));
+    *index = bench_index_create(nb_tunnels * ESP_SAS_PER_TUNNEL);
+    *replays = replay_table_create(nb_tunnels * TUNNEL_CHILD_SAS,BENCH_REPLAY_WINDOW);
+    if(tunnels == NULL || *index == NULL || *replays == NULL){
+        return NULL;
+    }
+    memset(tunnels,0,(size_t)nb_tunnels * stride);
+    for(uint32_t t = 0; t < nb_tunnels; t++){
+        uint8_t *tunnel = tunnels + (size_t)t * stride;
+        struct ip_addr *tunnel_ips = (struct ip_addr *)(tunnel + client_offset);
+        rte_be32_t spi[2];
+        bench_pair(t,&tunnel_ips[ESP_DIR_CLIENT],&tunnel_ips[ESP_DIR_HOST],spi);
+        tunnel[encap_offset] = ESP_ENCAP_UDP;
+        //the entries of the directions and the spis of the child SA, as an authenticated tunnel has
+        for(uint8_t dir = ESP_DIR_CLIENT; dir <= ESP_DIR_HOST; dir++){
+            bench_index_add(*index,tunnel,&tunnel_ips[dir],&tunnel_ips[!dir],dir,0);
+            bench_index_add(*index,tunnel,&tunnel_ips[dir],&tunnel_ips[!dir],dir,spi[dir]);
+        }
+    }
+    return tunnels;
+}
+
+/**
+ * @struct bench_layout
+ * @brief Tunnels of one layout with their index and replay windows
+ */
+struct bench_layout{
+    const char *name;
+    /** whether the tunnels are laid out as before the split */
+    bool unsplit;
+    size_t stride;
+    uint8_t *tunnels;
+    struct esp_sa_index *index;
+    struct replay_table *replays;
+    /** fastest run in nanoseconds */
+    uint64_t best;
+    /** packets found by the last run */
+    uint64_t found;
+};
+
+/**
+ * Runs the packets once through a layout, with sequence numbers going on from those of its previous run so
+ * that every packet is new to its replay window
+ * @param layout layout to run
+ * @param nb_tunnels tunnels of the layout
+ * @param nb_packets packets to run
+ * @param first_seq sequence number of the first packet
+ */
+static void
+bench_layout_run(struct bench_layout *layout, uint32_t nb_tunnels, uint64_t nb_packets, uint64_t first_seq){
+    const uint64_t start = bench_now();
+    if(layout->unsplit){
+        layout->found = bench_run(layout->index,layout->replays,layout->tunnels,sizeof(struct tunnel_unsplit),
+        offsetof(struct tunnel_unsplit,client_ip),offsetof(struct tunnel_unsplit,encap),offsetof(struct tunnel_unsplit,deadline),
+        nb_tunnels,nb_packets,first_seq);
+    }
+    else{
+        layout->found = bench_run(layout->index,layout->replays,layout->tunnels,sizeof(struct tunnel),
+        offsetof(struct tunnel,client_ip),offsetof(struct tunnel,encap),offsetof(struct tunnel,deadline),
+        nb_tunnels,nb_packets,first_seq);
+    }
+    layout->best = RTE_MIN(layout->best,bench_now() - start);
+}
+
+int main(int argc, char **argv){
+    const char *which = argc > 1 ? argv[1] : "both";
+    const uint32_t nb_tunnels = argc > 2 ? (uint32_t)strtoul(argv[2],NULL,10) : BENCH_TUNNELS;
+    const uint64_t nb_packets = argc > 3 ? strtoull(argv[3],NULL,10) : BENCH_PACKETS;
+    struct bench_layout layouts[2] = {
+        {.name = "old", .unsplit = true, .stride = sizeof(struct tunnel_unsplit), .best = UINT64_MAX},
+        {.name = "new", .unsplit = false, .stride = sizeof(struct tunnel), .best = UINT64_MAX}
+    };
+    if(nb_tunnels == 0 || nb_packets == 0 || (strcmp(which,"old") != 0 && strcmp(which,"new") != 0 && strcmp(which,"both") != 0)){
+        printf("%s [old|new|both] [TUNNELS] [PACKETS]\n",argv[0]);
+        return 1;
+    }
+    for(int l = 0; l < 2; l++){
+        struct bench_layout *layout = &layouts[l];
+        if(strcmp(which,"both") != 0 && strcmp(which,layout->name) != 0){
+            continue;
+        }
+        layout->tunnels = bench_setup(layout->stride,
+        layout->unsplit ? offsetof(struct tunnel_unsplit,client_ip) : offsetof(struct tunnel,client_ip),
+        layout->unsplit ? offsetof(struct tunnel_unsplit,encap) : offsetof(struct tunnel,encap),
+        nb_tunnels,&layout->index,&layout->replays);
+        if(layout->tunnels == NULL){
+            printf("Cannot allocate %u tunnels\n",nb_tunnels);
+            return 1;
+        }
+    }
+    printf("%u tunnels, %" PRIu64 " ESP packets at random tunnels, best of %d runs\n",nb_tunnels,nb_packets,BENCH_RUNS);
+    //the layouts take turns so that both see the same noise from the host
+    for(int run = 0; run < BENCH_RUNS; run++){
+        for(int l = 0; l < 2; l++){
+            if(layouts[l].tunnels != NULL){
+                bench_layout_run(&layouts[l],nb_tunnels,nb_packets,(uint64_t)run * nb_packets + 1);
+            }
+        }
+    }
+    for(int l = 0; l < 2; l++){
+        if(layouts[l].tunnels != NULL){
+            printf("%s layout, %zu bytes per tunnel: %.2f ns per packet, %" PRIu64 " of %" PRIu64 " packets found\n",
+            layouts[l].name,layouts[l].stride,(double)layouts[l].best / nb_packets,layouts[l].found,nb_packets);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,117 @@
+#ifndef AFPACKET_H
+#define AFPACKET_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <rte_mbuf.h>
+#include <rte_byteorder.h>
+#include "packet.h"
+
+/// Size of each block of the TPACKET_V3 ring, the kernel hands packets over a block at a time
+#define AFPACKET_BLOCK_SIZE (1 << 20)
+/// Number of blocks of the ring of every socket
+#define AFPACKET_BLOCK_NR 64
+/// Frame size given to the kernel, only used to size the ring as frames are packed within blocks
+#define AFPACKET_FRAME_SIZE 2048
+/// Milliseconds after which the kernel hands over a block that is not full
+#define AFPACKET_BLOCK_TIMEOUT 10
+/// Milliseconds to wait for a block before returning an empty burst
+#define AFPACKET_POLL_TIMEOUT 100
+/// Multiplier spreading the sum of the addresses of a pair over the sockets of the fanout group
+#define AFPACKET_FANOUT_MIX 0x9e3779b1
+
+/**
+ * @struct afpacket_rx
+ * @brief A AF_PACKET socket receiving from an interface into a TPACKET_V3 ring shared with the kernel
+ */
+struct afpacket_rx{
+    /** packet socket */
+    int fd;
+    /** start of the mapped ring */
+    uint8_t *ring;
+    /** size of the mapped ring */
+    size_t ring_size;
+    /** block currently handed to the application, NULL if none */
+    struct tpacket_block_desc *block;
+    /** index of the block to read next */
+    uint32_t block_index;
+    /** packets of the current block not yet returned */
+    uint32_t pkts_left;
+    /** next packet of the current block */
+    const uint8_t *next_pkt;
+    /** packets dropped by the kernel because the ring was full */
+    uint64_t drops;
+};
+
+/**
+ * Opens a packet socket on an interface with a TPACKET_V3 ring mapped into memory and puts the
+ * interface in promiscuous mode. When the socket is part of a fanout group, the kernel spreads packets
+ * over the sockets of the group the same way as afpacket_fanout_member
+ * @param rx struct to store the socket in
+ * @param iface name of the interface
+ * @param fanout_id id of the fanout group shared by the sockets receiving from the interface
+ * @param fanout whether if the socket joins the fanout group
+ * @returns 0 on success, -1 if the socket cannot be opened
+ */
+int afpacket_open(struct afpacket_rx *rx, const char *iface, uint16_t fanout_id, bool fanout);
+
+/**
+ * Gets the next packets received as packet views pointing into the ring, no data is copied. Packets
+ * of a burst all come from the same block, which is given back to the kernel on the next call once
+ * all its packets were returned, so the views are only valid until the next call. Waits up to
+ * AFPACKET_POLL_TIMEOUT ms for a block if none is ready
+ * @param rx packet socket
+ * @param views mbuf headers to use as views, at least n of them
+ * @param pkts array that gets pointers to the views filled
+ * @param n most packets to read
+ * @returns number of packets read, 0 if nothing was received before the timeout
+ */
+uint16_t afpacket_rx_burst(struct afpacket_rx *rx, struct rte_mbuf *views, struct rte_mbuf **pkts, uint16_t n);
+
+/**
+ * Gets the number of packets the kernel dropped because the ring of the socket was full
+ * @param rx packet socket
+ * @returns packets dropped since the socket was opened
+ */
+uint64_t afpacket_drops(struct afpacket_rx *rx);
+
+/**
+ * Closes a packet socket and unmaps its ring
+ * @param rx packet socket
+ */
+void afpacket_close(struct afpacket_rx *rx);
+
+/**
+ * Gets the member of the fanout group the kernel hands the packets of a client/host pair to. Mirrors
+ * the classic BPF program given to the fanout group, which adds the ip addresses so that both
+ * directions of a pair reach the same socket
+ * @param client_ip ip address of the client, as found in the ipv4 header
+ * @param host_ip ip address of the host, as found in the ipv4 header
+ * @param nb_members number of sockets in the fanout group
+ * @returns index of the socket
+ */
+static inline uint16_t
+afpacket_fanout_member(uint32_t client_ip, uint32_t host_ip, uint16_t nb_members){
+    uint32_t hash = (rte_be_to_cpu_32(client_ip) + rte_be_to_cpu_32(host_ip)) * AFPACKET_FANOUT_MIX;
+    return (hash >> 16) % nb_members;
+}
+
+/**
+ * Gets the member of the fanout group the kernel hands the packets of an IPv6 client/host pair to,
+ * the classic BPF program adds the 8 words of both addresses
+ * @param client_ip ip address of the client as 4 words, as found in the ipv6 header
+ * @param host_ip ip address of the host as 4 words, as found in the ipv6 header
+ * @param nb_members number of sockets in the fanout group
+ * @returns index of the socket
+ */
+static inline uint16_t
+afpacket_fanout_member_ipv6(const uint32_t *client_ip, const uint32_t *host_ip, uint16_t nb_members){
+    uint32_t sum = 0;
+    for(int i = 0; i < 4; i++){
+        sum += rte_be_to_cpu_32(client_ip[i]) + rte_be_to_cpu_32(host_ip[i]);
+    }
+    return ((sum * AFPACKET_FANOUT_MIX) >> 16) % nb_members;
+}
+
+#endif
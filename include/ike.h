@@ -3,35 +3,71 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <inttypes.h>
 #include <getopt.h>
 #include <rte_byteorder.h>
 #include <rte_mbuf.h>
 #include <string.h>
-#include "array.h"
+#include <stdlib.h>
 #include <rte_ethdev.h>
 #include <rte_ether.h>
 #include <rte_esp.h>
 #include <rte_udp.h>
 #include <stdbool.h>
 #include "log.h"
+#include "timer_wheel.h"
 #include "../deps/b64/b64.h"
 
-int src_addr_int;
-int dst_addr_int;
-char src_addr[128];
-char dst_addr[128];
-char current_time[24];
-static const int ESP_OFFSET = sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_ether_hdr) + sizeof(struct rte_udp_hdr);
-static const int ISAKMP_OFFSET = sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_ether_hdr) + sizeof(struct rte_udp_hdr) + 4;
-static const int first_payload_hdr_offset = ESP_OFFSET + 28;
-
-static const int ESP_OFFSET_6 = sizeof(struct rte_ipv6_hdr) + sizeof(struct rte_ether_hdr) + sizeof(struct rte_udp_hdr);
-static const int ISAKMP_OFFSET_6 = sizeof(struct rte_ipv6_hdr) + sizeof(struct rte_ether_hdr) + sizeof(struct rte_udp_hdr) + 4;
-static const int first_payload_hdr_offset_6 = ESP_OFFSET_6 + 28;
+/**
+ * @struct ip_addr
+ * @brief IPv4 or IPv6 address of a tunnel endpoint. IPv4 addresses are stored IPv4-mapped
+ * (::ffff:a.b.c.d) so that addresses of both families compare the same way, as two 64 bit words
+ */
+struct ip_addr{
+    union{
+        uint8_t bytes[16];
+        /** words in network byte order, an IPv4 address is word 3 */
+        rte_be32_t words[4];
+        uint64_t halves[2];
+    };
+};
 
-static const int serialize_size = 32;
-struct Array *tunnels;
+/* Packet state used while analysing a packet. These are per thread so that every worker lcore
+   can analyse its own packets without interfering with the others */
+extern __thread struct ip_addr src_ip;
+extern __thread struct ip_addr dst_ip;
+extern __thread char src_addr[128];
+extern __thread char dst_addr[128];
+extern __thread char current_time[24];
+struct tunnel_pool;
+/// Authenticated tunnels owned by the calling thread. Each worker lcore points this at its own pool
+extern __thread struct tunnel_pool *tunnels;
+/// IKE SAs of the calling thread yet to authenticate, moved to tunnels once they do
+extern __thread struct tunnel_pool *half_open;
+struct ike_sa_index;
+/// Index of the tunnels owned by the calling thread by the spis of their IKE SA, kept with tunnels
+extern __thread struct ike_sa_index *ike_sas;
+struct esp_sa_index;
+/// Index of the ESP SAs of the authenticated tunnels owned by the calling thread, kept with tunnels
+extern __thread struct esp_sa_index *esp_sas;
+/// Timers of the tunnels owned by the calling thread, kept with tunnels
+extern __thread struct timer_wheel *timers;
+struct replay_table;
+/// Replay windows of the child SAs of the authenticated tunnels owned by the calling thread, kept with tunnels
+extern __thread struct replay_table *replays;
+struct tunnel_journal;
+struct snapshot_tunnel;
+struct tunnel_snapshot;
+/// Journal of the authenticated tunnels, shared by the workers, NULL if it could not be opened
+extern struct tunnel_journal *journal;
+struct journal_queue;
+/// Queue of the journal the calling thread appends to, the one of the worker it is pointed at, NULL without a journal
+extern __thread struct journal_queue *journal_queue;
+/// Tick of the packets being analysed, read once per burst
+extern __thread uint64_t current_tick;
+/// Set while analysing an IKE message whose payloads are not logged, as part of a flood
+extern __thread bool ike_quiet;
 
 static const char * transform_types[5] = { "Encryption Algorithm","Pseudorandom Function","Integrity Algorithm","Diffie-Hellman Group","Extended Sequence Numbers"};
 
@@ -247,7 +283,7 @@ struct rte_isakmp_hdr{
     rte_be32_t message_id;
     /**  Length of header */
     rte_be32_t total_length; 
-};
+} __rte_packed;
 
 /**
  * @struct Payload header
@@ -361,41 +397,207 @@ struct delete{
     void* SPI;
 };
 
+/// Most fragments of an IKE message (RFC 7383) kept track of, messages split further are invalid
+#define SKF_MAX_FRAGMENTS 64
+
+/**
+ * @struct skf_payload
+ * @brief Header of an Encrypted Fragment payload (RFC 7383), followed by the encrypted fragment
+ */
+struct skf_payload{
+    /** next payload is the first payload of the message in fragment 1, 0 in the others */
+    struct isakmp_payload_hdr hdr;
+    /** number of this fragment, starting from 1 */
+    rte_be16_t fragment_number;
+    /** number of fragments of the message */
+    rte_be16_t total_fragments;
+};
+
+/**
+ * @struct skf_state
+ * @brief Fragments seen of the IKE message being received in one direction of an IKE SA. The
+ * fragments themselves are not kept as they cannot be decrypted
+ */
+struct skf_state{
+    /** message id of the message, in network byte order */
+    rte_be32_t message_id;
+    /** number of fragments of the message, 0 if no message is being received */
+    uint16_t total;
+    /** first payload of the message, taken from fragment 1 */
+    int8_t first_payload;
+    /** whether if every fragment was seen and the message analysed */
+    bool complete;
+    /** fragments seen, bit n - 1 for fragment n */
+    uint64_t received;
+};
+
+/// How the ESP packets of a tunnel are carried
+enum esp_encap{
+    /** no ESP packet seen yet, or the tunnel was loaded from file */
+    ESP_ENCAP_UNKNOWN = 0,
+    /** ESP directly over ip, protocol 50 */
+    ESP_ENCAP_NONE,
+    /** ESP in udp on port 4500 (NAT-T) */
+    ESP_ENCAP_UDP
+};
+
+/// Direction of the ESP traffic of a child SA, each with its own spi and replay window
+enum esp_dir{
+    /** sent by the client to the host */
+    ESP_DIR_CLIENT = 0,
+    /** sent by the host to the client */
+    ESP_DIR_HOST
+};
+
+/// Child SAs each tunnel keeps at once: the one set up by IKE_AUTH and those added or rekeyed by CREATE_CHILD_SA
+#define TUNNEL_CHILD_SAS 4
+/// Seconds a child SA negotiated by CREATE_CHILD_SA has to carry its first ESP packet in each direction
+#define CHILD_SA_NEGOTIATE_TIMEOUT 30
+
+/// What a child SA slot of a tunnel holds
+enum child_sa_state{
+    /** nothing, the slot can be taken */
+    CHILD_SA_FREE = 0,
+    /** an SA negotiated whose spis are learnt from its first ESP packets, as they are sent encrypted */
+    CHILD_SA_NEGOTIATED,
+    /** an SA that carried ESP packets, or was loaded from file */
+    CHILD_SA_ACTIVE
+};
+
+/**
+ * @struct child_sa
+ * @brief ESP SA pair of a tunnel, one spi per direction. Its replay windows are kept in a replay_table
+ * under the handle of the tunnel and the index of the child SA
+ */
+struct child_sa{
+    /** spi of each direction as found in the ESP header, indexed by esp_dir, 0 until learnt */
+    rte_be32_t spi[2];
+    /** low half of the highest sequence number of each direction when the timer of the tunnel last fired */
+    uint32_t swept[2];
+    /** tick the directions whose spi is still 0 can be learnt until */
+    uint64_t learn_until;
+    /** order the SA was negotiated in, the lowest is the oldest */
+    uint16_t serial;
+    /** an enum child_sa_state */
+    uint8_t state;
+};
+
 /** @struct tunnel
- *  @brief Container to store a tunnel between initiator and responder
+ *  @brief Container to store a tunnel between initiator and responder. Only holds what the ESP packets of the
+ *  tunnel are checked against, in both directions, so that an ESP packet touches one cache line of it besides
+ *  its ESP SA index slot and replay window: the spi of a packet is checked by the index, which leads to the child SA. The rest
+ *  of the tunnel, its child SAs included, is kept apart in its tunnel_ike under the same handle
  */
 struct tunnel{
+    /** client ip address */
+    struct ip_addr client_ip; 
+    /** host ip address */
+    struct ip_addr host_ip; 
+    /** tick the tunnel times out at. Activity pushes it back without moving the timer, which is
+        rescheduled to it when it fires early */
+    uint64_t deadline;
+    /** auth flag */
+    bool auth; 
+    /** whether if the ESP packets of the tunnel are encapsulated in udp, learnt from the first one */
+    uint8_t encap;
+    /** what the tunnel is waiting for, an enum tunnel_timer */
+    uint8_t timer_class;
+} __rte_cache_aligned;
+
+/** @struct tunnel_ike
+ *  @brief Part of a tunnel only used by its IKE messages and timer
+ */
+struct tunnel_ike{
     /** initiator spi */
     uint64_t initiator_spi; 
     /** responder spi */
     uint64_t responder_spi; 
-    /** client ip address */
-    int client_ip; 
-    /** host ip address */
-    int host_ip; 
-    /** client esp spi */
-    uint32_t client_spi; 
-    /** host esp spi */
-    uint32_t host_spi; 
-    /** client esp seq */
-    uint32_t client_seq; 
-    /** host esp seq */
-    uint32_t host_seq; 
+    /** timer of the tunnel, due at the deadline or before it */
+    struct timer_node timer;
+    /** if count == 6, peer is deado */
+    int dpd_count; 
     /** dead peer detection flag */
     bool dpd; 
-    /** auth flag */
-    bool auth; 
-    /** client flag to indicate tunnel was loaded from file */
-    bool client_loaded; 
-    /** host flag to indicate tunnel was loaded from file */
-    bool host_loaded; 
     bool deleting;
-    /** timeout counter */
-    int timeout; 
-    /** if count == 6, peer is deado */
-    int dpd_count; 
+    /** fragmented messages being received, indexed by the response flag */
+    struct skf_state skf[2];
+    /** ESP SAs of the tunnel */
+    struct child_sa children[TUNNEL_CHILD_SAS];
+    /** serial of the next child SA negotiated */
+    uint16_t next_serial;
+    /** whether if the tunnel journal holds the tunnel */
+    bool saved;
 };
 
+/// What a tunnel is waiting for, which decides how long it may stay silent and what it means when it does
+enum tunnel_timer{
+    /** authenticated tunnel, its session ends */
+    TUNNEL_TIMER_IDLE = 0,
+    /** IKE SA yet to authenticate, its authentication failed */
+    TUNNEL_TIMER_HALF_OPEN,
+    /** peer that did not answer the last dead peer detection request, its session ends */
+    TUNNEL_TIMER_DPD,
+};
+
+/// Seconds an authenticated tunnel can go without traffic
+#define TUNNEL_IDLE_TIMEOUT 40
+/// Seconds an IKE SA has to authenticate, pushed back by each of its messages
+#define TUNNEL_HALF_OPEN_TIMEOUT 40
+/// Seconds a peer has to answer the last dead peer detection request
+#define TUNNEL_DPD_GRACE 10
+/// Tunnels that could be evicted compared to pick the one evicted from a full pool
+#define EVICT_SAMPLE 8
+/// Most tunnels looked at to find them
+#define EVICT_SCAN 64
+/// Seconds an authenticated tunnel must have been quiet for before a new tunnel may take its slot
+#define EVICT_IDLE 10
+
+/// Bytes of a tunnel saved to the tunnel file the journal replaced: the IKE spis, addresses and ESP spis
+static const int serialize_size = 2 * sizeof(uint64_t) + 2 * sizeof(struct ip_addr) + 2 * sizeof(uint32_t);
+/// Size of the records saved before IPv6 support, with 4 byte IPv4 addresses
+static const int legacy_serialize_size = 32;
+
+/**
+ * Gets the address key of an IPv4 address
+ * @param addr address as found in the ipv4 header
+ * @returns IPv4-mapped address
+ */
+static inline struct ip_addr
+ip_addr_from_ipv4(rte_be32_t addr){
+    struct ip_addr ip = {
+        .words = {0,0,RTE_BE32(0xFFFF),addr}
+    };
+    return ip;
+}
+
+/**
+ * Gets the address key of an IPv6 address
+ * @param addr address as found in the ipv6 header
+ * @returns copy of the address
+ */
+static inline struct ip_addr
+ip_addr_from_ipv6(const uint8_t *addr){
+    struct ip_addr ip;
+    memcpy(ip.bytes,addr,sizeof(ip.bytes));
+    return ip;
+}
+
+/**
+ * Compares two addresses. The low half holding IPv4 addresses is compared first so that IPv4
+ * addresses that differ fail on the first comparison
+ * @returns whether if the addresses are the same
+ */
+static inline bool
+ip_addr_equal(struct ip_addr a, struct ip_addr b){
+    return a.halves[1] == b.halves[1] && a.halves[0] == b.halves[0];
+}
+
+/// Checks whether if an address is an IPv4-mapped IPv4 address
+static inline bool
+ip_addr_is_ipv4(const struct ip_addr *addr){
+    return addr->halves[0] == 0 && addr->words[2] == RTE_BE32(0xFFFF);
+}
+
 /** Gets response flag of a packet. If 1, means the packet is a response else, the packet is a request
  * @param hdr IKE/isakmp headers of the packet
  * @return response flag of the packet
@@ -459,30 +661,78 @@ void get_ip_address_string(rte_be32_t addr,char *ip);
  */
 void get_ipv6_address_string(uint8_t* addr,char *ip);
 
+/** converts a tunnel endpoint address into a string, dotted for IPv4 and colon separated for IPv6
+ * @param addr address to convert
+ * @param ip string to store the converted ip, at least 40 bytes
+ */
+void get_ip_addr_string(const struct ip_addr *addr,char *ip);
+
 /** deletes tunnel from authenticated tunnels once session ends
  * @param initiator_spi initiator spi from ISAKMP/IKE header
  * @param responder_spi responder spi from ISAKMP/IKE header
  * @param src_addr source address of packet
  * @param dst_addr destination address of packet
  */
-void delete_tunnel(uint64_t initiator_spi,uint64_t responder_spi,int src_addr,int dst_addr);
+void delete_tunnel(uint64_t initiator_spi,uint64_t responder_spi,struct ip_addr src_addr,struct ip_addr dst_addr);
 
 /**
- * Add tunnels to established tunnel array
- * @param tunnel tunnel to add
+ * Saves the child SAs of a tunnel with both spis learnt to the tunnel journal, which adds the tunnel the first
+ * time and updates it after. A tunnel left without such a child SA is removed from the journal
+ * @param add tunnel to save, of the calling thread
  */
 void add_tunnel(struct tunnel* add);
 
 /**
- * Remove tunnel from saved tunnel file
- * @param remove tunnel to remove
+ * Copies a tunnel into a free slot of the tunnels of the calling thread, or of half_open if it is not authenticated,
+ * and indexes it by the spis of its IKE SA, and by its ESP SAs if it is authenticated. A full pool evicts the tunnel
+ * least worth keeping, if any
+ * @param tunnel tunnel to copy in
+ * @param ike IKE part of the tunnel to copy in, its timer is scheduled here
+ * @returns the tunnel added, NULL if no slot can be freed or it cannot be indexed
+ */
+struct tunnel *insert_tunnel(const struct tunnel *tunnel, const struct tunnel_ike *ike);
+
+/**
+ * Removes a tunnel from the tunnel journal, if it holds it, with a delete record
+ * @param remove tunnel to remove, of the calling thread
  */
 void remove_tunnel(struct tunnel* remove);
 
 /**
- * Load save tunnels from file and add them to established tunnels. The tunnels will have their client_loaded and host_laoded flag set
+ * Opens the tunnel journal and adds the tunnels it holds to established tunnels. The last tunnel snapshot, taken by a
+ * checkpoint or when the workers last stopped, is restored instead with the replay windows of the child SAs, then the
+ * records appended to the journal after it are replayed over it. Without a snapshot, the saved spis make up the child
+ * SAs of each tunnel, whose replay windows start from the next packet.
+ * The tunnels of the tunnel file the journal replaced, in either of its formats, are moved to the journal and the file removed
+ * @param nb_workers number of workers, each appending to a queue of the journal of its own
+ * @param select_worker points tunnels, ike_sas and journal_queue at those of the worker that owns a loaded tunnel
+ * @param restore_workers restores a snapshot into every worker with restore_snapshot
+ */
+void load_tunnel(uint16_t nb_workers, void (*select_worker)(struct tunnel *tunnel),
+void (*restore_workers)(const struct tunnel_snapshot *snapshot));
+
+/**
+ * Adds the tunnels of a snapshot that a worker owns to the tunnels the calling thread is pointed at, with the replay
+ * windows of their child SAs. Workers own tunnels of their own, so each can be restored on a thread of its own
+ * @param snapshot mapped snapshot
+ * @param worker index of the worker the calling thread is pointed at
+ * @param worker_for_pair gets the index of the worker that owns the tunnels of a pair of addresses
+ */
+void restore_snapshot(const struct tunnel_snapshot *snapshot, uint16_t worker,
+uint16_t (*worker_for_pair)(const struct ip_addr *client_ip, const struct ip_addr *host_ip));
+
+/**
+ * Packs the authenticated tunnels the calling thread is pointed at into records of a tunnel snapshot, with the state
+ * of their child SAs and replay windows. Called by the worker that owns them, or once it stopped
+ * @param records records to fill, room for as many as the pool of the tunnels holds
+ * @returns the number of records filled
+ */
+uint64_t snapshot_tunnels(struct snapshot_tunnel *records);
+
+/**
+ * Stops the compaction of the tunnel journal and closes it, once the workers are done
  */
-void load_tunnel();
+void close_tunnel_journal(void);
 
 /**
  * Analyses a Key Exchange payload
@@ -504,6 +754,18 @@ int analyse_KE(struct rte_mbuf *pkt,uint16_t offset,struct rte_isakmp_hdr *isakm
  */
 int analyse_SK(struct rte_mbuf *pkt, uint16_t offset, struct rte_isakmp_hdr *isakmp_hdr);
 
+/**
+ * Analyses an Encrypted Fragment payload (RFC 7383). Fragments are counted per IKE SA and direction,
+ * and once all fragments of a message were seen it is analysed like an Encrypted payload using the
+ * first payload given in fragment 1. A message with more fragments replaces the one being received,
+ * one with fewer is ignored, so each tunnel only ever keeps track of one message per direction
+ * @param pkt : pointer to packet used
+ * @param offset: offset to paylaod header
+ * @param isakmp_hdr pointer to isakmp headers
+ * @returns 1 if there are no errors analyzing the packet, 0 if otherwise
+ */
+int analyse_SKF(struct rte_mbuf *pkt, uint16_t offset, struct rte_isakmp_hdr *isakmp_hdr);
+
 /**
  * Analyses a Notify payload. If an error code is sent, should kill sesssion i think?
  * @param pkt : pointer to packet used
@@ -565,14 +827,102 @@ int analyse_SA(struct rte_mbuf *pkt,uint16_t offset,struct rte_isakmp_hdr *isakm
  * @param tunnel tunnel to check against
  * @returns 1 if information matches, 0 if otherwise
  */
-int check_ike_spi(uint64_t initiator_spi,uint64_t responder_spi,int src_addr,int dst_addr,struct tunnel* tunnel);
+int check_ike_spi(uint64_t initiator_spi,uint64_t responder_spi,struct ip_addr src_addr,struct ip_addr dst_addr,struct tunnel* tunnel);
 
 /** 
- * checks whether if ike information in tunnel actually exists
+ * checks whether if ike information in tunnel actually exists, against the addresses in src_ip and dst_ip.
+ * The deadline of the tunnel found is pushed back
  * @param isakmp_hdr isakmp header containing initiator and responder spis to check
- * @param ipv4_hdr IPV4 header containing respective ip addresses of client and host to check
  * @returns 1 if information matches, 0 if otherwise
  */
-int check_if_tunnel_exists(struct rte_isakmp_hdr *isakmp_hdr,struct rte_ipv4_hdr *ipv4_hdr);
+int check_if_tunnel_exists(struct rte_isakmp_hdr *isakmp_hdr);
+
+/**
+ * Gets the IKE part of a tunnel of the calling thread
+ * @param tunnel tunnel
+ * @returns the IKE part, under the handle of the tunnel
+ */
+struct tunnel_ike *tunnel_ike(const struct tunnel *tunnel);
+
+/**
+ * Gets the tunnel of the calling thread an IKE part belongs to
+ * @param ike IKE part of a tunnel
+ * @returns the tunnel, under the handle of the IKE part
+ */
+struct tunnel *tunnel_from_ike(const struct tunnel_ike *ike);
+
+/** 
+ * checks whether if a tunnel links two addresses, in either direction
+ * @param tunnel tunnel to check
+ * @param src_addr source address of packet
+ * @param dst_addr destination address of packet
+ * @returns whether if the addresses are those of the tunnel
+ */
+static inline bool
+tunnel_links(const struct tunnel *tunnel, const struct ip_addr *src_addr, const struct ip_addr *dst_addr){
+    return (ip_addr_equal(tunnel->client_ip,*src_addr) && ip_addr_equal(tunnel->host_ip,*dst_addr)) ||
+    (ip_addr_equal(tunnel->host_ip,*src_addr) && ip_addr_equal(tunnel->client_ip,*dst_addr));
+}
+
+/**
+ * Sets up a child SA negotiated on a tunnel of the calling thread, whose spis are learnt from its first ESP packets.
+ * A tunnel with every slot taken retires one that carried no ESP packet since the last sweep, or else the oldest
+ * @param tunnel authenticated tunnel, or one authenticating
+ * @param seconds seconds the spis can be learnt for, 0 for as long as the tunnel lives
+ */
+void child_sa_negotiated(struct tunnel *tunnel, uint32_t seconds);
+
+/**
+ * Checks whether if a tunnel of the calling thread expects the spi of a new ESP SA in a direction
+ * @param tunnel authenticated tunnel
+ * @param dir an esp_dir
+ */
+bool child_sa_awaits(const struct tunnel *tunnel, uint8_t dir);
+
+/**
+ * Learns the spi of a direction of a child SA negotiated on a tunnel of the calling thread from its first ESP
+ * packet. The SA is indexed and its replay window starts from the packet, and the tunnel file is pointed at it
+ * once both spis are learnt
+ * @param tunnel authenticated tunnel
+ * @param dir direction of the packet
+ * @param spi spi from the ESP header
+ * @param seq sequence number from the ESP header
+ * @returns the child SA, -1 if the tunnel expects no new spi in that direction
+ */
+int child_sa_learn(struct tunnel *tunnel, uint8_t dir, rte_be32_t spi, uint32_t seq);
+
+/**
+ * Retires the child SAs of a tunnel of the calling thread that carried no ESP packet since the last sweep
+ * while another did, which is what happens to the SAs replaced by a rekey. Called when the timer of the tunnel
+ * fires while it is active
+ * @param tunnel authenticated tunnel
+ */
+void child_sa_sweep(struct tunnel *tunnel);
+
+/**
+ * Schedules the timer of a tunnel of the calling thread
+ * @param tunnel tunnel to schedule
+ * @param timer_class what the tunnel is waiting for
+ * @param seconds seconds from current_tick the tunnel times out in
+ */
+void tunnel_timer_arm(struct tunnel *tunnel, uint8_t timer_class, uint32_t seconds);
+
+/**
+ * Pushes the deadline of a tunnel back on activity, to the idle timeout once authenticated. The timer is
+ * only moved if the deadline comes earlier, so this is cheap enough for every packet
+ * @param tunnel tunnel with activity
+ */
+static inline void
+tunnel_touch(struct tunnel *tunnel){
+    const uint8_t timer_class = tunnel->auth ? TUNNEL_TIMER_IDLE : TUNNEL_TIMER_HALF_OPEN;
+    const uint64_t deadline = current_tick + (tunnel->auth ? TUNNEL_IDLE_TIMEOUT : TUNNEL_HALF_OPEN_TIMEOUT) * TIMER_HZ;
+    //the timer is never due after the deadline, so it only has to move when the deadline comes earlier
+    if(deadline < tunnel->deadline){
+        tunnel_timer_arm(tunnel,timer_class,tunnel->auth ? TUNNEL_IDLE_TIMEOUT : TUNNEL_HALF_OPEN_TIMEOUT);
+        return;
+    }
+    tunnel->timer_class = timer_class;
+    tunnel->deadline = deadline;
+}
 #endif
 
@@ -4,25 +4,112 @@
 #include <stdio.h>
 #include <time.h>
 #include <string.h>
+#include <stdbool.h>
 #include <systemd/sd-journal.h>
+#include <rte_ring.h>
+#include <rte_mempool.h>
 #include "../deps/b64/b64.h"
 
+/// Bytes of a log line each event handed to the logging stage carries, longer lines span several events
+#define LOG_EVENT_SIZE 240
+/// Longest log line the logging stage writes whole, longer ones are cut and counted
+#define LOG_LINE_MAX 4096
+
 static char *directory = "/var/log/snart";
 /// IPsec log
 static const char *ipsec_log = "/var/log/snart/ipsec.log";
 /// Malicious traffic log
 static const char *main_log = "/var/log/snart/monitor.log";
-/// Saved tunnel log
+/// Saved tunnel log, replaced by the tunnel journal and only read to move its tunnels there
 static const char *tunnel_log = "/var/log/snart/tunnels.log";
+/// Journal of the saved tunnels
+static const char *tunnel_journal_file = "/var/log/snart/tunnels.journal";
+/// Snapshot of the tunnels taken when the workers stop
+static const char *tunnel_snapshot_file = "/var/log/snart/tunnels.snapshot";
+
+/**
+ * @struct log_event
+ * @brief Part of a log line handed from a parse worker to the logging stage of the pipeline. The events of a
+ * line are enqueued together so that they reach the logging stage one after the other
+ */
+struct log_event{
+    /** file to write the log to */
+    const char *file_name;
+    /** priority of the log */
+    int priority;
+    /** bytes of log */
+    uint16_t length;
+    /** whether the line goes on in the next event */
+    bool more;
+    /** part of the log line, not terminated */
+    char log[LOG_EVENT_SIZE];
+};
+
+/**
+ * @struct log_stage_stats
+ * @brief Counters of the logging stage
+ */
+struct log_stage_stats{
+    /** log lines written */
+    uint64_t written;
+    /** log lines dropped because the ring or the event pool was full */
+    uint64_t drops;
+    /** log lines longer than LOG_LINE_MAX, cut to it */
+    uint64_t truncated;
+    /** highest number of events seen waiting in the ring */
+    unsigned peak;
+};
 
 /**
- * Write log into systemd log and a stored log file
+ * Write log into systemd log and a stored log file. When the logging stage is running, the log is
+ * only queued and written later by the logging stage
  * @param file_name filename to write log to
  * @param log String to write to log
  * @param priority of the log
  */
 void write_log(char* file_name,char*log,int priority);
 
+/**
+ * Creates the ring and event pool of the logging stage. Once called, write_log no longer writes
+ * logs itself and log_stage_poll has to be called to write them
+ * @param ring_size number of events that can be queued, must be a power of 2
+ * @param socket_id socket to allocate the ring and pool on
+ * @returns 0 on success, -1 if otherwise
+ */
+int log_stage_init(unsigned ring_size,int socket_id);
+
+/**
+ * Writes the log lines of a burst of the events queued for the logging stage. A line whose events are not
+ * all dequeued yet is written by a later call
+ * @returns number of events dequeued
+ */
+unsigned log_stage_poll(void);
+
+/**
+ * Gets the ring feeding the logging stage
+ * @returns the ring, NULL if the logging stage is not used
+ */
+struct rte_ring *log_stage_ring(void);
+
+/**
+ * Gets the counters of the logging stage
+ * @param stats struct to copy the counters to
+ */
+void log_stage_get_stats(struct log_stage_stats *stats);
+
+/**
+ * Write log into systemd log and a stored log file straight away, even if the logging stage is running
+ * @param file_name filename to write log to
+ * @param log String to write to log
+ * @param priority of the log
+ */
+void write_log_now(const char* file_name,const char*log,int priority);
+
+/**
+ * Creates the log directory if it does not exist yet, which also holds the tunnel journal and snapshot
+ */
+void create_log_directory(void);
+
 /**
  * Gets current time in the format dd/mm/yyyy hh:MM:ss format
  * @param buf string to store the formatted string
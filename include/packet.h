@@ -0,0 +1,27 @@
+#ifndef PACKET_H
+#define PACKET_H
+
+#include <stdint.h>
+#include <rte_mbuf.h>
+
+/**
+ * Makes a mbuf header point at packet data that does not live in a mempool, such as a packet
+ * mapped from a capture file. The analysis code can then read the packet the same way as one
+ * received from a port. The view must never be freed with rte_pktmbuf_free
+ * @param view mbuf header to use as the view
+ * @param data start of the packet
+ * @param len length of the packet
+ */
+static inline void
+pkt_view_init(struct rte_mbuf *view, const void *data, uint16_t len){
+    view->buf_addr = (void *)(uintptr_t)data;
+    view->data_off = 0;
+    view->data_len = len;
+    view->pkt_len = len;
+    view->nb_segs = 1;
+    view->next = NULL;
+    view->ol_flags = 0;
+    view->packet_type = 0;
+}
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef PARSE_H
+#define PARSE_H
+
+#include <stdint.h>
+#include <rte_mbuf.h>
+#include <rte_mbuf_ptype.h>
+
+/// Most VLAN tags skipped before the ip header
+#define PARSE_MAX_VLANS 4
+/// Most IPv6 extension headers skipped before the layer 4 header
+#define PARSE_MAX_IPV6_EXTS 8
+
+/**
+ * @struct pkt_desc
+ * @brief Offsets of the headers of a packet, found once by parse_packet and reused by every later stage.
+ * Small enough to be carried in a mbuf dynamic field
+ */
+struct pkt_desc{
+    /** packet type down to layer 4. The layer 3 type is unknown for packets that are not ip and the
+        layer 4 type for ip packets too short for their headers */
+    uint32_t ptype;
+    /** offset of the ip header, after the VLAN tags */
+    uint16_t l3_offset;
+    /** offset of the layer 4 header, after the IPv4 options or IPv6 extension headers. For fragments,
+        offset of the fragment payload, right after the IPv6 fragment header */
+    uint16_t l4_offset;
+    /** offset of the udp payload, or of the ESP header of ESP directly over ip. 0 if the packet is
+        neither or too short for the udp header */
+    uint16_t payload_offset;
+    /** protocol of the layer 4 header */
+    uint8_t l4_proto;
+    /** class the packet was sorted into */
+    uint8_t pkt_class;
+    /** udp or tcp ports in host byte order, 0 if the packet is neither */
+    uint16_t src_port;
+    uint16_t dst_port;
+};
+
+/**
+ * Walks the headers of a packet once and records their offsets. VLAN and QinQ tags, IPv4 options and
+ * IPv6 extension headers are skipped. ESP directly over ip gets the RTE_PTYPE_TUNNEL_ESP packet type. The packet type set by the port is used to skip the walk down
+ * to layer 3 when it shows a plain ethernet frame with an IPv4 header without options
+ * @param pkt packet to parse
+ * @param desc descriptor to fill
+ */
+void parse_packet(const struct rte_mbuf *pkt,struct pkt_desc *desc);
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef PCAP_H
+#define PCAP_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <rte_mbuf.h>
+#include "packet.h"
+
+/// Most interfaces described in a pcapng section that are kept track of
+#define PCAP_MAX_INTERFACES 16
+/// Ethernet link type, the only one that can be analysed
+#define PCAP_LINKTYPE_ETHERNET 1
+
+/**
+ * @struct pcap_file
+ * @brief A pcap or pcapng capture file mapped into memory
+ */
+struct pcap_file{
+    /** start of the mapped file */
+    const uint8_t *data;
+    /** size of the file */
+    size_t size;
+    /** offset of the next record or block to read */
+    size_t offset;
+    /** whether if the file is pcapng rather than pcap */
+    bool pcapng;
+    /** whether if the file was written with the other byte order */
+    bool swapped;
+    /** link type of the pcap file or of each interface of the current pcapng section */
+    uint16_t linktype[PCAP_MAX_INTERFACES];
+    /** snapshot length of each interface of the current pcapng section */
+    uint32_t snaplen[PCAP_MAX_INTERFACES];
+    /** number of interfaces described in the current pcapng section */
+    uint32_t nb_interfaces;
+    /** packets skipped because they are not ethernet or are too large */
+    uint64_t skipped;
+};
+
+/**
+ * Maps a pcap or pcapng file into memory and reads its header
+ * @param file struct to store the mapped file in
+ * @param path path of the capture file
+ * @returns 0 on success, -1 if the file cannot be read or is not a capture file
+ */
+int pcap_open(struct pcap_file *file,const char *path);
+
+/**
+ * Gets the next packets of the file as packet views pointing into the mapped file, no data is copied
+ * @param file mapped capture file
+ * @param views mbuf headers to use as views, at least n of them
+ * @param pkts array that gets pointers to the views filled
+ * @param n most packets to read
+ * @returns number of packets read, 0 once the end of the file is reached
+ */
+uint16_t pcap_next_burst(struct pcap_file *file,struct rte_mbuf *views,struct rte_mbuf **pkts,uint16_t n);
+
+/**
+ * Unmaps a capture file
+ * @param file mapped capture file
+ */
+void pcap_close(struct pcap_file *file);
+
+#endif
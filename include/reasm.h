@@ -0,0 +1,112 @@
+#ifndef REASM_H
+#define REASM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <rte_mbuf.h>
+#include "ike.h"
+#include "parse.h"
+#include "packet.h"
+
+/// Most datagrams being reassembled at once by a worker
+#define REASM_MAX_FLOWS 64
+/// Most bytes of fragments held by a worker, fragments that do not fit are dropped
+#define REASM_MEMORY_CAP (2 << 20)
+/// Seconds after the first fragment of a datagram after which it is given up on
+#define REASM_TIMEOUT 5
+/// Size of the units fragment offsets are counted in
+#define REASM_UNIT 8
+/// Largest datagram reassembled, headers included, so that it fits a packet view
+#define REASM_MAX_SIZE UINT16_MAX
+/// Room kept in front of the payload for the headers of the first fragment
+#define REASM_MAX_HDR 256
+
+/// What became of a fragment given to reasm_add
+enum reasm_result{
+    /** held until the other fragments of its datagram arrive */
+    REASM_HELD,
+    /** completed its datagram, which is returned */
+    REASM_DONE,
+    /** belongs to a datagram that is not IKE, it is not held */
+    REASM_NOT_IKE,
+    /** dropped because the table or the memory cap is full */
+    REASM_DROPPED,
+    /** overlaps or runs past the other fragments, its datagram is dropped */
+    REASM_MALFORMED
+};
+
+/**
+ * @struct reasm_flow
+ * @brief A datagram being reassembled, identified by its addresses, protocol and ip id
+ */
+struct reasm_flow{
+    struct ip_addr src;
+    struct ip_addr dst;
+    uint32_t id;
+    uint8_t proto;
+    bool used;
+    /** the first fragment showed a datagram that is not IKE, later fragments are only counted */
+    bool not_ike;
+    /** seconds at the first fragment */
+    uint64_t start;
+    /** REASM_MAX_HDR bytes ending with the headers of the first fragment, followed by the payload.
+        NULL until a fragment is held */
+    uint8_t *buf;
+    /** bytes allocated for buf */
+    uint32_t buf_size;
+    /** length of the headers in front of the payload, 0 until the first fragment arrives */
+    uint16_t hdr_len;
+    /** descriptor of the first fragment */
+    struct pkt_desc desc;
+    /** payload length, 0 until the last fragment arrives */
+    uint32_t total;
+    /** payload bytes received */
+    uint32_t received;
+    /** units of payload received, one bit each */
+    uint64_t units[(REASM_MAX_SIZE / REASM_UNIT + 63) / 64];
+};
+
+/**
+ * @struct reasm_table
+ * @brief Datagrams being reassembled by a worker. Each worker owns its table as all fragments of a
+ * datagram share the addresses workers are picked with
+ */
+struct reasm_table{
+    struct reasm_flow flows[REASM_MAX_FLOWS];
+    /** bytes allocated for the flows */
+    uint32_t memory;
+    /** datagrams reassembled */
+    uint64_t reassembled;
+    /** datagrams given up on after REASM_TIMEOUT */
+    uint64_t timeouts;
+    /** fragments dropped because the table or memory cap was full */
+    uint64_t drops;
+    /** datagrams dropped because of overlapping or oversized fragments */
+    uint64_t malformed;
+    /** buffer of the last datagram reassembled, freed on the next call */
+    uint8_t *done;
+    /** view of the last datagram reassembled */
+    struct rte_mbuf view;
+};
+
+/**
+ * Allocates an empty table
+ * @returns the table, NULL if it cannot be allocated
+ */
+struct reasm_table *reasm_create(void);
+
+/**
+ * Adds an ipv4 or ipv6 udp fragment to the datagram it belongs to. Only datagrams whose first
+ * fragment shows udp port 500 or 4500 are kept, and the fragments of a datagram are given up on
+ * REASM_TIMEOUT seconds after the first arrives
+ * @param table table of the calling worker
+ * @param pkt fragment
+ * @param desc descriptor of the fragment
+ * @param datagram set to a view of the reassembled datagram on REASM_DONE, valid until the next call
+ * @param datagram_desc set to the descriptor of the reassembled datagram on REASM_DONE
+ * @returns what became of the fragment
+ */
+enum reasm_result reasm_add(struct reasm_table *table, const struct rte_mbuf *pkt, const struct pkt_desc *desc,
+struct rte_mbuf **datagram, struct pkt_desc *datagram_desc);
+
+#endif
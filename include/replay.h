@@ -0,0 +1,145 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/// Sizes of the anti-replay window, in sequence numbers, a power of two
+#define REPLAY_WINDOW_MIN 64
+#define REPLAY_WINDOW_MAX 4096
+
+/// What an ESP sequence number is to the window of its direction
+enum replay_result{
+    /** ahead of every number seen, the window slides up to it */
+    REPLAY_NEW = 0,
+    /** behind the highest number seen but within the window and not seen yet */
+    REPLAY_REORDERED,
+    /** within the window and already seen */
+    REPLAY_REPLAYED,
+    /** behind the window */
+    REPLAY_TOO_OLD
+};
+
+/**
+ * @struct replay_window
+ * @brief Anti-replay window of a direction of a child SA (RFC 4303 section 3.4.3). The bitmap is used as
+ * a ring indexed by the sequence number, with twice as many bits as the window so that sliding it only
+ * clears the words it moves past, whatever the size of the window (RFC 6479)
+ */
+struct replay_window{
+    /** highest sequence number seen, with the upper half of an extended sequence number */
+    uint64_t top;
+    /** bit seq % (2 * size) is set once seq is seen, for the numbers of the window */
+    uint64_t bits[];
+};
+
+/**
+ * @struct replay_table
+ * @brief Anti-replay windows of the child SAs of the tunnels of a worker, both directions of a child SA side
+ * by side. They are kept out of the tunnels as their size is only known at startup
+ */
+struct replay_table{
+    uint8_t *windows;
+    /** sequence numbers of each window */
+    uint32_t size;
+    /** words of each bitmap minus one */
+    uint32_t word_mask;
+    /** bytes of each window */
+    uint32_t stride;
+};
+
+/**
+ * Allocates the windows of the child SAs of a pool of tunnels
+ * @param capacity child SAs of the pool
+ * @param size sequence numbers of each window, a power of two between REPLAY_WINDOW_MIN and REPLAY_WINDOW_MAX
+ * @returns the table, NULL if it cannot be allocated
+ */
+struct replay_table *replay_table_create(uint32_t capacity, uint32_t size);
+
+/**
+ * Gets the window of a direction of a child SA
+ * @param table table of the pool of the tunnel
+ * @param sa index of the child SA among those of the pool
+ * @param dir an esp_dir
+ */
+static inline struct replay_window *
+replay_window(const struct replay_table *table, uint32_t sa, uint8_t dir){
+    return (struct replay_window *)(table->windows + ((uint64_t)sa * 2 + dir) * table->stride);
+}
+
+/**
+ * Restarts a window from a sequence number, as the first seen on its SA
+ * @param table table of the window
+ * @param window window to restart
+ * @param seq sequence number from the ESP header
+ */
+void replay_window_reset(const struct replay_table *table, struct replay_window *window, uint32_t seq);
+
+/**
+ * Empties a window, which then takes any sequence number as new. Used for SAs whose numbers went on while
+ * they were not watched
+ * @param table table of the window
+ * @param window window to empty
+ */
+void replay_window_clear(const struct replay_table *table, struct replay_window *window);
+
+/**
+ * Gets the sequence numbers seen among the 64 closest to the highest of a window, to save it
+ * @param table table of the window
+ * @param window window to read
+ * @returns bit i set if top - 63 + i was seen
+ */
+uint64_t replay_window_recent(const struct replay_table *table, const struct replay_window *window);
+
+/**
+ * Restores a saved window. The numbers further behind than the 64 saved are taken as seen, flagging a packet
+ * reordered that far across a restart rather than letting a replay of it through
+ * @param table table of the window
+ * @param window window to restore
+ * @param top highest sequence number seen, 0 for a window that takes any number as new
+ * @param recent numbers seen among the 64 closest to top, as returned by replay_window_recent
+ */
+void replay_window_restore(const struct replay_table *table, struct replay_window *window, uint64_t top, uint64_t recent);
+
+/**
+ * Checks a sequence number against a window and marks it as seen if it is new or reordered. Only the low
+ * half of an extended sequence number is sent: the upper half taken is the one that puts the number
+ * closest to the highest seen, so the window carries on past 2^32 on an SA with extended sequence numbers,
+ * which is the only way one without can go on after 2^32 - 1 rather than rekeying
+ * @param table table of the window
+ * @param window window of the SA of the packet
+ * @param seq sequence number from the ESP header
+ * @returns what the number is to the window
+ */
+static inline enum replay_result
+replay_check(const struct replay_table *table, struct replay_window *window, uint32_t seq){
+    const uint64_t top = window->top;
+    //the difference of the low halves taken as signed is the distance from top
+    const int64_t delta = (int32_t)(seq - (uint32_t)top);
+    const uint64_t seq64 = delta < 0 && (uint64_t)-delta > top ? seq : top + delta;
+    uint64_t *word = &window->bits[(seq64 >> 6) & table->word_mask];
+    const uint64_t bit = 1ULL << (seq64 & 63);
+    if(seq64 > top){
+        //clear the words the window moves past, at most the whole bitmap
+        uint64_t words = (seq64 >> 6) - (top >> 6);
+        if(words > table->word_mask + 1){
+            words = table->word_mask + 1;
+        }
+        for(uint64_t i = 1; i <= words; i++){
+            window->bits[((top >> 6) + i) & table->word_mask] = 0;
+        }
+        window->top = seq64;
+        *word |= bit;
+        return REPLAY_NEW;
+    }
+    if(top - seq64 >= table->size){
+        return REPLAY_TOO_OLD;
+    }
+    if(*word & bit){
+        return REPLAY_REPLAYED;
+    }
+    *word |= bit;
+    return REPLAY_REORDERED;
+}
+
+#endif
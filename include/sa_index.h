@@ -0,0 +1,205 @@
+#ifndef SA_INDEX_H
+#define SA_INDEX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <rte_hash_crc.h>
+#include <rte_prefetch.h>
+#include "ike.h"
+
+/// Fewest slots of an index, a power of two
+#define SA_INDEX_INIT_SIZE 1024
+/// Most ESP SAs a tunnel indexes: the entry of each direction, which also finds the child SAs being learnt,
+/// and the spi of each direction of every child SA, as all of them may be active while a rekey overlaps
+#define ESP_SAS_PER_TUNNEL (2 + 2 * TUNNEL_CHILD_SAS)
+
+/**
+ * @struct ike_sa_slot
+ * @brief Slot of the IKE SA index. The spis are kept in the slot so that probing does not touch the
+ * tunnels that do not match
+ */
+struct ike_sa_slot{
+    rte_be64_t initiator_spi;
+    rte_be64_t responder_spi;
+    /** tunnel of the IKE SA, NULL if the slot is free */
+    struct tunnel *tunnel;
+};
+
+/**
+ * @struct ike_sa_index
+ * @brief Open addressing hash table from the spi pair of an IKE SA to its tunnel. Each worker owns
+ * the index of its tunnels. Several tunnels may share a spi pair, the addresses tell them apart. The table
+ * is allocated once for the most IKE SAs the worker holds, and removing one shifts back the entries probing
+ * past it rather than leaving a marker, so that churn never makes the table grow or be rebuilt
+ */
+struct ike_sa_index{
+    struct ike_sa_slot *slots;
+    /** number of slots minus one */
+    uint32_t mask;
+    /** tunnels indexed */
+    uint32_t count;
+    /** seed of the hash, random so that peers cannot pick spis that collide */
+    uint32_t seed;
+};
+
+/// Hashes the spi pair of an IKE SA
+static inline uint32_t
+ike_sa_hash(const struct ike_sa_index *index, uint64_t initiator_spi, uint64_t responder_spi){
+    return rte_hash_crc_8byte(responder_spi,rte_hash_crc_8byte(initiator_spi,index->seed));
+}
+
+/**
+ * Prefetches the slot an IKE SA is looked up from, so that looking up the IKE SAs of a burst only
+ * waits for memory once
+ * @param index index of the calling worker
+ * @param initiator_spi initiator spi from the isakmp header
+ * @param responder_spi responder spi from the isakmp header
+ */
+static inline void
+ike_sa_index_prefetch(const struct ike_sa_index *index, uint64_t initiator_spi, uint64_t responder_spi){
+    rte_prefetch0(&index->slots[ike_sa_hash(index,initiator_spi,responder_spi) & index->mask]);
+}
+
+/**
+ * Allocates an empty index
+ * @param capacity most IKE SAs the index holds
+ * @returns the index, NULL if it cannot be allocated
+ */
+struct ike_sa_index *ike_sa_index_create(uint32_t capacity);
+
+/**
+ * Indexes a tunnel under its spi pair. The tunnel must not move or change spis until it is removed
+ * @param index index of the calling worker
+ * @param tunnel tunnel to index
+ * @returns 0 on success, -1 if three quarters of the slots are taken
+ */
+int ike_sa_index_add(struct ike_sa_index *index, struct tunnel *tunnel);
+
+/**
+ * Removes a tunnel from the index
+ * @param index index of the calling worker
+ * @param tunnel tunnel to remove, as it was added
+ */
+void ike_sa_index_del(struct ike_sa_index *index, struct tunnel *tunnel);
+
+/**
+ * Looks up the tunnel of an IKE SA, whose addresses must be the packet's in either direction
+ * @param index index of the calling worker
+ * @param initiator_spi initiator spi from the isakmp header
+ * @param responder_spi responder spi from the isakmp header
+ * @param src_addr source address of the packet
+ * @param dst_addr destination address of the packet
+ * @returns the tunnel, NULL if there is none
+ */
+struct tunnel *ike_sa_index_lookup(const struct ike_sa_index *index, uint64_t initiator_spi, uint64_t responder_spi,
+struct ip_addr src_addr, struct ip_addr dst_addr);
+
+/**
+ * @struct esp_sa_slot
+ * @brief Slot of the ESP SA index
+ */
+struct esp_sa_slot{
+    /** tunnel of the SA, NULL if the slot is free */
+    struct tunnel *tunnel;
+    /** spi of the SA as found in the ESP header, 0 for the entry of a direction of a tunnel */
+    rte_be32_t spi;
+    /** direction of the tunnel the SA is used in */
+    uint8_t dir;
+    /** child SA of the tunnel the spi belongs to */
+    uint8_t child;
+};
+
+/**
+ * @struct esp_sa_index
+ * @brief Open addressing hash table from the source address, destination address and spi of an ESP
+ * packet to the tunnel, direction and child SA it belongs to. Every direction of an authenticated tunnel
+ * has an entry with spi 0, which finds the tunnel of a packet whose spi is not indexed, either because
+ * the tunnel has yet to learn it or because it is the wrong one. Like the IKE SA index, it is allocated once
+ * and removing an SA shifts back the entries probing past it
+ */
+struct esp_sa_index{
+    struct esp_sa_slot *slots;
+    /** number of slots minus one */
+    uint32_t mask;
+    /** SAs indexed */
+    uint32_t count;
+    /** seed of the hash, random so that peers cannot pick spis that collide */
+    uint32_t seed;
+};
+
+/// Hashes the addresses and spi of an ESP packet
+static inline uint32_t
+esp_sa_hash(const struct esp_sa_index *index, const struct ip_addr *src, const struct ip_addr *dst, rte_be32_t spi){
+    uint32_t hash = rte_hash_crc_4byte(spi,index->seed);
+    hash = rte_hash_crc_8byte(src->halves[0],hash);
+    hash = rte_hash_crc_8byte(src->halves[1],hash);
+    hash = rte_hash_crc_8byte(dst->halves[0],hash);
+    return rte_hash_crc_8byte(dst->halves[1],hash);
+}
+
+/**
+ * Prefetches the slot an ESP packet is looked up from, so that looking up the ESP packets of a burst
+ * only waits for memory once
+ * @param index index of the calling worker
+ * @param src source address of the packet
+ * @param dst destination address of the packet
+ * @param spi spi from the ESP header
+ */
+static inline void
+esp_sa_index_prefetch(const struct esp_sa_index *index, const struct ip_addr *src, const struct ip_addr *dst, rte_be32_t spi){
+    rte_prefetch0(&index->slots[esp_sa_hash(index,src,dst,spi) & index->mask]);
+}
+
+/**
+ * Allocates an empty index
+ * @param capacity most ESP SAs the index holds
+ * @returns the index, NULL if it cannot be allocated
+ */
+struct esp_sa_index *esp_sa_index_create(uint32_t capacity);
+
+/**
+ * Indexes an ESP SA of a tunnel. The tunnel must not move or change addresses until it is removed
+ * @param index index of the calling worker
+ * @param tunnel tunnel of the SA
+ * @param dir direction the SA is used in
+ * @param spi spi of the SA, 0 for the entry of the direction
+ * @param child child SA of the tunnel the spi belongs to, 0 for the entry of the direction
+ * @returns 0 on success, -1 if three quarters of the slots are taken
+ */
+int esp_sa_index_add(struct esp_sa_index *index, struct tunnel *tunnel, uint8_t dir, rte_be32_t spi, uint8_t child);
+
+/**
+ * Removes an ESP SA of a tunnel from the index, if it was indexed
+ * @param index index of the calling worker
+ * @param tunnel tunnel of the SA
+ * @param dir direction the SA is used in
+ * @param spi spi of the SA, 0 for the entry of the direction
+ */
+void esp_sa_index_del(struct esp_sa_index *index, struct tunnel *tunnel, uint8_t dir, rte_be32_t spi);
+
+/**
+ * Looks up the tunnel of an ESP packet by its spi. A packet with spi 0 is never found this way
+ * @param index index of the calling worker
+ * @param src source address of the packet
+ * @param dst destination address of the packet
+ * @param spi spi from the ESP header
+ * @param dir set to the direction of the packet in the tunnel found
+ * @param child set to the child SA of the tunnel the spi belongs to
+ * @returns the tunnel, NULL if the spi is not indexed for the addresses
+ */
+struct tunnel *esp_sa_index_lookup(const struct esp_sa_index *index, const struct ip_addr *src, const struct ip_addr *dst,
+rte_be32_t spi, uint8_t *dir, uint8_t *child);
+
+/**
+ * Looks up the tunnel of an ESP packet whose spi is not indexed by its addresses alone. A tunnel that
+ * expects the spi of a new child SA in that direction is preferred
+ * @param index index of the calling worker
+ * @param src source address of the packet
+ * @param dst destination address of the packet
+ * @param dir set to the direction of the packet in the tunnel found
+ * @returns the tunnel, NULL if no authenticated tunnel links the addresses
+ */
+struct tunnel *esp_sa_index_lookup_pair(const struct esp_sa_index *index, const struct ip_addr *src, const struct ip_addr *dst,
+uint8_t *dir);
+
+#endif
@@ -0,0 +1,128 @@
+#ifndef SOURCE_LIMIT_H
+#define SOURCE_LIMIT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ike.h"
+#include "timer_wheel.h"
+
+/// Sources a limiter keeps a budget for, a power of two
+#define SOURCE_LIMIT_SIZE 4096
+/// Sources sharing the slots of a set, an address can only get a slot of its set
+#define SOURCE_LIMIT_WAYS 4
+
+/**
+ * @struct token_bucket
+ * @brief Budget of events refilled at a steady rate up to a burst. Credit is counted in ticks so that
+ * refilling needs no division: each event costs TIMER_HZ and each tick adds the rate
+ */
+struct token_bucket{
+    /** tick the credit was last refilled at */
+    uint64_t updated;
+    uint64_t credit;
+};
+
+/**
+ * Refills a bucket up to now and takes an event from it if it can afford one
+ * @param bucket bucket to take from
+ * @param now current tick
+ * @param rate events per second
+ * @param burst most events taken at once
+ * @returns whether if the event is within the budget
+ */
+static inline bool
+token_bucket_take(struct token_bucket *bucket, uint64_t now, uint32_t rate, uint32_t burst){
+    if(now > bucket->updated){
+        bucket->credit += (now - bucket->updated) * rate;
+        if(bucket->credit > (uint64_t)burst * TIMER_HZ){
+            bucket->credit = (uint64_t)burst * TIMER_HZ;
+        }
+        bucket->updated = now;
+    }
+    if(bucket->credit < TIMER_HZ){
+        return false;
+    }
+    bucket->credit -= TIMER_HZ;
+    return true;
+}
+
+/**
+ * Checks whether if a bucket is refilled up to its burst by now, so that starting it over gives nothing away
+ * @param bucket bucket to check
+ * @param now current tick
+ * @param rate events per second
+ * @param burst most events taken at once
+ * @returns whether if the bucket is full
+ */
+static inline bool
+token_bucket_full(const struct token_bucket *bucket, uint64_t now, uint32_t rate, uint32_t burst){
+    const uint64_t elapsed = now > bucket->updated ? now - bucket->updated : 0;
+    return bucket->credit + elapsed * rate >= (uint64_t)burst * TIMER_HZ;
+}
+
+/**
+ * @struct source_bucket
+ * @brief Budget of a source address
+ */
+struct source_bucket{
+    struct ip_addr addr;
+    struct token_bucket bucket;
+    /** whether if the last event of the source was over its budget */
+    bool over;
+};
+
+/**
+ * @struct source_set
+ * @brief Sources whose addresses hash to the same set
+ */
+struct source_set{
+    /** sources with a budget of their own, unused while updated is 0 */
+    struct source_bucket ways[SOURCE_LIMIT_WAYS];
+    /** budget shared by the sources of the set left without a slot, addr is the last one charged */
+    struct source_bucket shared;
+};
+
+/**
+ * @struct source_limiter
+ * @brief Per source budgets of a worker, in a fixed table so that floods from spoofed addresses cannot
+ * make it grow. An address takes a slot of its set only from a source whose budget has refilled to a full
+ * burst, so that taking it over gives nothing away. While every slot of the set is held by a source still
+ * using its budget, a new address is charged against the budget the set shares for such sources: a flood
+ * of addresses that collide can never mint credit, and sources that hold a slot keep theirs
+ */
+struct source_limiter{
+    struct source_set sets[SOURCE_LIMIT_SIZE / SOURCE_LIMIT_WAYS];
+    /** events per second of each source */
+    uint32_t rate;
+    /** most events a source can have at once */
+    uint32_t burst;
+    /** seed of the hash, random so that sources cannot pick addresses that collide */
+    uint32_t seed;
+};
+
+/**
+ * Allocates a limiter with no source
+ * @param rate events per second of each source
+ * @param burst most events a source can have at once
+ * @returns the limiter, NULL if it cannot be allocated
+ */
+struct source_limiter *source_limiter_create(uint32_t rate, uint32_t burst);
+
+/**
+ * Takes an event from the budget of a source
+ * @param limiter limiter of the calling worker
+ * @param addr address of the source
+ * @param now current tick
+ * @returns whether if the event is within the budget of the source
+ */
+bool source_limit_take(struct source_limiter *limiter, const struct ip_addr *addr, uint64_t now);
+
+/**
+ * Checks whether if the last event of a source was over its budget, without taking one
+ * @param limiter limiter of the calling worker
+ * @param addr address of the source
+ * @returns whether if the source is over its budget, false for a source not seen lately
+ */
+bool source_limit_over(const struct source_limiter *limiter, const struct ip_addr *addr);
+
+#endif
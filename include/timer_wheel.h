@@ -0,0 +1,88 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/// Ticks of a timer wheel per second
+#define TIMER_HZ 100
+/// Slots of each level of a wheel, as a power of two
+#define TIMER_WHEEL_BITS 8
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+/// Levels of a wheel, each slot of a level spanning a whole turn of the level below. Four levels reach
+/// 2^32 ticks ahead, further deadlines are clamped
+#define TIMER_WHEEL_LEVELS 4
+
+/**
+ * @struct timer_node
+ * @brief Timer embedded in the object it is for. A timer is in at most one slot of one wheel
+ */
+struct timer_node{
+    struct timer_node *next;
+    /** link pointing at this timer, NULL if the timer is not scheduled */
+    struct timer_node **pprev;
+    /** tick the timer is scheduled for */
+    uint64_t expires;
+};
+
+/**
+ * @struct timer_wheel
+ * @brief Hierarchical timer wheel owned by a worker. A timer goes in the lowest level whose turn reaches its
+ * deadline and moves down a level each time its slot comes up, so that scheduling and cancelling are O(1)
+ * and a tick only costs the timers in its slot
+ */
+struct timer_wheel{
+    struct timer_node *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    /** next tick to run, every earlier tick has run */
+    uint64_t now;
+    /** timers scheduled */
+    uint32_t count;
+};
+
+/// Called for each timer whose tick comes up, with the timer no longer scheduled. It may schedule it again
+typedef void (*timer_fire_t)(struct timer_wheel *wheel, struct timer_node *timer);
+
+/// Gets the object a timer is embedded in
+#define timer_container(timer,type,member) ((type *)((char *)(timer) - offsetof(type,member)))
+
+/// Gets the current tick of the monotonic clock. Cheap enough to be read for every burst
+uint64_t timer_now(void);
+
+/**
+ * Allocates a wheel with no timers
+ * @param now current tick, the first one the wheel will run
+ * @returns the wheel, NULL if it cannot be allocated
+ */
+struct timer_wheel *timer_wheel_create(uint64_t now);
+
+/**
+ * Schedules a timer, moving it if it is already scheduled
+ * @param wheel wheel of the calling worker
+ * @param timer timer to schedule
+ * @param expires tick to fire at, a past tick fires on the next run
+ */
+void timer_wheel_arm(struct timer_wheel *wheel, struct timer_node *timer, uint64_t expires);
+
+/**
+ * Unschedules a timer, if it is scheduled
+ * @param wheel wheel of the timer
+ * @param timer timer to cancel
+ */
+void timer_wheel_cancel(struct timer_wheel *wheel, struct timer_node *timer);
+
+/// Checks whether if a timer is scheduled
+static inline int
+timer_pending(const struct timer_node *timer){
+    return timer->pprev != NULL;
+}
+
+/**
+ * Runs the ticks up to now, firing the timers due
+ * @param wheel wheel of the calling worker
+ * @param now current tick
+ * @param fire called for each timer due
+ * @returns number of timers fired
+ */
+unsigned timer_wheel_run(struct timer_wheel *wheel, uint64_t now, timer_fire_t fire);
+
+#endif
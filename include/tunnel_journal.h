@@ -0,0 +1,255 @@
+#ifndef TUNNEL_JOURNAL_H
+#define TUNNEL_JOURNAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <rte_common.h>
+#include "ike.h"
+
+/// First bytes of a journal file
+#define JOURNAL_MAGIC 0x4C4E524A54524E53ULL
+/// Version of the records, a journal of another version is started over
+#define JOURNAL_VERSION 1
+/// Fewest records a journal has before it is compacted
+#define JOURNAL_COMPACT_MIN 1024
+/// A journal is compacted once it has this many records per live tunnel
+#define JOURNAL_COMPACT_RATIO 2
+/// Records each thread appending to a journal can have waiting to be written, a power of two. Those appended past
+/// it are dropped rather than waited for
+#define JOURNAL_QUEUE_SIZE (1 << 15)
+/// Bytes of records the thread of a journal writes at once
+#define JOURNAL_BUFFER_SIZE (1 << 22)
+/// Milliseconds the thread of a journal sleeps once no record waits to be written
+#define JOURNAL_POLL_MS 10
+
+/// What a journal record does to the tunnel it keys
+enum journal_type{
+    /** the tunnel learnt the spis of its first child SA */
+    JOURNAL_ADD = 1,
+    /** the child SAs of the tunnel changed */
+    JOURNAL_UPDATE,
+    /** the tunnel ended, only the key is written */
+    JOURNAL_DELETE
+};
+
+/**
+ * @struct journal_tunnel
+ * @brief Payload of a journal record. The spis and addresses of the IKE SA key the tunnel, the ESP spis
+ * follow them so that a delete only writes the key
+ */
+struct journal_tunnel{
+    uint64_t initiator_spi;
+    uint64_t responder_spi;
+    struct ip_addr client_ip;
+    struct ip_addr host_ip;
+    /** spis of each child SA with both spis learnt, indexed by esp_dir, 0 for the others */
+    rte_be32_t spi[TUNNEL_CHILD_SAS][2];
+};
+
+/// Bytes of the payload of a delete
+#define JOURNAL_KEY_SIZE offsetof(struct journal_tunnel,spi)
+
+/**
+ * @struct journal_record
+ * @brief Header of a journal record, followed by its payload
+ */
+struct journal_record{
+    /** CRC32C of the rest of the header and of the payload, a record that does not match ends the journal */
+    uint32_t crc;
+    /** an enum journal_type */
+    uint8_t type;
+    uint8_t reserved;
+    /** bytes of the payload */
+    uint16_t length;
+    /** order the record was appended in, carried on over compactions and restarts */
+    uint64_t seq;
+};
+
+/**
+ * @struct journal_entry
+ * @brief Record waiting in a journal queue, before the thread of the journal gives it a seq and a CRC
+ */
+struct journal_entry{
+    /** an enum journal_type */
+    uint8_t type;
+    struct journal_tunnel tunnel;
+};
+
+struct tunnel_journal;
+
+/**
+ * @struct journal_queue
+ * @brief Records appended by one thread, taken by the thread of the journal. Only the appending thread moves
+ * head and only the thread of the journal moves tail, so that neither locks
+ */
+struct journal_queue{
+    /** entries, a ring of JOURNAL_QUEUE_SIZE */
+    struct journal_entry *entries;
+    /** journal the queue belongs to */
+    struct tunnel_journal *journal;
+    /** entries appended */
+    uint64_t head;
+    /** records dropped because the queue was full */
+    uint64_t drops;
+    /** entries taken by the thread of the journal */
+    uint64_t tail __rte_cache_aligned;
+} __rte_cache_aligned;
+
+/**
+ * @struct journal_header
+ * @brief First bytes of a journal file
+ */
+struct journal_header{
+    uint64_t magic;
+    uint32_t version;
+    uint32_t reserved;
+};
+
+/**
+ * @struct tunnel_journal
+ * @brief Append-only file of the tunnels worth restoring on restart. Workers append a record each time a
+ * tunnel is added, changes child SAs or ends, each to a queue of its own. A thread of the journal takes the
+ * records of every queue, gives them their seq in the order it takes them and writes them to the file, so
+ * that appends neither lock nor wait for the disk. The same thread rewrites the file with the live tunnels
+ * only once records of ended or changed tunnels pile up, keeping the deletes appended after the last tunnel
+ * snapshot, which the journal is replayed over on restart. The records of a tunnel keep the order they were
+ * appended in, as they all come from the worker owning it
+ */
+struct tunnel_journal{
+    /** file records are appended to, only written by the thread of the journal */
+    int fd;
+    char *path;
+    /** guards the file, its counters and checkpoint_seq against the threads reading them */
+    pthread_mutex_t lock;
+    /** wakes the thread of the journal */
+    pthread_cond_t wake;
+    pthread_t thread;
+    /** queue of each thread appending */
+    struct journal_queue *queues;
+    uint16_t nb_queues;
+    /** records being written, JOURNAL_BUFFER_SIZE bytes, only used by the thread of the journal */
+    uint8_t *buffer;
+    /** seq of the next record taken from the queues, only written by the thread of the journal */
+    uint64_t next_seq;
+    /** seq of the last record of the tunnel snapshot, UINT64_MAX if there is none */
+    uint64_t checkpoint_seq;
+    /** bytes of the file */
+    uint64_t size;
+    /** records in the file */
+    uint64_t records;
+    /** tunnels added and not deleted */
+    uint64_t live;
+    /** compactions done since the journal was opened */
+    uint64_t compactions;
+    /** records that could not be written */
+    uint64_t errors;
+    /** records the file must have before compacting again after a compaction failed, 0 if none did */
+    uint64_t retry_at;
+    /** whether if appends wait for room in a full queue rather than drop the record */
+    bool wait;
+    bool stop;
+};
+
+/**
+ * @struct tunnel_journal_stats
+ * @brief Counters of a journal
+ */
+struct tunnel_journal_stats{
+    /** records in the file */
+    uint64_t records;
+    /** tunnels the file holds */
+    uint64_t live;
+    uint64_t compactions;
+    /** records that could not be written or were dropped from a full queue */
+    uint64_t errors;
+};
+
+/**
+ * Opens a journal, compacted first if it is due. A file cut short by a crash is read up to its last whole
+ * record, and one of another version is started over. A journal ending before the snapshot was taken, as when
+ * its last records were lost, goes on from the seq of the snapshot. Starts the thread of the journal
+ * @param path journal file, created if missing
+ * @param checkpoint_seq seq of the last record of the tunnel snapshot the journal is replayed over, UINT64_MAX if
+ * there is none
+ * @param nb_queues number of queues, one per thread appending
+ * @returns the journal, NULL if the file cannot be written
+ */
+struct tunnel_journal *tunnel_journal_open(const char *path, uint64_t checkpoint_seq, uint16_t nb_queues);
+
+/**
+ * Gets a queue of a journal, only ever appended to by one thread at a time
+ * @param journal journal of the queue, may be NULL
+ * @param index index of the queue, below the number the journal was opened with
+ * @returns the queue, NULL if journal is
+ */
+struct journal_queue *tunnel_journal_queue(struct tunnel_journal *journal, uint16_t index);
+
+/**
+ * Hands each tunnel the journal holds to a callback, which may append to the journal
+ * @param journal journal to read
+ * @param restore called with the payload of each live tunnel
+ * @param arg passed on to restore
+ * @returns the number of tunnels, -1 if the file cannot be read
+ */
+int64_t tunnel_journal_replay(struct tunnel_journal *journal, void (*restore)(const struct journal_tunnel *tunnel, void *arg),
+void *arg);
+
+/**
+ * Hands each record appended after a tunnel snapshot was taken to a callback, in the order they were appended
+ * @param journal journal to read
+ * @param seq seq of the last record of the snapshot
+ * @param apply called with the type and payload of each record, only the key is set for JOURNAL_DELETE
+ * @param arg passed on to apply
+ * @returns the number of records, -1 if the file cannot be read
+ */
+int64_t tunnel_journal_replay_after(struct tunnel_journal *journal, uint64_t seq,
+void (*apply)(uint8_t type, const struct journal_tunnel *tunnel, void *arg), void *arg);
+
+/**
+ * Appends a record to a queue the thread of the journal writes to the file. Never locks nor waits for the disk
+ * @param queue queue of the calling thread
+ * @param type an enum journal_type
+ * @param tunnel payload, only the key is written for JOURNAL_DELETE
+ * @returns 0 on success, -1 if the queue is full as the disk fell behind
+ */
+int tunnel_journal_append(struct journal_queue *queue, uint8_t type, const struct journal_tunnel *tunnel);
+
+/**
+ * Makes appends to a full queue wait for the thread of the journal to take records rather than drop them, for
+ * threads loading tunnels before the workers run
+ * @param journal journal of the queues
+ * @param wait whether if appends wait
+ */
+void tunnel_journal_wait(struct tunnel_journal *journal, bool wait);
+
+/**
+ * Gets the seq of the last record the thread of a journal took from its queues, safe to call from any thread.
+ * Every record appended after the call gets a higher seq
+ * @param journal journal to read
+ * @returns the seq, 0 if the journal never had a record
+ */
+uint64_t tunnel_journal_seq(struct tunnel_journal *journal);
+
+/**
+ * Lets compactions drop the deletes appended up to a tunnel snapshot once it is on disk, as restoring it
+ * no longer needs them. Safe to call from any thread
+ * @param journal journal of the snapshot
+ * @param seq seq of the last record of the snapshot
+ */
+void tunnel_journal_checkpoint(struct tunnel_journal *journal, uint64_t seq);
+
+/**
+ * Gets the counters of a journal, safe to call from any thread
+ * @param journal journal to read
+ * @param stats counters to fill
+ */
+void tunnel_journal_get_stats(struct tunnel_journal *journal, struct tunnel_journal_stats *stats);
+
+/**
+ * Writes the records appended, stops the thread of the journal and closes it
+ * @param journal journal to close
+ */
+void tunnel_journal_close(struct tunnel_journal *journal);
+
+#endif
@@ -0,0 +1,167 @@
+#ifndef TUNNEL_POOL_H
+#define TUNNEL_POOL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <rte_rcu_qsbr.h>
+#include "ike.h"
+
+/// Tunnels each worker can hold unless set with --max-tunnels, allocated when the worker starts
+#define TUNNEL_POOL_SIZE 65536
+
+/**
+ * Threads reading the pools of workers they do not run, each with its RCU reader id. A reader walks a
+ * pool between rte_rcu_qsbr_thread_online and rte_rcu_qsbr_thread_offline, and must not keep pointers
+ * to tunnels past the offline call
+ */
+enum tunnel_reader{
+    /** thread refreshing the console */
+    TUNNEL_READER_STATS = 0,
+    TUNNEL_READER_MAX
+};
+
+/**
+ * @struct tunnel_retired
+ * @brief Slot freed while other threads may still be reading it
+ */
+struct tunnel_retired{
+    /** RCU token taken when the slot was freed */
+    uint64_t token;
+    uint32_t handle;
+};
+
+/**
+ * @struct tunnel_pool
+ * @brief Fixed set of tunnel slots owned by a worker, allocated once so that the packet path never
+ * allocates. Only the owning worker changes the pool, other threads only read it. A tunnel keeps its
+ * slot, and so its address and handle, until it is freed. The part of each tunnel the ESP packets use
+ * is kept apart from its IKE part, both indexed by the handle. The handles of the live tunnels are kept
+ * packed at the start of handles so that walking them does not depend on the capacity. A freed slot
+ * is retired rather than reused until every reader that could have seen it went offline, so that
+ * readers walk the pool without locks and never see a tunnel being overwritten
+ */
+struct tunnel_pool{
+    /** tunnel slots, one cache line each */
+    struct tunnel *tunnels;
+    /** IKE part of each slot */
+    struct tunnel_ike *ike;
+    /** handles of the live tunnels, only the first count are meaningful */
+    uint32_t *handles;
+    /** position of each live slot in handles */
+    uint32_t *positions;
+    /** stack of the handles of the free slots */
+    uint32_t *free;
+    /** retired slots in the order they were freed, a ring of capacity entries */
+    struct tunnel_retired *retired;
+    /** RCU variable of the readers, NULL if no other thread reads the pool */
+    struct rte_rcu_qsbr *rcu;
+    /** number of live tunnels, published after the tunnel and its handle */
+    uint32_t count;
+    uint32_t nb_free;
+    /** oldest retired slot */
+    uint32_t retired_head;
+    uint32_t nb_retired;
+    /** number of slots */
+    uint32_t capacity;
+    /** position in walking order the next eviction starts looking from */
+    uint32_t evict_cursor;
+    /** tunnels ended to make room for a new one */
+    uint64_t evicted;
+    /** new tunnels not added because no slot could be freed */
+    uint64_t refused;
+};
+
+/**
+ * Allocates the RCU variable shared by every pool, with a reader registered for each tunnel_reader.
+ * Does not need EAL
+ * @returns the variable, NULL if it cannot be allocated
+ */
+struct rte_rcu_qsbr *tunnel_rcu_create(void);
+
+/**
+ * Allocates a pool with every slot free. The slots are written once so that the memory is committed
+ * up front rather than as tunnels come
+ * @param capacity number of slots
+ * @param rcu RCU variable of the threads reading the pool, NULL if only the owner does
+ * @returns the pool, NULL if it cannot be allocated
+ */
+struct tunnel_pool *tunnel_pool_create(uint32_t capacity, struct rte_rcu_qsbr *rcu);
+
+/**
+ * Takes a free slot and publishes a tunnel in it. Slots retired long enough ago are reclaimed first
+ * @param pool pool of the calling worker
+ * @param init tunnel copied into the slot before readers can see it
+ * @param init_ike IKE part copied into the slot
+ * @returns the slot, NULL if every slot holds a tunnel or is still retired
+ */
+struct tunnel *tunnel_pool_alloc(struct tunnel_pool *pool, const struct tunnel *init, const struct tunnel_ike *init_ike);
+
+/**
+ * Removes a tunnel from the live ones and retires its slot. The live tunnel last in walking order takes
+ * its place in that order. The slot keeps its content until it is reused
+ * @param pool pool of the calling worker
+ * @param tunnel tunnel to free
+ */
+void tunnel_pool_free(struct tunnel_pool *pool, struct tunnel *tunnel);
+
+/// Gets the handle of a tunnel, the index of its slot
+static inline uint32_t
+tunnel_pool_handle(const struct tunnel_pool *pool, const struct tunnel *tunnel){
+    return tunnel - pool->tunnels;
+}
+
+/**
+ * Gets the index of a child SA of a tunnel among those of the pool. The child SAs of the same rank are
+ * packed together, so that the first of each tunnel, which carries most of the traffic, stay close
+ * @param pool pool of the tunnel
+ * @param tunnel tunnel of the SA
+ * @param child child SA of the tunnel
+ */
+static inline uint32_t
+tunnel_pool_child(const struct tunnel_pool *pool, const struct tunnel *tunnel, uint8_t child){
+    return child * pool->capacity + tunnel_pool_handle(pool,tunnel);
+}
+
+/// Checks whether if a tunnel is in the slots of a pool
+static inline bool
+tunnel_pool_holds(const struct tunnel_pool *pool, const struct tunnel *tunnel){
+    return tunnel >= pool->tunnels && tunnel < pool->tunnels + pool->capacity;
+}
+
+/// Checks whether if an IKE part is in the slots of a pool
+static inline bool
+tunnel_pool_holds_ike(const struct tunnel_pool *pool, const struct tunnel_ike *ike){
+    return ike >= pool->ike && ike < pool->ike + pool->capacity;
+}
+
+/// Gets the IKE part of a tunnel of the pool
+static inline struct tunnel_ike *
+tunnel_pool_ike(const struct tunnel_pool *pool, const struct tunnel *tunnel){
+    return &pool->ike[tunnel - pool->tunnels];
+}
+
+/// Gets the tunnel an IKE part of the pool belongs to
+static inline struct tunnel *
+tunnel_pool_from_ike(const struct tunnel_pool *pool, const struct tunnel_ike *ike){
+    return &pool->tunnels[ike - pool->ike];
+}
+
+/// Gets the number of live tunnels, safe to call from a reader
+static inline uint32_t
+tunnel_pool_count(const struct tunnel_pool *pool){
+    return __atomic_load_n(&pool->count,__ATOMIC_ACQUIRE);
+}
+
+/**
+ * Gets a live tunnel by its position in walking order. A reader may see a tunnel twice or miss one
+ * that moved while it walked, but always a whole tunnel
+ * @param pool pool to walk
+ * @param i position, below the count
+ * @returns the tunnel
+ */
+static inline struct tunnel *
+tunnel_pool_at(const struct tunnel_pool *pool, uint32_t i){
+    return &pool->tunnels[__atomic_load_n(&pool->handles[i],__ATOMIC_ACQUIRE)];
+}
+
+#endif
@@ -0,0 +1,143 @@
+#ifndef TUNNEL_SNAPSHOT_H
+#define TUNNEL_SNAPSHOT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ike.h"
+
+/// First bytes of a snapshot file
+#define SNAPSHOT_MAGIC 0x54414E5354524E53ULL
+/// Version of the records, a snapshot of another version is not read
+#define SNAPSHOT_VERSION 1
+/// Seconds a child SA restored still learning the spi of a direction has to learn it
+#define SNAPSHOT_LEARN_FOREVER UINT32_MAX
+
+/// Flags of a tunnel in a snapshot
+enum snapshot_flag{
+    /** a dead peer detection request went unanswered */
+    SNAPSHOT_DPD = 1,
+    /** a delete was sent, the next response ends the session */
+    SNAPSHOT_DELETING = 2,
+    /** the tunnel journal holds the tunnel */
+    SNAPSHOT_SAVED = 4
+};
+
+/**
+ * @struct snapshot_window
+ * @brief Replay window of a direction of a child SA. Only the sequence numbers closest to the highest are
+ * kept, those further behind are taken as seen when the window is restored
+ */
+struct snapshot_window{
+    /** highest sequence number seen, with the upper half of an extended sequence number */
+    uint64_t top;
+    /** bit i is set if top - 63 + i was seen */
+    uint64_t recent;
+};
+
+/**
+ * @struct snapshot_child
+ * @brief Child SA of a tunnel in a snapshot
+ */
+struct snapshot_child{
+    /** spi of each direction, indexed by esp_dir, 0 if not learnt */
+    rte_be32_t spi[2];
+    struct snapshot_window windows[2];
+    /** seconds left to learn the missing spis, SNAPSHOT_LEARN_FOREVER for as long as the tunnel lives */
+    uint32_t learn;
+    uint16_t serial;
+    /** an enum child_sa_state */
+    uint8_t state;
+    uint8_t reserved;
+};
+
+/**
+ * @struct snapshot_tunnel
+ * @brief Authenticated tunnel in a snapshot. Records have a fixed size so that a snapshot is read in place
+ */
+struct snapshot_tunnel{
+    uint64_t initiator_spi;
+    uint64_t responder_spi;
+    struct ip_addr client_ip;
+    struct ip_addr host_ip;
+    /** child SAs in their slots of the tunnel */
+    struct snapshot_child children[TUNNEL_CHILD_SAS];
+    uint16_t next_serial;
+    /** an enum esp_encap */
+    uint8_t encap;
+    uint8_t dpd_count;
+    /** enum snapshot_flag bits */
+    uint8_t flags;
+    uint8_t reserved[11];
+};
+
+/**
+ * @struct snapshot_header
+ * @brief First bytes of a snapshot file, followed by the records
+ */
+struct snapshot_header{
+    uint64_t magic;
+    uint32_t version;
+    /** bytes of each record, so that a snapshot of another layout is not read */
+    uint32_t record_size;
+    /** records of the snapshot */
+    uint64_t count;
+    /** seq of the last record of the tunnel journal when the snapshot was taken */
+    uint64_t journal_seq;
+    /** CRC32C of the records */
+    uint32_t crc;
+    /** CRC32C of the header before this field */
+    uint32_t header_crc;
+    uint8_t reserved[24];
+};
+
+/**
+ * @struct tunnel_snapshot
+ * @brief Snapshot being written, allocated, or read, mapped from its file
+ */
+struct tunnel_snapshot{
+    /** header, followed by the records */
+    struct snapshot_header *header;
+    struct snapshot_tunnel *tunnels;
+    /** records the snapshot can hold */
+    uint64_t capacity;
+    /** bytes of the header and of the records */
+    size_t size;
+    /** whether if the snapshot is mapped from a file */
+    bool mapped;
+};
+
+/**
+ * Allocates a snapshot to be written
+ * @param snapshot snapshot to allocate
+ * @param capacity records the snapshot can hold
+ * @returns 0 on success, -1 if it cannot be allocated
+ */
+int tunnel_snapshot_alloc(struct tunnel_snapshot *snapshot, uint64_t capacity);
+
+/**
+ * Writes the first records of a snapshot to a new file, with a single write, and puts it in place of the
+ * previous snapshot once it is on disk
+ * @param snapshot allocated snapshot
+ * @param path snapshot file
+ * @param count records to write
+ * @param journal_seq seq of the last record of the tunnel journal the snapshot is taken with
+ * @returns 0 on success, -1 if it cannot be written, the previous snapshot is then kept, or if the directory
+ * could not be flushed after putting it in place
+ */
+int tunnel_snapshot_write(struct tunnel_snapshot *snapshot, const char *path, uint64_t count, uint64_t journal_seq);
+
+/**
+ * Maps a snapshot file read-only and checks its version and CRCs
+ * @param snapshot snapshot to map
+ * @param path snapshot file
+ * @returns 0 on success, -1 if there is no snapshot of this version whose CRCs match
+ */
+int tunnel_snapshot_map(struct tunnel_snapshot *snapshot, const char *path);
+
+/**
+ * Frees an allocated snapshot or unmaps a mapped one
+ * @param snapshot snapshot to free
+ */
+void tunnel_snapshot_free(struct tunnel_snapshot *snapshot);
+
+#endif
@@ -11,21 +11,61 @@
 #include <rte_lcore.h>
 #include <rte_per_lcore.h>
 #include <rte_icmp.h>
+#include <rte_prefetch.h>
+#include <rte_cycles.h>
+#include <rte_thash.h>
+#include <netinet/in.h>
+#include <netinet/icmp6.h>
 #include <unistd.h>
 
 
 #include "include/ike.h"
+#include "include/pcap.h"
+#include "include/afpacket.h"
+#include "include/parse.h"
+#include "include/reasm.h"
+#include "include/sa_index.h"
+#include "include/tunnel_pool.h"
+#include "include/timer_wheel.h"
+#include "include/source_limit.h"
+#include "include/replay.h"
+#include "include/tunnel_journal.h"
+#include "include/tunnel_snapshot.h"
 
 #define RX_RING_SIZE 1024
 #define TX_RING_SIZE 1024
 
 #define NUM_MBUFS 8191
 #define MBUF_CACHE_SIZE 250
-#define BURST_SIZE 1
+#define DEFAULT_BURST_SIZE 32
+#define MAX_BURST_SIZE 128
+/// How many packets ahead of the one being analysed get their headers prefetched
+#define PREFETCH_OFFSET 4
+/// Default number of entries of the rings between pipeline stages
+#define DEFAULT_RING_SIZE 4096
+/// Most tunnels --max-tunnels lets a worker hold, and IKE SAs --max-half-open lets it track
+#define MAX_TUNNELS_LIMIT (1 << 22)
+/// IKE SAs yet to authenticate each worker tracks unless set with --max-half-open
+#define DEFAULT_MAX_HALF_OPEN 16384
+/// Sequence numbers of each replay window unless set with --replay-window
+#define DEFAULT_REPLAY_WINDOW 64
+/// Seconds between checkpoints of the tunnels unless set with --checkpoint-interval, and the most it can be set to
+#define DEFAULT_CHECKPOINT_INTERVAL 60
+#define MAX_CHECKPOINT_INTERVAL 86400
+/// Most tunnels the console lists, only counted past it
+#define STATS_TUNNELS_SHOWN 32
+/// IKE_SA_INIT exchanges per second each initiator address may open, and most at once
+#define SOURCE_INIT_RATE 10
+#define SOURCE_INIT_BURST 20
+/// IKE_SA_INIT messages each worker logs per second before only counting them
+#define INIT_LOG_RATE 100
 #define ISAKMP_PORT 500
 #define IPSEC_NAT_T_PORT 4500
+/// Zero bytes in front of IKE messages sent on IPSEC_NAT_T_PORT, telling them apart from ESP
+#define NON_ESP_MARKER_LEN 4
 #include <string.h>
 #include <pthread.h>
+#include <signal.h>
 #include <time.h>
 
 
@@ -45,25 +85,194 @@ struct ISAKMP_TEST{
     /// 0 means IKE/ISAKMP else ESP
     uint32_t test_octet;
 };
-void * object[]= {0};
 
-///Tolerance for sequence numbers in case they arrive in in correct order
-uint32_t tolerance = 15;
+/// Offset of the mbuf dynamic field the rx stage of the pipeline hands the descriptor of a packet over in
+static int pkt_desc_offset = -1;
 
-static const int IPV4_OFFSET = sizeof(struct rte_ether_hdr);
-static const int UDP_OFFSET = sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_ether_hdr);
-
-static const int UDP_OFFSET_6 = sizeof(struct rte_ipv6_hdr) + sizeof(struct rte_ether_hdr);
+/// Gets the descriptor carried by a packet handed over by the rx stage
+static inline struct pkt_desc *
+pkt_desc_field(struct rte_mbuf *pkt){
+    return RTE_MBUF_DYNFIELD(pkt,pkt_desc_offset,struct pkt_desc *);
+}
 
-static int rte_mbuf_dynfield_offset = -1;
+/// Number of packets pulled from the rx queue per poll, set with --burst-size
+static uint16_t burst_size = DEFAULT_BURST_SIZE;
 static uint16_t count = 0;
 
-int total_processed = 0;
-int non_ipsec = 0;
-int legit_pkts = 0;
-int isakmp_pkts = 0;
-int tampered_pkts = 0;
-int malformed_pkts = 0;
+/**
+ * @struct packet_stats
+ * @brief Packet counters of a worker. Each worker only updates its own copy
+ */
+struct packet_stats{
+    uint64_t total_processed;
+    uint64_t non_ipsec;
+    uint64_t legit_pkts;
+    uint64_t isakmp_pkts;
+    uint64_t tampered_pkts;
+    uint64_t malformed_pkts;
+    /// IKE fragments held for reassembly or dropped by it, the fragment completing a datagram is counted as the datagram
+    uint64_t fragments;
+    /// ESP packets behind the highest sequence number of their SA but within its replay window, counted as legit
+    uint64_t esp_reordered;
+    /// ESP packets whose sequence number was already seen, counted as tampered
+    uint64_t esp_replayed;
+    /// ESP packets whose sequence number is behind the replay window, counted as tampered
+    uint64_t esp_too_old;
+    /// IKE_SA_INIT messages not logged, from initiators over their budget or past INIT_LOG_RATE
+    uint64_t init_unlogged;
+    /// IKE_SA_INIT responses whose IKE SA was not tracked because its initiator was over its budget
+    uint64_t init_untracked;
+};
+
+/**
+ * @struct init_flood
+ * @brief IKE_SA_INIT messages a worker left out of the log since it last reported them, so that a flood
+ * costs one line per second rather than one per message
+ */
+struct init_flood{
+    /// budget of the messages logged
+    struct token_bucket logged;
+    /// tick of the next report
+    uint64_t next_report;
+    uint64_t unlogged;
+    uint64_t untracked;
+};
+
+/**
+ * @struct worker
+ * @brief State of a worker lcore. Each worker polls one rx queue of every port and owns the tunnels
+ * of the client/host pairs that RSS steers to that queue. In pipeline mode the worker is a parse
+ * stage and gets its packets from its ring instead
+ */
+struct worker{
+    /// lcore the worker runs on
+    unsigned lcore_id;
+    /// rx queue polled by the worker
+    uint16_t queue_id;
+    /// authenticated tunnels owned by the worker
+    struct tunnel_pool *tunnels;
+    /// IKE SAs owned by the worker yet to authenticate
+    struct tunnel_pool *half_open;
+    /// tunnels owned by the worker indexed by the spis of their IKE SA
+    struct ike_sa_index *ike_sas;
+    /// authenticated tunnels owned by the worker indexed by their ESP SAs
+    struct esp_sa_index *esp_sas;
+    /// timers of the tunnels owned by the worker
+    struct timer_wheel *timers;
+    /// IKE datagrams the worker is reassembling
+    struct reasm_table *reasm;
+    /// IKE_SA_INIT budgets of the initiators seen by the worker
+    struct source_limiter *limiter;
+    /// replay windows of the child SAs of the tunnels owned by the worker
+    struct replay_table *replays;
+    /// IKE_SA_INIT messages the worker did not log yet
+    struct init_flood flood;
+    struct packet_stats stats;
+    /// ring the rx stages hand packets over, only used in pipeline mode
+    struct rte_ring *ring;
+    /// highest number of packets seen waiting in the ring
+    unsigned ring_peak;
+    /// ring other workers hand over the IPsec packets of pairs owned by this worker, only used when
+    /// several workers poll rx queues and the NIC may not steer a whole pair to one queue
+    struct rte_ring *handoff;
+    /// packets handed over to the workers owning them
+    uint64_t handed_off;
+    /// packets dropped because the handoff ring of their owner was full
+    uint64_t handoff_drops;
+    /// thread running the worker with the afpacket backend
+    pthread_t thread;
+    /// part of the checkpoint records the worker copies its tunnels into, room for as many as its pool holds
+    struct snapshot_tunnel *checkpoint_records;
+    /// tunnels the worker copied into checkpoint_records
+    uint64_t checkpoint_count;
+    /// last checkpoint_epoch the worker copied its tunnels for, stored once they are copied
+    uint64_t checkpoint_done;
+} __rte_cache_aligned;
+
+/**
+ * @struct rx_stage
+ * @brief rx stage of the pipeline. Polls one rx queue of every port and hands each packet to the
+ * parse worker owning its client/host pair
+ */
+struct rx_stage{
+    /// lcore the stage runs on
+    unsigned lcore_id;
+    /// rx queue polled by the stage
+    uint16_t queue_id;
+    /// packets received
+    uint64_t rx_pkts;
+    /// packets dropped because the ring of their parse worker was full
+    uint64_t ring_drops;
+} __rte_cache_aligned;
+
+/// Workers, indexed by the rx queue they poll or by their parse stage index in pipeline mode
+static struct worker workers[RTE_MAX_LCORE];
+/// Number of workers, each owning a share of the tunnels
+static uint16_t nb_workers = 1;
+/// Number of rx queues per port
+static uint16_t nb_rx_queues = 1;
+
+/// Set with --pipeline. Packets then go through rx, parse and log stages running on separate lcores
+static bool pipeline_mode = false;
+/// rx stages of the pipeline, indexed by the rx queue they poll
+static struct rx_stage rx_stages[RTE_MAX_LCORE];
+/// lcores given to each pipeline stage with --pipeline
+static unsigned rx_lcores[RTE_MAX_LCORE];
+static unsigned nb_rx_lcores;
+static unsigned parse_lcores[RTE_MAX_LCORE];
+static unsigned nb_parse_lcores;
+static unsigned log_lcore;
+/// Number of entries of the rings between pipeline stages, or of the handoff rings of the workers, set with --ring-size
+static unsigned ring_size = DEFAULT_RING_SIZE;
+/// Tunnels each worker can hold, set with --max-tunnels
+static uint32_t max_tunnels = TUNNEL_POOL_SIZE;
+/// IKE SAs yet to authenticate each worker can track, set with --max-half-open
+static uint32_t max_half_open = DEFAULT_MAX_HALF_OPEN;
+/// Sequence numbers of the replay window of each ESP SA, set with --replay-window
+static uint32_t replay_size = DEFAULT_REPLAY_WINDOW;
+/// Seconds between checkpoints of the tunnels to the tunnel snapshot, 0 for none, set with --checkpoint-interval
+static uint32_t checkpoint_interval = DEFAULT_CHECKPOINT_INTERVAL;
+/// Capture file analysed instead of ports, set with --read-pcap
+static const char *pcap_path = NULL;
+/// Set with --backend afpacket. Packets are then received from a kernel interface instead of DPDK ports
+static bool afpacket_mode = false;
+/// Interface received from by the afpacket backend, set with --iface
+static const char *afpacket_iface = NULL;
+/// Number of threads receiving from the interface, each with its own socket and worker, set with --threads
+static uint16_t afpacket_threads = 1;
+/// Packet socket of each afpacket worker
+static struct afpacket_rx afpacket_rxs[RTE_MAX_LCORE];
+/// RCU variable of the threads reading the tunnels of every worker, see enum tunnel_reader
+static struct rte_rcu_qsbr *tunnel_rcu;
+/// Set by SIGINT and SIGTERM, the workers then stop and the tunnels are saved before exiting
+static volatile bool force_quit;
+/// Thread writing the checkpoints, running if checkpointing is set
+static pthread_t checkpointer;
+static bool checkpointing;
+/// Checkpoints written and those that could not be, counted by the checkpoint thread
+static uint64_t checkpoints;
+static uint64_t checkpoint_errors;
+/// Tunnels of the last checkpoint and milliseconds it took
+static uint64_t checkpoint_tunnels;
+static uint64_t checkpoint_ms;
+/// Records of the checkpoints, allocated by the first one, each worker copying its tunnels into a part of its own
+static struct tunnel_snapshot checkpoint;
+/// Raised by the checkpoint thread to have every worker copy its tunnels into the checkpoint, see take_checkpoint
+static uint64_t checkpoint_epoch;
+/// Counters of the calling worker
+static __thread struct packet_stats *stats;
+/// Reassembly table of the calling worker
+static __thread struct reasm_table *reasm;
+/// IKE_SA_INIT budgets of the calling worker
+static __thread struct source_limiter *limiter;
+/// IKE_SA_INIT messages the calling worker did not log yet
+static __thread struct init_flood *flood;
+
+/// RSS key made of a repeated 0x6d5a, which gives the same hash for both directions of a client/host pair
+static uint8_t rss_key[52];
+static uint8_t rss_key_len = 40;
+/// Size of the redirection table programmed on the ports
+static uint16_t reta_size;
 
 /**
  * @struct ESP check struct
@@ -76,497 +285,910 @@ struct check{
     uint32_t spi;
 };
 
-void* count_packets(){
-    printf("\rTotal packets processed: %d",total_processed);
+/**
+ * Ends a tunnel of the calling worker whose timer fired, unless activity pushed its deadline back since the
+ * timer was scheduled, in which case the timer is scheduled again for the deadline and the child SAs that
+ * were replaced are retired
+ * @param wheel wheel of the calling worker
+ * @param timer timer of the tunnel
+ */
+static void
+expire_tunnel(struct timer_wheel *wheel, struct timer_node *timer){
+    struct tunnel_ike *ike = timer_container(timer,struct tunnel_ike,timer);
+    struct tunnel *tunnel = tunnel_from_ike(ike);
+    char client_ip[INET6_ADDRSTRLEN];
+    char host_ip[INET6_ADDRSTRLEN];
+    char log[2048];
+    int priority = LOG_INFO;
+    if(tunnel->deadline >= wheel->now){
+        timer_wheel_arm(wheel,timer,tunnel->deadline);
+        if(tunnel->auth){
+            child_sa_sweep(tunnel);
+        }
+        return;
+    }
+    get_current_time(current_time);
+    get_ip_addr_string(&tunnel->client_ip,client_ip);
+    get_ip_addr_string(&tunnel->host_ip,host_ip);
+    if(tunnel->timer_class == TUNNEL_TIMER_HALF_OPEN){
+        snprintf(log,2048,"%s;IKE Authentication between %s and %s failed\n",current_time
+        ,client_ip, host_ip);
+        priority = LOG_NOTICE;
+    }
+    else{
+        snprintf(log,2048,"%s;Session ended between %s and %s\n",current_time
+        ,client_ip, host_ip);
+    }
+    write_log(ipsec_log,log,priority);
+    delete_tunnel(ike->initiator_spi,ike->responder_spi,tunnel->client_ip,tunnel->host_ip);
+}
 
-    
+/**
+ * Logs how many IKE_SA_INIT messages the calling worker left out of the log since the last report, if any,
+ * and waits a second before the next report
+ * @param now current tick
+ */
+static void
+report_init_flood(uint64_t now){
+    char log[2048];
+    if(flood->unlogged == 0 && flood->untracked == 0){
+        return;
+    }
+    get_current_time(current_time);
+    snprintf(log,2048,"%s;IKE_SA_INIT_FLOOD;%" PRIu64  " messages not logged;%" PRIu64 " IKE SAs not tracked\n",current_time
+    ,flood->unlogged,flood->untracked);
+    write_log(ipsec_log,log,LOG_WARNING);
+    flood->unlogged = 0;
+    flood->untracked = 0;
+    flood->next_report = now + TIMER_HZ;
 }
 
-/// Runs in the background to check for tunnel timeout for all established tunnels
-void timeout(){
-    while(true){
-        current_time[0] = 0;
-        get_current_time(current_time);
-        for(int i = 1;i<=tunnels->size;i++){
-            struct tunnel *tunnel = (struct tunnel *)tunnels->array[i];
-            tunnel->timeout ++;
-            int priority = LOG_INFO;
-            if(tunnel->timeout == 40){
-                char* client_ip[16] = {0};
-                char* host_ip[16] = {0};
-                get_ip_address_string(tunnel->client_ip,client_ip);
-                get_ip_address_string(tunnel->host_ip,host_ip);
-                char log[2048];
-                if(tunnel->auth){
-                    snprintf(log,2048,"%s;Session ended between %s and %s\n",current_time
-                    ,client_ip, host_ip);
-                }
-                else{
-                    snprintf(log,2048,"%s;IKE Authentication between %s and %s failed\n",current_time
-                    ,client_ip, host_ip);
-                    priority = LOG_NOTICE;
-                }
-                write_log(ipsec_log,log,priority);
-                delete_tunnel(tunnel->initiator_spi,tunnel->responder_spi,tunnel->client_ip,tunnel->host_ip);
-            }
+/**
+ * Fires the timers of the calling worker that are due. Each worker runs its own timers from its loop so
+ * that tunnels are only ever changed by the worker owning them
+ */
+static inline void
+run_timers(void){
+    const uint64_t now = timer_now();
+    timer_wheel_run(timers,now,expire_tunnel);
+    if(now >= flood->next_report){
+        report_init_flood(now);
+    }
+}
+
+/**
+ * Copies the tunnels of the calling worker into its part of the checkpoint once the checkpoint thread raised
+ * checkpoint_epoch. The worker owning the tunnels is the only one changing them, so none is copied half changed
+ * @param worker calling worker
+ */
+static inline void
+take_checkpoint(struct worker *worker){
+    const uint64_t epoch = __atomic_load_n(&checkpoint_epoch,__ATOMIC_ACQUIRE);
+    if(likely(epoch == worker->checkpoint_done)){
+        return;
+    }
+    worker->checkpoint_count = snapshot_tunnels(worker->checkpoint_records);
+    __atomic_store_n(&worker->checkpoint_done,epoch,__ATOMIC_RELEASE);
+}
+
+/// Prints the tunnels of every worker and the packet counters summed over all workers to the console
+static void
+print_stats(void){
+    struct packet_stats total = {0};
+    uint64_t reassembled = 0, reasm_timeouts = 0, reasm_drops = 0, reasm_malformed = 0;
+    uint64_t nb_tunnels = 0, tunnel_slots = 0, evicted = 0, refused = 0;
+    uint64_t nb_half_open = 0, half_open_slots = 0, half_open_evicted = 0, half_open_refused = 0;
+    struct ip_addr client_ips[STATS_TUNNELS_SHOWN], host_ips[STATS_TUNNELS_SHOWN];
+    uint32_t shown = 0;
+    printf("\e[1;1H\e[2J");
+    printf("================================\n");
+    puts(
+         "             __,---.__\n"
+         "        __,-'         `-.\n"
+         "       /_/_,'  SNART🐷   \\&\n"
+         "       _,👀               \\\n"
+         "      (\")            .    |\n"
+         "      🧃``--|__|--..-'`.__|\n"
+         );
+    printf("================================\n          Tunnels\n================================\n");
+    //the workers keep changing their tunnels, a tunnel seen here is not reused until the walk is over. Only the
+    //addresses are copied while online, so that printing does not hold back the reuse of freed slots
+    rte_rcu_qsbr_thread_online(tunnel_rcu,TUNNEL_READER_STATS);
+    for(uint16_t w = 0; w < nb_workers && shown < STATS_TUNNELS_SHOWN; w++){
+        const struct tunnel_pool *worker_tunnels = workers[w].tunnels;
+        const uint32_t count = RTE_MIN(tunnel_pool_count(worker_tunnels),STATS_TUNNELS_SHOWN - shown);
+        for (uint32_t i = 0; i < count; i++){
+            const struct tunnel* check = tunnel_pool_at(worker_tunnels,i);
+            client_ips[shown] = check->client_ip;
+            host_ips[shown++] = check->host_ip;
         }
-        sleep(1);
     }
+    rte_rcu_qsbr_thread_offline(tunnel_rcu,TUNNEL_READER_STATS);
+    for(uint32_t i = 0; i < shown; i++){
+        char ip[INET6_ADDRSTRLEN];
+        printf("--------------------------------\n| tunnel %u\n",i + 1);
+        get_ip_addr_string(&client_ips[i],ip);
+        printf("| Client: %s\n",ip);
+        get_ip_addr_string(&host_ips[i],ip);
+        printf("| Host: %s\n",ip);
+    }
+    for(uint16_t w = 0; w < nb_workers; w++){
+        nb_tunnels += tunnel_pool_count(workers[w].tunnels);
+    }
+    if(nb_tunnels > shown){
+        printf("--------------------------------\n| %" PRIu64 " more tunnels not listed\n",nb_tunnels - shown);
+    }
+    for(uint16_t w = 0; w < nb_workers; w++){
+        total.total_processed += workers[w].stats.total_processed;
+        total.non_ipsec += workers[w].stats.non_ipsec;
+        total.legit_pkts += workers[w].stats.legit_pkts;
+        total.isakmp_pkts += workers[w].stats.isakmp_pkts;
+        total.tampered_pkts += workers[w].stats.tampered_pkts;
+        total.malformed_pkts += workers[w].stats.malformed_pkts;
+        total.fragments += workers[w].stats.fragments;
+        total.esp_reordered += workers[w].stats.esp_reordered;
+        total.esp_replayed += workers[w].stats.esp_replayed;
+        total.esp_too_old += workers[w].stats.esp_too_old;
+        total.init_unlogged += workers[w].stats.init_unlogged;
+        total.init_untracked += workers[w].stats.init_untracked;
+        tunnel_slots += workers[w].tunnels->capacity;
+        evicted += workers[w].tunnels->evicted;
+        refused += workers[w].tunnels->refused;
+        nb_half_open += tunnel_pool_count(workers[w].half_open);
+        half_open_slots += workers[w].half_open->capacity;
+        half_open_evicted += workers[w].half_open->evicted;
+        half_open_refused += workers[w].half_open->refused;
+        reassembled += workers[w].reasm->reassembled;
+        reasm_timeouts += workers[w].reasm->timeouts;
+        reasm_drops += workers[w].reasm->drops;
+        reasm_malformed += workers[w].reasm->malformed;
+    }
+    printf("================================");
+    for(uint16_t w = 0; w < nb_workers; w++){
+        if(pipeline_mode){
+            printf("\n| Parse lcore %u: %" PRIu64 " packets",workers[w].lcore_id,workers[w].stats.total_processed);
+        }
+        else{
+            printf("\n| Lcore %u (queue %u): %" PRIu64 " packets",workers[w].lcore_id,w,workers[w].stats.total_processed);
+        }
+    }
+    if(workers[0].handoff != NULL){
+        printf("\n================================");
+        for(uint16_t w = 0; w < nb_workers; w++){
+            printf("\n| Handoff ring lcore %u: %u/%u queued, %" PRIu64 " handed off, %" PRIu64 " drops",workers[w].lcore_id,
+            rte_ring_count(workers[w].handoff),rte_ring_get_capacity(workers[w].handoff),workers[w].handed_off,
+            workers[w].handoff_drops);
+        }
+    }
+    if(pipeline_mode){
+        struct log_stage_stats log_stats;
+        struct rte_ring *log_ring = log_stage_ring();
+        log_stage_get_stats(&log_stats);
+        printf("\n================================");
+        for(uint16_t q = 0; q < nb_rx_queues; q++){
+            printf("\n| Rx lcore %u (queue %u): %" PRIu64 " packets, %" PRIu64 " ring drops",
+            rx_stages[q].lcore_id,q,rx_stages[q].rx_pkts,rx_stages[q].ring_drops);
+        }
+        for(uint16_t w = 0; w < nb_workers; w++){
+            printf("\n| Parse ring lcore %u: %u/%u queued, peak %u",workers[w].lcore_id,
+            rte_ring_count(workers[w].ring),rte_ring_get_capacity(workers[w].ring),workers[w].ring_peak);
+        }
+        printf("\n| Log ring lcore %u: %u/%u queued, peak %u, %" PRIu64 " written, %" PRIu64 " drops, %" PRIu64 " truncated",
+        log_lcore,rte_ring_count(log_ring),rte_ring_get_capacity(log_ring),log_stats.peak,log_stats.written,log_stats.drops,
+        log_stats.truncated);
+    }
+    printf("\n================================");
+    printf("\n| Non IPSec packets: %" PRIu64, total.non_ipsec);
+    printf("\n| Tampered IPSec packets: %" PRIu64,total.tampered_pkts);
+    printf("\n| Legitimate IPSec packets: %" PRIu64,total.legit_pkts + total.isakmp_pkts);
+    printf("\n| ESP sequence numbers: %" PRIu64 " replayed, %" PRIu64 " behind the window, %" PRIu64 " reordered",
+    total.esp_replayed,total.esp_too_old,total.esp_reordered);
+    printf("\n| Malformed packets: %" PRIu64,total.malformed_pkts);
+    printf("\n| IP fragments of IKE: %" PRIu64 " (%" PRIu64 " datagrams reassembled, %" PRIu64 " timed out, %" PRIu64 " dropped, %" PRIu64 " overlapping)",
+    total.fragments,reassembled,reasm_timeouts,reasm_drops,reasm_malformed);
+    printf("\n| Tunnels: %" PRIu64 "/%" PRIu64 " slots in use, %" PRIu64 " evicted, %" PRIu64 " refused",
+    nb_tunnels,tunnel_slots,evicted,refused);
+    printf("\n| Half-open IKE SAs: %" PRIu64 "/%" PRIu64 " slots in use, %" PRIu64 " evicted, %" PRIu64 " refused",
+    nb_half_open,half_open_slots,half_open_evicted,half_open_refused);
+    printf("\n| IKE_SA_INIT over budget: %" PRIu64 " messages not logged, %" PRIu64 " IKE SAs not tracked",
+    total.init_unlogged,total.init_untracked);
+    if(journal != NULL){
+        struct tunnel_journal_stats journal_stats;
+        tunnel_journal_get_stats(journal,&journal_stats);
+        printf("\n| Tunnel journal: %" PRIu64 " records for %" PRIu64 " tunnels, %" PRIu64 " compactions, %" PRIu64 " write errors",
+        journal_stats.records,journal_stats.live,journal_stats.compactions,journal_stats.errors);
+    }
+    if(checkpointing){
+        printf("\n| Checkpoints: %" PRIu64 " written, %" PRIu64 " failed, last of %" PRIu64 " tunnels in %" PRIu64 " ms",
+        checkpoints,checkpoint_errors,checkpoint_tunnels,checkpoint_ms);
+    }
+    printf("\n| Total packets processed: %" PRIu64 "\n",total.total_processed);
+    printf("================================\n");
+    int64_t unaccounted = total.total_processed - total.non_ipsec - total.tampered_pkts - total.legit_pkts - total.isakmp_pkts - total.malformed_pkts - total.fragments;
+    if( unaccounted == 0){
+        printf("| All traffic accounted for\n");
+    }else{
+        printf("| %" PRId64 " packets unaccounted for. \n| Please check network logs.\n", unaccounted);
+    }
+    printf("================================\n");
 }
 
+/**
+ * Classes packets are sorted into before being analysed, each analysed by its own handler
+ */
+enum pkt_class{
+    /// ESP encapsulated in udp (NAT-T) or directly over ip
+    PKT_CLASS_ESP,
+    /// IKE on udp port 500
+    PKT_CLASS_IKE,
+    /// IKE on udp port 4500, behind the non-ESP marker
+    PKT_CLASS_IKE_NAT_T,
+    /// Any other udp packet
+    PKT_CLASS_UDP,
+    PKT_CLASS_TCP,
+    PKT_CLASS_ICMP,
+    /// udp fragments, reassembled when they belong to IKE
+    PKT_CLASS_FRAGMENT,
+    /// Packets that are not ip or of another ip protocol
+    PKT_CLASS_OTHER,
+    /// Packets too short for the headers their type announces
+    PKT_CLASS_MALFORMED,
+    PKT_CLASS_MAX
+};
 
-/// Process packets
-static uint16_t
-read_data(uint16_t port __rte_unused, uint16_t qidx __rte_unused,
-		struct rte_mbuf **pkts, uint16_t nb_pkts,
-		uint16_t max_pkts __rte_unused, void *_ __rte_unused)
-{
-	unsigned i;
-    get_current_time(current_time);
-    
-	for (i = 0; i < nb_pkts; i++){
-        uint32_t x = rte_pktmbuf_data_len(pkts[i]); //get size of entire packet
-        struct rte_mbuf *pkt = pkts[i];
-        struct rte_ipv4_hdr *ipv4_hdr;
-        struct rte_ether_hdr *ether_hdr;
-        char log[2048] = {0};
-        src_addr[0] = 0;
-        dst_addr[0] = 0;
-        bool malformed = false;
-        if(sizeof(ether_hdr) < x){
-            ether_hdr = rte_pktmbuf_mtod(pkt,struct rte_ether_hdr*);
-            if(rte_be_to_cpu_16(ether_hdr->ether_type) == RTE_ETHER_TYPE_IPV4){
-                if(IPV4_OFFSET + sizeof(struct rte_ipv4_hdr) <= x){
-                    ipv4_hdr = rte_pktmbuf_mtod_offset(pkt,struct rte_ipv4_hdr *, IPV4_OFFSET); //get ipv4 header
-                    /* check protocol (ICMP, UDP, TCP etc)
-                        Due to UDP encapsulation, esp packet shld be within a udp packet with dst/src port 4500
-                    */       
-                    get_ip_address_string(ipv4_hdr->src_addr,src_addr);
-                    get_ip_address_string(ipv4_hdr->dst_addr,dst_addr);
-
-                    if(ipv4_hdr->next_proto_id == IPPROTO_UDP){
-                        if(UDP_OFFSET + sizeof(struct rte_udp_hdr) <= x){
-                            // printf("Protocol: UDP\n");
-                            struct rte_udp_hdr *udp_hdr;
-                            udp_hdr = rte_pktmbuf_mtod_offset(pkt,struct rte_udp_hdr *,UDP_OFFSET); //get udp header
-                            //get src/dst ports and convert to big endian to log them
-                            int dst_port = rte_cpu_to_be_16(udp_hdr->dst_port);
-                            int src_port = rte_cpu_to_be_16(udp_hdr->src_port);
-                            src_addr_int = ipv4_hdr->src_addr;
-                            dst_addr_int = ipv4_hdr->dst_addr;
-                            // printf("Src port: %u\n",dst_port);
-                            // printf("Dst port: %u\n",src_port);
-                            if(dst_port == IPSEC_NAT_T_PORT || src_port == IPSEC_NAT_T_PORT){
-                                if(ESP_OFFSET + sizeof(struct ISAKMP_TEST) <= x){
-                                    struct ISAKMP_TEST *test;
-                                    test = rte_pktmbuf_mtod_offset(pkt,struct ISAKMP_TEST*,ESP_OFFSET);
-                                    if(ISAKMP_OFFSET + sizeof(struct rte_isakmp_hdr) <= x || ESP_OFFSET + sizeof(struct rte_esp_hdr) <= x){
-                                        if(test->test_octet == 0){
-                                            struct rte_isakmp_hdr *isakmp_hdr;
-                                            isakmp_hdr = rte_pktmbuf_mtod_offset(pkt,struct rte_isakmp_hdr*,ISAKMP_OFFSET);
-                                            if(check_if_tunnel_exists(isakmp_hdr,ipv4_hdr)==1){
-                                                int check = analyse_isakmp_payload(pkt,isakmp_hdr,first_payload_hdr_offset + 4,isakmp_hdr->nxt_payload);
-                                                // print_isakmp_headers_info(isakmp_hdr);
-                                                if(check == 1){
-                                                    isakmp_pkts++;
-                                                }
-                                                else{
-                                                    snprintf(log,2048,"%s;INVALID_ISAKMP_PACKET;%s;%s;%lx;%lx\n",current_time
-                                                    ,src_addr, dst_addr, isakmp_hdr->initiator_spi,isakmp_hdr->responder_spi);
-                                                    write_log(ipsec_log,log,LOG_WARNING);
-                                                    tampered_pkts++;
-                                                }
-                                            }
-                                            else{
-                                                snprintf(log,2048,"%s;INVALID_ISAKMP_PACKET;%s;%s;%lx;%lx\n",current_time
-                                                ,src_addr, dst_addr, isakmp_hdr->initiator_spi,isakmp_hdr->responder_spi);
-                                                write_log(ipsec_log,log,LOG_WARNING);
-                                                tampered_pkts++;
-                                            }
-                                        }
-                                        else{
-                                            //esp packet
-                                            struct rte_esp_hdr *esp_header;
-                                            esp_header = rte_pktmbuf_mtod_offset(pkt,struct rte_esp_hdr *,ESP_OFFSET); // get esp headers
-                                            // log spi
-                                            struct check tunnel_to_chk = {
-                                                .seq = rte_be_to_cpu_32(esp_header->seq),
-                                                .spi = rte_be_to_cpu_32(esp_header->spi)
-                                            };
-                                            
-                                            // Lets check for new tunnels
-                                            if (tunnels->size == 0){
-                                                    snprintf(log,2048,"%s;UNAUTHORISED_ESP_PACKET;%s;%s;%x;%d\n",current_time
-                                                    ,src_addr, dst_addr,tunnel_to_chk.spi,tunnel_to_chk.seq);
-
-                                                    write_log(ipsec_log,log,LOG_WARNING);
-                                                    tampered_pkts++;
-                                            }else{
-                                                struct tunnel* check;
-                                                bool tunnel_exists = false;
-                                                bool tampered = false;
-                                                for (uint32_t i = 1; i <= tunnels->size; i++){
-                                                    check = ((struct tunnel*) tunnels->array[i]);
-                                                    if (check->client_ip == src_addr_int && check->host_ip == dst_addr_int && check->auth){
-                                                        if (check->client_spi == 0){
-                                                            check->client_spi = esp_header->spi;
-                                                            check->client_seq = rte_be_to_cpu_32(esp_header->seq);
-                                                            if(check->host_spi != 0 ){
-                                                                add_tunnel(check);
-                                                            }
-                                                            legit_pkts++;
-                                                            tunnel_exists = true;
-                                                        }
-                                                        else if(check->client_spi == esp_header->spi){
-                                                            int seq = rte_be_to_cpu_32(esp_header->seq);
-                                                            if(check->client_seq <= (seq + tolerance) || check->client_seq >= (seq + tolerance)){
-                                                                if(check->client_seq < seq){
-                                                                    check->client_seq = seq;
-                                                                }
-                                                                legit_pkts++;
-                                                                tunnel_exists = true;
-                                                            }
-                                                            else if(check->client_loaded){
-                                                                check->client_seq = rte_be_to_cpu_32(esp_header->seq);
-                                                                check->client_loaded = false;
-                                                                legit_pkts++;
-                                                                tunnel_exists = true;
-                                                            }
-                                                            else{
-                                                                snprintf(log,2048,"%s;INVALID_SEQ_NO;%s;%s;%d;%d\n",current_time
-                                                                ,src_addr, dst_addr,tunnel_to_chk.seq,check->client_seq);
-                                                                
-                                                                write_log(ipsec_log,log,LOG_WARNING);
-                                                                tampered_pkts++;
-                                                                tampered = true;
-                                                                break;
-                                                            }
-                                                        }else{
-                                                            snprintf(log,2048,"%s;INVALID_SPI;%s;%s;%x;%x\n",current_time
-                                                            , src_addr, dst_addr,tunnel_to_chk.spi,check->initiator_spi);
-                                                            
-                                                            write_log(ipsec_log,log,LOG_WARNING);
-                                                            tampered_pkts++;
-                                                            tampered = true;
-                                                            break;
-
-                                                        }
-                                                    }else if (check->host_ip == src_addr_int && check->client_ip == dst_addr_int && check->auth){
-                                                        if (check->host_spi == 0){
-                                                            check->host_spi = esp_header->spi;
-                                                            check->host_seq = rte_be_to_cpu_32(esp_header->seq);
-                                                            if(check->client_spi != 0 ){
-                                                                add_tunnel(check);
-                                                            }
-                                                            legit_pkts++;
-                                                            tunnel_exists = true;
-                                                            
-                                                        }
-                                                        else if(check->host_spi == esp_header->spi){
-                                                            int seq = rte_be_to_cpu_32(esp_header->seq);
-                                                            if(check->host_seq <= (seq + tolerance) || check->host_seq >= (seq - tolerance)){
-                                                                if(check->client_seq < seq){
-                                                                    check->host_seq = seq;
-                                                                }
-                                                                legit_pkts++;
-                                                                tunnel_exists = true;
-                                                            }
-                                                            else if(check->host_loaded){
-                                                                check->host_seq = rte_be_to_cpu_32(esp_header->seq);
-                                                                check->host_loaded = false;
-                                                                legit_pkts++;
-                                                                tunnel_exists = true;
-                                                            }
-                                                            else{
-                                                                snprintf(log,2048,"%s;INVALID_SEQ_NO;%s;%s;%d;%d\n",current_time
-                                                                , src_addr, dst_addr,tunnel_to_chk.seq,check->host_seq);
-                                                                
-                                                                write_log(ipsec_log,log,LOG_WARNING);
-                                                                tampered_pkts++;
-                                                                tampered = true;
-                                                                break;
-                                                            }
-                                                        }else {
-                                                            snprintf(log,2048,"%s;INVALID_SPI;%s;%s;%x;%x\n",current_time
-                                                            ,src_addr, dst_addr,tunnel_to_chk.spi,check->responder_spi);
-                                                            
-                                                            write_log(ipsec_log,log,LOG_WARNING);
-                                                            tampered_pkts++;
-                                                            tampered = true;
-                                                            break;
-                                                        }
-                                                    }
-                                                    if(tunnel_exists){
-                                                        ((struct tunnel*) tunnels->array[i])->timeout = 0;
-                                                        break;
-                                                    }
-                                                }
-                                                if(!(tunnel_exists||tampered)){
-                                                    snprintf(log,2048,"%s;UNAUTHORISED_ESP_PACKET;%s;%s;%x;%d\n",current_time
-                                                    ,src_addr, dst_addr,tunnel_to_chk.spi,tunnel_to_chk.seq);
-                                                    write_log(ipsec_log,log,LOG_WARNING);
-                                                    tampered_pkts++;    
-                                                }
-                                            }
-                                        }
-                                    }
-                                    else{
-                                        malformed = true;
-                                    }
-                                }
-                                else{
-                                    malformed = true;
-                                }
-                            
-                            }
-                            else if(dst_port == ISAKMP_PORT || src_port == ISAKMP_PORT){
-                                if(ESP_OFFSET + sizeof(struct rte_isakmp_hdr) <= x){
-                                    struct rte_isakmp_hdr *isakmp_hdr;
-                                    isakmp_hdr = rte_pktmbuf_mtod_offset(pkt,struct rte_isakmp_hdr*,ESP_OFFSET);
-                                    // print_isakmp_headers_info(hdr);
-                                    if(isakmp_hdr->exchange_type ==  IKE_SA_INIT){
-                                        if(get_initiator_flag(isakmp_hdr) == 1){
-                                            snprintf(log,2048,"%s;%s is trying to initiate IKE exchange with %s\n",current_time
-                                            ,src_addr, dst_addr);
-                                            write_log(ipsec_log,log,LOG_INFO);
-                                        
-                                        }
-                                        else if(check_if_tunnel_exists(isakmp_hdr,ipv4_hdr)==0 && isakmp_hdr->responder_spi != (rte_be64_t)0){                                                                              
-                                            //Only if server responds then tunnel should be considered legit
-                                            struct tunnel new_tunnel;
-                                            new_tunnel.host_ip = ipv4_hdr->src_addr;
-                                            new_tunnel.client_ip = ipv4_hdr->dst_addr;
-
-                                            new_tunnel.responder_spi = isakmp_hdr->responder_spi;
-                                            new_tunnel.initiator_spi = isakmp_hdr->initiator_spi;
-                                            new_tunnel.host_spi = 0;
-                                            new_tunnel.client_spi = 0;
-
-                                            new_tunnel.dpd = false;
-                                            new_tunnel.dpd_count = 0;
-
-                                            new_tunnel.client_seq = 0;
-                                            new_tunnel.host_seq = 0;
-                                            new_tunnel.timeout = 0;
-                                            new_tunnel.auth = false;
-                                            new_tunnel.client_loaded = false;
-                                            new_tunnel.host_loaded = false;
-                                            push(tunnels,&new_tunnel);
-                                        }
-                                        int check = analyse_isakmp_payload(pkt,isakmp_hdr,first_payload_hdr_offset,isakmp_hdr->nxt_payload);
-                                        if(check = 0){
-                                            snprintf(log,2048,"%s;INVALID_ISAKMP_PACKET;%s;%s;%lx;%lx\n",current_time
-                                            ,src_addr, dst_addr, isakmp_hdr->initiator_spi,isakmp_hdr->responder_spi);
-                                            write_log(ipsec_log,log,LOG_WARNING);
-                                            tampered_pkts++;
-                                        }
-                                        else{
-                                             isakmp_pkts++;
-                                        }
-                                    }
-
-                                }
-                                else{
-                                    malformed = true;
-                                }
-                            }
-                            else{ 
-                                //not esp packet
-                                snprintf(log,2048,"%s;UDP;%s:%d->%s:%d\n",current_time
-                                ,src_addr,src_port,dst_addr,dst_port);
-                                write_log(main_log,log,LOG_WARNING);
-                                non_ipsec++;
-                                
-
-                            }  
-                                
-                        }
-                        else{
-                            malformed = true;
-                        }
-                    }
-                    else if(ipv4_hdr->next_proto_id == IPPROTO_TCP){
-                        if(UDP_OFFSET + sizeof(struct rte_tcp_hdr) <= x){
-                            //TCP packet
-                            //TODO: should log protocol xD
-                            struct rte_tcp_hdr* tcp_hdr;
-                            tcp_hdr =  rte_pktmbuf_mtod_offset(pkt,struct rte_tcp_hdr*,UDP_OFFSET);
-                            int src_port = rte_be_to_cpu_16(tcp_hdr->src_port);
-                            int dst_port = rte_be_to_cpu_16(tcp_hdr->dst_port);
-                            
-                            snprintf(log,2048,"%s;TCP;%s:%d->%s:%d\n",current_time
-                            ,src_addr,src_port,dst_addr,dst_port);
-                            
-                            write_log(main_log,log,LOG_WARNING);
-                            non_ipsec++;
-                        }
-                        else{
-                            malformed = true;
-                        }
-                        
-                    }
-                    else if(ipv4_hdr->next_proto_id == IPPROTO_ICMP){
-                        //ICMP packet
-                        if(UDP_OFFSET + sizeof(struct rte_icmp_hdr) <= x){
-                            struct rte_icmp_hdr* icmp_hdr;
-                            icmp_hdr = rte_pktmbuf_mtod_offset(pkt,struct rte_icmp_hdr*,UDP_OFFSET);
-                            if(icmp_hdr->icmp_type == 0){
-                                snprintf(log,2048,"%s;Ping response %s to %s\n",current_time,
-                                src_addr,dst_addr);
-                            }
-                            else if(icmp_hdr->icmp_type == 8){
-                                snprintf(log,2048,"%s;Ping request: %s to %s\n",current_time,src_addr,dst_addr);
-                            }
-                            else{
-                                snprintf(log,2048,"%s;ICMP Packet: %s to %s\n",current_time,src_addr,dst_addr);
-                            }
-                            write_log(main_log,log,LOG_WARNING);
-                            non_ipsec++;
-                        }
-                        else{
-                            malformed = true;
-                        }
-                        
-                    }
-                    else{
-                        non_ipsec++;
-                    }
+/**
+ * Sorts a parsed packet into the class of the handler that analyses it
+ * @param pkt packet to classify
+ * @param desc offsets of the headers of the packet
+ * @returns class of the packet
+ */
+static inline enum pkt_class
+classify_packet(const struct rte_mbuf *pkt, const struct pkt_desc *desc){
+    const uint32_t x = rte_pktmbuf_data_len(pkt);
+    if((desc->ptype & RTE_PTYPE_L2_MASK) == 0){
+        return PKT_CLASS_MALFORMED;
+    }
+    if(!RTE_ETH_IS_IPV4_HDR(desc->ptype) && !RTE_ETH_IS_IPV6_HDR(desc->ptype)){
+        return PKT_CLASS_OTHER;
+    }
+    switch(desc->ptype & RTE_PTYPE_L4_MASK){
+        case RTE_PTYPE_L4_UDP:
+            if(desc->dst_port == IPSEC_NAT_T_PORT || desc->src_port == IPSEC_NAT_T_PORT){
+                if(desc->payload_offset + sizeof(struct rte_esp_hdr) > x){
+                    return PKT_CLASS_MALFORMED;
                 }
-                else{
-                    malformed = true;
+                if(rte_pktmbuf_mtod_offset(pkt,const struct ISAKMP_TEST *,desc->payload_offset)->test_octet != 0){
+                    return PKT_CLASS_ESP;
                 }
+                return desc->payload_offset + NON_ESP_MARKER_LEN + sizeof(struct rte_isakmp_hdr) <= x ? PKT_CLASS_IKE_NAT_T : PKT_CLASS_MALFORMED;
             }
-            else if(rte_be_to_cpu_16(ether_hdr->ether_type) == RTE_ETHER_TYPE_IPV6){
-                if(IPV4_OFFSET + sizeof(struct rte_ipv6_hdr) <= x){
-                    struct rte_ipv6_hdr *ipv6_hdr =rte_pktmbuf_mtod_offset(pkt,struct rte_ipv6_hdr*,IPV4_OFFSET);
-                    get_ipv6_address_string(ipv6_hdr->src_addr,src_addr);
-                    get_ipv6_address_string(ipv6_hdr->dst_addr,dst_addr);
-                    if(ipv6_hdr->proto == IPPROTO_TCP){
-                        if(UDP_OFFSET_6 + sizeof(struct rte_tcp_hdr) <= x){
-                            //IPv6 TCP packet
-                            struct rte_tcp_hdr* tcp_hdr;
-                            
-                            tcp_hdr =  rte_pktmbuf_mtod_offset(pkt,struct rte_tcp_hdr*,UDP_OFFSET_6);
-                            int src_port = rte_be_to_cpu_16(tcp_hdr->src_port);
-                            int dst_port = rte_be_to_cpu_16(tcp_hdr->dst_port);
-                            
-                            snprintf(log,2048,"%s;TCP;[%s]:%d->[%s]:%d\n",current_time
-                            ,src_addr,src_port,dst_addr,dst_port);
-                            printf("%s",log);
-                            write_log(main_log,log,LOG_WARNING);
-                        }
-                        else{
-                            malformed = true;
-                        }
-                    }
-                     if(ipv6_hdr->proto == IPPROTO_UDP){
-                        if(UDP_OFFSET_6 + sizeof(struct rte_tcp_hdr) <= x){
-                            //IPv6 TCP packet
-                            struct rte_udp_hdr* udp_hdr;
-                            udp_hdr =  rte_pktmbuf_mtod_offset(pkt,struct rte_udp_hdr*,UDP_OFFSET_6);
-                            int src_port = rte_be_to_cpu_16(udp_hdr->src_port);
-                            int dst_port = rte_be_to_cpu_16(udp_hdr->dst_port);
-                            
-                            snprintf(log,2048,"%s;UDP;[%s]:%d->[%s]:%d\n",current_time
-                            ,src_addr,src_port,dst_addr,dst_port);
-                            
-                            write_log(main_log,log,LOG_WARNING);
-                        }
-                        else{
-                            malformed = true;
-                        }
-                    }
-                    else if(ipv6_hdr->proto == IPPROTO_ICMPV6){
-                        //ICMP packet
-                        if(UDP_OFFSET + sizeof(struct rte_icmp_hdr) <= x){
-                            struct rte_icmp_hdr* icmp_hdr;
-                            icmp_hdr = rte_pktmbuf_mtod_offset(pkt,struct rte_icmp_hdr*,UDP_OFFSET_6);
-                            if(icmp_hdr->icmp_type == 0){
-                                snprintf(log,2048,"%s;Ping response %s to %s\n",current_time,
-                                src_addr,dst_addr);
-                            }
-                            else if(icmp_hdr->icmp_type == 8){
-                                snprintf(log,2048,"%s;Ping request: %s to %s\n",current_time,src_addr,dst_addr);
-                            }
-                            else{
-                                snprintf(log,2048,"%s;ICMP Packet: %s to %s\n",current_time,src_addr,dst_addr);
-                            }
-                            write_log(main_log,log,LOG_WARNING);
-                        }
-                        else{
-                            malformed = true;
-                        }
-                        
-                    }
-                    non_ipsec ++;
-                }
-                else{
-                    malformed = true;
-                }
+            if(desc->dst_port == ISAKMP_PORT || desc->src_port == ISAKMP_PORT){
+                return desc->payload_offset + sizeof(struct rte_isakmp_hdr) <= x ? PKT_CLASS_IKE : PKT_CLASS_MALFORMED;
             }
-            else{
-                non_ipsec ++;
+            return PKT_CLASS_UDP;
+        case RTE_PTYPE_L4_TCP:
+            return PKT_CLASS_TCP;
+        case RTE_PTYPE_L4_ICMP:
+            return desc->l4_offset + sizeof(struct rte_icmp_hdr) <= x ? PKT_CLASS_ICMP : PKT_CLASS_MALFORMED;
+        case RTE_PTYPE_L4_FRAG:
+            return desc->l4_proto == IPPROTO_UDP ? PKT_CLASS_FRAGMENT : PKT_CLASS_OTHER;
+        case RTE_PTYPE_L4_NONFRAG:
+            if((desc->ptype & RTE_PTYPE_TUNNEL_MASK) == RTE_PTYPE_TUNNEL_ESP){
+                return desc->payload_offset + sizeof(struct rte_esp_hdr) <= x ? PKT_CLASS_ESP : PKT_CLASS_MALFORMED;
             }
+            return PKT_CLASS_OTHER;
+        case 0:
+            //ip header or layer 4 header truncated
+            return PKT_CLASS_MALFORMED;
+        default:
+            return PKT_CLASS_OTHER;
+    }
+}
+
+/// Formats the addresses of an ip packet into src_addr and dst_addr for logging
+static void
+format_addresses(struct rte_mbuf *pkt, const struct pkt_desc *desc){
+    if(RTE_ETH_IS_IPV4_HDR(desc->ptype)){
+        struct rte_ipv4_hdr *ipv4_hdr = rte_pktmbuf_mtod_offset(pkt,struct rte_ipv4_hdr *,desc->l3_offset);
+        get_ip_address_string(ipv4_hdr->src_addr,src_addr);
+        get_ip_address_string(ipv4_hdr->dst_addr,dst_addr);
+    }
+    else{
+        struct rte_ipv6_hdr *ipv6_hdr = rte_pktmbuf_mtod_offset(pkt,struct rte_ipv6_hdr *,desc->l3_offset);
+        //appends to the string
+        src_addr[0] = 0;
+        dst_addr[0] = 0;
+        get_ipv6_address_string(ipv6_hdr->src_addr,src_addr);
+        get_ipv6_address_string(ipv6_hdr->dst_addr,dst_addr);
+    }
+}
+
+/// Reads the addresses of an ip packet
+static inline void
+read_addresses(struct rte_mbuf *pkt, const struct pkt_desc *desc, struct ip_addr *src, struct ip_addr *dst){
+    if(RTE_ETH_IS_IPV4_HDR(desc->ptype)){
+        struct rte_ipv4_hdr *ipv4_hdr = rte_pktmbuf_mtod_offset(pkt,struct rte_ipv4_hdr *,desc->l3_offset);
+        *src = ip_addr_from_ipv4(ipv4_hdr->src_addr);
+        *dst = ip_addr_from_ipv4(ipv4_hdr->dst_addr);
+    }
+    else{
+        struct rte_ipv6_hdr *ipv6_hdr = rte_pktmbuf_mtod_offset(pkt,struct rte_ipv6_hdr *,desc->l3_offset);
+        *src = ip_addr_from_ipv6(ipv6_hdr->src_addr);
+        *dst = ip_addr_from_ipv6(ipv6_hdr->dst_addr);
+    }
+}
+
+/// Sets src_ip and dst_ip to the addresses of an ip packet, the key tunnels are looked up with
+static inline void
+load_addresses(struct rte_mbuf *pkt, const struct pkt_desc *desc){
+    read_addresses(pkt,desc,&src_ip,&dst_ip);
+}
+
+/**
+ * Checks how an ESP packet is carried against how its tunnel's are, which is learnt from the first one
+ * @param tunnel tunnel of the packet
+ * @param encap encapsulation of the packet
+ * @returns whether if the packet is carried the same way as the other packets of the tunnel
+ */
+static inline bool
+check_encap(struct tunnel *tunnel, uint8_t encap){
+    if(unlikely(tunnel->encap == ESP_ENCAP_UNKNOWN)){
+        tunnel->encap = encap;
+    }
+    return tunnel->encap == encap;
+}
+
+/**
+ * Handles ESP, encapsulated in udp or directly over ip. The tunnel and child SA are looked up by the
+ * addresses and SPI of the packet. When the SPI is not indexed, the tunnel linking the addresses either
+ * learns it, if a child SA negotiated on it has yet to see one in that direction, or the packet has the
+ * wrong SPI. The encapsulation is checked against the tunnel and the sequence number against the replay
+ * window of the child SA. The addresses are only formatted when something is logged
+ */
+static void
+handle_esp(struct rte_mbuf *pkt, const struct pkt_desc *desc){
+    char log[2048];
+    const uint8_t encap = desc->l4_proto == IPPROTO_UDP ? ESP_ENCAP_UDP : ESP_ENCAP_NONE;
+    struct rte_esp_hdr *esp_header = rte_pktmbuf_mtod_offset(pkt,struct rte_esp_hdr *,desc->payload_offset);
+    struct check tunnel_to_chk = {
+        .seq = rte_be_to_cpu_32(esp_header->seq),
+        .spi = rte_be_to_cpu_32(esp_header->spi)
+    };
+    load_addresses(pkt,desc);
+
+    uint8_t dir, child;
+    bool learnt = false;
+    struct tunnel *check = esp_sa_index_lookup(esp_sas,&src_ip,&dst_ip,esp_header->spi,&dir,&child);
+    if(check == NULL){
+        check = esp_sa_index_lookup_pair(esp_sas,&src_ip,&dst_ip,&dir);
+        if(check == NULL){
+            format_addresses(pkt,desc);
+            snprintf(log,2048,"%s;UNAUTHORISED_ESP_PACKET;%s;%s;%x;%d\n",current_time
+            ,src_addr, dst_addr,tunnel_to_chk.spi,tunnel_to_chk.seq);
+            write_log(ipsec_log,log,LOG_WARNING);
+            stats->tampered_pkts++;
+            return;
         }
-        else{
-            malformed = true;
+        learnt = true;
+    }
+    if(!check_encap(check,encap)){
+        format_addresses(pkt,desc);
+        snprintf(log,2048,"%s;INVALID_ENCAPSULATION;%s;%s;%x\n",current_time
+        ,src_addr, dst_addr,tunnel_to_chk.spi);
+        write_log(ipsec_log,log,LOG_WARNING);
+        stats->tampered_pkts++;
+        return;
+    }
+    if(unlikely(learnt)){
+        if(child_sa_learn(check,dir,esp_header->spi,tunnel_to_chk.seq) < 0){
+            format_addresses(pkt,desc);
+            snprintf(log,2048,"%s;INVALID_SPI;%s;%s;%x;%" PRIx64 "\n",current_time
+            ,src_addr, dst_addr,tunnel_to_chk.spi,dir == ESP_DIR_CLIENT ? tunnel_ike(check)->initiator_spi : tunnel_ike(check)->responder_spi);
+            write_log(ipsec_log,log,LOG_WARNING);
+            stats->tampered_pkts++;
+            return;
+        }
+    }
+    else{
+        struct replay_window *window = replay_window(replays,tunnel_pool_child(tunnels,check,child),dir);
+        switch(replay_check(replays,window,tunnel_to_chk.seq)){
+            case REPLAY_NEW:
+                break;
+            case REPLAY_REORDERED:
+                stats->esp_reordered++;
+                break;
+            case REPLAY_REPLAYED:
+                format_addresses(pkt,desc);
+                snprintf(log,2048,"%s;REPLAYED_SEQ_NO;%s;%s;%u\n",current_time
+                ,src_addr, dst_addr,tunnel_to_chk.seq);
+                write_log(ipsec_log,log,LOG_WARNING);
+                stats->esp_replayed++;
+                stats->tampered_pkts++;
+                return;
+            case REPLAY_TOO_OLD:
+                format_addresses(pkt,desc);
+                snprintf(log,2048,"%s;INVALID_SEQ_NO;%s;%s;%u;%" PRIu64 "\n",current_time
+                ,src_addr, dst_addr,tunnel_to_chk.seq,window->top);
+                write_log(ipsec_log,log,LOG_WARNING);
+                stats->esp_too_old++;
+                stats->tampered_pkts++;
+                return;
         }
-        if(malformed){
-            if(src_addr[0] != "\0" && dst_addr[0] != "\0"){
-                
-                snprintf(log,2048,"%s;MALFORMED_PACKET;%s;%s\n",current_time,src_addr,dst_addr);
+    }
+    stats->legit_pkts++;
+    tunnel_touch(check);
+}
+
+/**
+ * Analyses an IKE message of an exchange after IKE_SA_INIT, which is only valid within a known tunnel.
+ * src_ip, dst_ip and their strings must be set
+ * @param pkt packet of the message
+ * @param ike_offset offset of the isakmp header
+ */
+static void
+analyse_tunnel_ike(struct rte_mbuf *pkt, uint16_t ike_offset){
+    char log[2048];
+    struct rte_isakmp_hdr *isakmp_hdr = rte_pktmbuf_mtod_offset(pkt,struct rte_isakmp_hdr*,ike_offset);
+    if(check_if_tunnel_exists(isakmp_hdr)==1){
+        int check = analyse_isakmp_payload(pkt,isakmp_hdr,ike_offset + sizeof(struct rte_isakmp_hdr),isakmp_hdr->nxt_payload);
+        if(check == 1){
+            stats->isakmp_pkts++;
+            return;
+        }
+    }
+    snprintf(log,2048,"%s;INVALID_ISAKMP_PACKET;%s;%s;%lx;%lx\n",current_time
+    ,src_addr, dst_addr, isakmp_hdr->initiator_spi,isakmp_hdr->responder_spi);
+    write_log(ipsec_log,log,LOG_WARNING);
+    stats->tampered_pkts++;
+}
+
+/// Handles IKE on udp port 4500, which is only valid within a known tunnel
+static void
+handle_ike_nat_t(struct rte_mbuf *pkt, const struct pkt_desc *desc){
+    load_addresses(pkt,desc);
+    format_addresses(pkt,desc);
+    analyse_tunnel_ike(pkt,desc->payload_offset + NON_ESP_MARKER_LEN);
+}
+
+/**
+ * Handles IKE on udp port 500. A tunnel is created once the responder answers IKE_SA_INIT. Peers not
+ * behind NAT keep to port 500 for the later exchanges, whose ESP then goes directly over ip
+ */
+static void
+handle_ike(struct rte_mbuf *pkt, const struct pkt_desc *desc){
+    char log[2048];
+    struct rte_isakmp_hdr *isakmp_hdr = rte_pktmbuf_mtod_offset(pkt,struct rte_isakmp_hdr*,desc->payload_offset);
+    load_addresses(pkt,desc);
+    format_addresses(pkt,desc);
+    if(isakmp_hdr->exchange_type ==  IKE_SA_INIT){
+        if(get_initiator_flag(isakmp_hdr) == 1){
+            //an initiator over its budget also has the IKE SA of its request left untracked
+            if(source_limit_take(limiter,&src_ip,current_tick) &&
+            token_bucket_take(&flood->logged,current_tick,INIT_LOG_RATE,INIT_LOG_RATE)){
+                snprintf(log,2048,"%s;%s is trying to initiate IKE exchange with %s\n",current_time
+                ,src_addr, dst_addr);
+                write_log(ipsec_log,log,LOG_INFO);
             }
             else{
-                 snprintf(log,2048,"%s;MALFORMED_PACKET\n",current_time);
+                ike_quiet = true;
             }
-            write_log(main_log,log,LOG_WARNING);
-            malformed ++;
-        }
-        total_processed++;
-        if(total_processed % 10 == 0) {
-            printf("\e[1;1H\e[2J");
-            printf("================================\n");
-	    puts(
-		 "             __,---.__\n"
-		 "        __,-'         `-.\n"
-		 "       /_/_,'  SNART🐷   \\&\n"
-		 "       _,👀               \\\n"
-		 "      (\")            .    |\n"
-		 "      🧃``--|__|--..-'`.__|\n"
-		 );
-	    printf("================================\n          Tunnels\n================================\n");
-            for (uint32_t i = 1; i <= tunnels->size; i++){
-                struct tunnel* check = ((struct tunnel*) tunnels->array[i]);
-                printf("--------------------------------\n| tunnel %d\n",i);
-                int bit4 = check->client_ip >> 24 & 0xFF;
-                int bit3 = check->client_ip >> 16 & 0xFF;
-                int bit2 = check->client_ip >> 8 & 0xFF;
-                int bit1 = check->client_ip & 0xFF;
-                printf("| Client: %u.%u.%u.%u\n",bit1,bit2,bit3,bit4);
-                bit4 = check->host_ip >> 24 & 0xFF;
-                bit3 = check->host_ip >> 16 & 0xFF;
-                bit2 = check->host_ip >> 8 & 0xFF;
-                bit1 = check->host_ip & 0xFF;
-                printf("| Host: %u.%u.%u.%u\n",bit1,bit2,bit3,bit4);
+        }
+        else{
+            //responses to initiators over their budget are left out as well, the others share the budget of the requests
+            ike_quiet = source_limit_over(limiter,&dst_ip) ||
+            !token_bucket_take(&flood->logged,current_tick,INIT_LOG_RATE,INIT_LOG_RATE);
+        }
+        if(ike_quiet){
+            flood->unlogged++;
+            stats->init_unlogged++;
+        }
+        if(get_initiator_flag(isakmp_hdr) == 0 && isakmp_hdr->responder_spi != (rte_be64_t)0 && check_if_tunnel_exists(isakmp_hdr)==0){
+            if(source_limit_over(limiter,&dst_ip)){
+                //the initiator was over its budget when it sent the request
+                flood->untracked++;
+                stats->init_untracked++;
             }
-            printf("================================");
-            printf("\n| Non IPSec packets: %d", non_ipsec);
-            printf("\n| Tampered IPSec packets: %d",tampered_pkts);
-            printf("\n| Legitimate IPSec packets: %d",legit_pkts + isakmp_pkts);
-            printf("\n| Malformed packets: %d",malformed);
-            printf("\n| Total packets processed: %d\n",total_processed);
-            printf("================================\n");
-            int unaccounted = total_processed - non_ipsec - tampered_pkts - legit_pkts - isakmp_pkts - malformed;
-            if( unaccounted == 0){
-                printf("| All traffic accounted for\n");
-            }else{
-                printf("| %d packets unaccounted for. \n| Please check network logs.\n", unaccounted);
+            else{
+                //Only if server responds then tunnel should be considered legit
+                struct tunnel new_tunnel;
+                struct tunnel_ike new_ike;
+                new_tunnel.host_ip = src_ip;
+                new_tunnel.client_ip = dst_ip;
+
+                new_ike.responder_spi = isakmp_hdr->responder_spi;
+                new_ike.initiator_spi = isakmp_hdr->initiator_spi;
+                memset(new_ike.children,0,sizeof(new_ike.children));
+                new_ike.next_serial = 0;
+                new_ike.saved = false;
+
+                new_ike.dpd = false;
+                new_ike.dpd_count = 0;
+
+                new_tunnel.auth = false;
+                new_ike.deleting = false;
+                new_tunnel.encap = ESP_ENCAP_UNKNOWN;
+                memset(new_ike.skf,0,sizeof(new_ike.skf));
+                if(insert_tunnel(&new_tunnel,&new_ike) == NULL){
+                    snprintf(log,2048,"%s;TUNNEL_TABLE_FULL;%s;%s;%lx;%lx\n",current_time
+                    ,src_addr, dst_addr, isakmp_hdr->initiator_spi,isakmp_hdr->responder_spi);
+                    write_log(ipsec_log,log,LOG_WARNING);
+                }
             }
-            printf("================================\n");
+        }
+        int check = analyse_isakmp_payload(pkt,isakmp_hdr,desc->payload_offset + sizeof(struct rte_isakmp_hdr),isakmp_hdr->nxt_payload);
+        ike_quiet = false;
+        if(check == 0){
+            snprintf(log,2048,"%s;INVALID_ISAKMP_PACKET;%s;%s;%lx;%lx\n",current_time
+            ,src_addr, dst_addr, isakmp_hdr->initiator_spi,isakmp_hdr->responder_spi);
+            write_log(ipsec_log,log,LOG_WARNING);
+            stats->tampered_pkts++;
+        }
+        else{
+             stats->isakmp_pkts++;
+        }
+    }
+    else{
+        analyse_tunnel_ike(pkt,desc->payload_offset);
+    }
+}
+
+/// Handles udp packets that are neither IKE nor ESP
+static void
+handle_udp(struct rte_mbuf *pkt, const struct pkt_desc *desc){
+    char log[2048];
+    const bool ipv4 = RTE_ETH_IS_IPV4_HDR(desc->ptype);
+    format_addresses(pkt,desc);
+    snprintf(log,2048,ipv4 ? "%s;UDP;%s:%d->%s:%d\n" : "%s;UDP;[%s]:%d->[%s]:%d\n",current_time
+    ,src_addr,desc->src_port,dst_addr,desc->dst_port);
+    write_log(main_log,log,LOG_WARNING);
+    stats->non_ipsec++;
+}
+
+/// Handles tcp packets
+static void
+handle_tcp(struct rte_mbuf *pkt, const struct pkt_desc *desc){
+    char log[2048];
+    const bool ipv4 = RTE_ETH_IS_IPV4_HDR(desc->ptype);
+    format_addresses(pkt,desc);
+    snprintf(log,2048,ipv4 ? "%s;TCP;%s:%d->%s:%d\n" : "%s;TCP;[%s]:%d->[%s]:%d\n",current_time
+    ,src_addr,desc->src_port,dst_addr,desc->dst_port);
+    write_log(main_log,log,LOG_WARNING);
+    stats->non_ipsec++;
+}
+
+/// Handles ICMP and ICMPv6 packets
+static void
+handle_icmp(struct rte_mbuf *pkt, const struct pkt_desc *desc){
+    char log[2048];
+    const bool ipv4 = RTE_ETH_IS_IPV4_HDR(desc->ptype);
+    struct rte_icmp_hdr *icmp_hdr = rte_pktmbuf_mtod_offset(pkt,struct rte_icmp_hdr *,desc->l4_offset);
+    format_addresses(pkt,desc);
+    if(icmp_hdr->icmp_type == (ipv4 ? RTE_IP_ICMP_ECHO_REPLY : ICMP6_ECHO_REPLY)){
+        snprintf(log,2048,"%s;Ping response %s to %s\n",current_time,src_addr,dst_addr);
+    }
+    else if(icmp_hdr->icmp_type == (ipv4 ? RTE_IP_ICMP_ECHO_REQUEST : ICMP6_ECHO_REQUEST)){
+        snprintf(log,2048,"%s;Ping request: %s to %s\n",current_time,src_addr,dst_addr);
+    }
+    else{
+        snprintf(log,2048,"%s;ICMP Packet: %s to %s\n",current_time,src_addr,dst_addr);
+    }
+    write_log(main_log,log,LOG_WARNING);
+    stats->non_ipsec++;
+}
+
+/// Handles packets that are not ip or of a protocol that is not analysed
+static void
+handle_other(struct rte_mbuf *pkt __rte_unused, const struct pkt_desc *desc __rte_unused){
+    stats->non_ipsec++;
+}
+
+/// Handles packets too short for their headers
+static void
+handle_malformed(struct rte_mbuf *pkt, const struct pkt_desc *desc){
+    char log[2048];
+    uint32_t x = rte_pktmbuf_data_len(pkt);
+    if((RTE_ETH_IS_IPV4_HDR(desc->ptype) && desc->l3_offset + sizeof(struct rte_ipv4_hdr) <= x) ||
+    (RTE_ETH_IS_IPV6_HDR(desc->ptype) && desc->l3_offset + sizeof(struct rte_ipv6_hdr) <= x)){
+        format_addresses(pkt,desc);
+        snprintf(log,2048,"%s;MALFORMED_PACKET;%s;%s\n",current_time,src_addr,dst_addr);
+    }
+    else{
+        snprintf(log,2048,"%s;MALFORMED_PACKET\n",current_time);
+    }
+    write_log(main_log,log,LOG_WARNING);
+    stats->malformed_pkts++;
+}
+
+static void handle_fragment(struct rte_mbuf *pkt, const struct pkt_desc *desc);
+
+/// Handler of every class, indexed by class
+static void (*const class_handlers[PKT_CLASS_MAX])(struct rte_mbuf *pkt, const struct pkt_desc *desc) = {
+    [PKT_CLASS_ESP] = handle_esp,
+    [PKT_CLASS_IKE] = handle_ike,
+    [PKT_CLASS_IKE_NAT_T] = handle_ike_nat_t,
+    [PKT_CLASS_UDP] = handle_udp,
+    [PKT_CLASS_TCP] = handle_tcp,
+    [PKT_CLASS_ICMP] = handle_icmp,
+    [PKT_CLASS_FRAGMENT] = handle_fragment,
+    [PKT_CLASS_OTHER] = handle_other,
+    [PKT_CLASS_MALFORMED] = handle_malformed,
+};
+
+/**
+ * Handles udp fragments. Fragments of IKE datagrams are held until the datagram is complete, which
+ * is then classified and handled like any other packet. Fragments of other datagrams are not analysed
+ */
+static void
+handle_fragment(struct rte_mbuf *pkt, const struct pkt_desc *desc){
+    struct rte_mbuf *datagram;
+    struct pkt_desc datagram_desc;
+    switch(reasm_add(reasm,pkt,desc,&datagram,&datagram_desc)){
+        case REASM_DONE:{
+            enum pkt_class c = classify_packet(datagram,&datagram_desc);
+            datagram_desc.pkt_class = c;
+            class_handlers[c](datagram,&datagram_desc);
+            break;
+        }
+        case REASM_NOT_IKE:
+            stats->non_ipsec++;
+            break;
+        case REASM_MALFORMED:
+            handle_malformed(pkt,desc);
+            break;
+        default:
+            stats->fragments++;
+            break;
+    }
+}
+
+/**
+ * Packets of a burst sorted by class, waiting to be handed to their handler in bulk
+ */
+struct class_queues{
+    /// index in the burst of the packets waiting in each class
+    uint16_t index[PKT_CLASS_MAX][MAX_BURST_SIZE];
+    uint16_t nb_pkts[PKT_CLASS_MAX];
+};
+
+/// Hands the packets waiting in every class to their handler, ESP first
+static void
+flush_classes(struct class_queues *queues, struct rte_mbuf **pkts, const struct pkt_desc *descs){
+    for(unsigned c = 0; c < PKT_CLASS_MAX; c++){
+        for(uint16_t i = 0; i < queues->nb_pkts[c]; i++){
+            const uint16_t p = queues->index[c][i];
+            class_handlers[c](pkts[p],&descs[p]);
+        }
+        queues->nb_pkts[c] = 0;
+    }
+}
+
+/**
+ * Prefetches the IKE SA index slot of an IKE packet. Lookups cannot be done ahead of handling the packet
+ * as the IKE packets before it in the burst may add or remove tunnels
+ * @param pkt IKE packet
+ * @param ike_offset offset of the isakmp header
+ */
+static inline void
+prefetch_ike_sa(struct rte_mbuf *pkt, uint16_t ike_offset){
+    const struct rte_isakmp_hdr *isakmp_hdr = rte_pktmbuf_mtod_offset(pkt,const struct rte_isakmp_hdr *,ike_offset);
+    ike_sa_index_prefetch(ike_sas,isakmp_hdr->initiator_spi,isakmp_hdr->responder_spi);
+}
+
+/**
+ * Prefetches the ESP SA index slot of an ESP packet
+ * @param pkt ESP packet
+ * @param desc offsets of the headers of the packet
+ */
+static inline void
+prefetch_esp_sa(struct rte_mbuf *pkt, const struct pkt_desc *desc){
+    const struct rte_esp_hdr *esp_header = rte_pktmbuf_mtod_offset(pkt,const struct rte_esp_hdr *,desc->payload_offset);
+    struct ip_addr src, dst;
+    read_addresses(pkt,desc,&src,&dst);
+    esp_sa_index_prefetch(esp_sas,&src,&dst,esp_header->spi);
+}
+
+/**
+ * Processes a burst of packets. Every packet is first parsed and classified while the headers of
+ * the packet PREFETCH_OFFSET places ahead are prefetched, along with the SA index slots of the IKE and
+ * ESP packets, then each class is handed to its handler in bulk. IKE packets change the tunnels that ESP
+ * is checked against, so they and fragments, which may complete an IKE message, are handled in order:
+ * the packets classified before one are handled first
+ * @param pkts packets received from the rx queue
+ * @param nb_pkts number of packets in the burst
+ * @param parsed whether if the rx stage of the pipeline already parsed the packets, their descriptors
+ * are then read from the mbufs
+ */
+static void
+process_burst(struct rte_mbuf **pkts, uint16_t nb_pkts, bool parsed){
+    struct class_queues queues;
+    struct pkt_desc descs[MAX_BURST_SIZE];
+    uint16_t i;
+
+    get_current_time(current_time);
+    current_tick = timer_now();
+    memset(queues.nb_pkts,0,sizeof(queues.nb_pkts));
+
+    for(i = 0; i < PREFETCH_OFFSET && i < nb_pkts; i++){
+        rte_prefetch0(rte_pktmbuf_mtod(pkts[i],void *));
+    }
+    for(i = 0; i < nb_pkts; i++){
+        if(i + PREFETCH_OFFSET < nb_pkts){
+            rte_prefetch0(rte_pktmbuf_mtod(pkts[i + PREFETCH_OFFSET],void *));
+        }
+        if(parsed){
+            descs[i] = *pkt_desc_field(pkts[i]);
+        }
+        else{
+            parse_packet(pkts[i],&descs[i]);
+        }
+        descs[i].pkt_class = classify_packet(pkts[i],&descs[i]);
+        if(descs[i].pkt_class == PKT_CLASS_IKE){
+            prefetch_ike_sa(pkts[i],descs[i].payload_offset);
+        }
+        else if(descs[i].pkt_class == PKT_CLASS_IKE_NAT_T){
+            prefetch_ike_sa(pkts[i],descs[i].payload_offset + NON_ESP_MARKER_LEN);
+        }
+        else if(descs[i].pkt_class == PKT_CLASS_ESP){
+            prefetch_esp_sa(pkts[i],&descs[i]);
+        }
+    }
+    for(i = 0; i < nb_pkts; i++){
+        const enum pkt_class c = descs[i].pkt_class;
+        if(c == PKT_CLASS_IKE || c == PKT_CLASS_IKE_NAT_T || c == PKT_CLASS_FRAGMENT){
+            flush_classes(&queues,pkts,descs);
+            class_handlers[c](pkts[i],&descs[i]);
+        }
+        else{
+            queues.index[c][queues.nb_pkts[c]++] = i;
+        }
+    }
+    flush_classes(&queues,pkts,descs);
+    stats->total_processed += nb_pkts;
+}
+
+/**
+ * Gets the worker owning the tunnels of a client/host pair. Without the pipeline this is the rx
+ * queue that RSS steers the pair to, which mirrors the hash computed by the NIC using the same key
+ * and redirection table, or the socket the kernel hands the pair to with the afpacket backend.
+ * Either way, both directions of a pair get the same worker
+ * @param client_ip ip address of the client
+ * @param host_ip ip address of the host, of the same family as the client
+ * @returns index of the owning worker
+ */
+static uint16_t
+worker_for_pair(const struct ip_addr *client_ip, const struct ip_addr *host_ip){
+    union rte_thash_tuple tuple;
+    uint32_t hash;
+    if(nb_workers == 1){
+        return 0;
+    }
+    if(ip_addr_is_ipv4(client_ip)){
+        if(afpacket_mode){
+            return afpacket_fanout_member(client_ip->words[3],host_ip->words[3],nb_workers);
+        }
+        tuple.v4.src_addr = rte_be_to_cpu_32(client_ip->words[3]);
+        tuple.v4.dst_addr = rte_be_to_cpu_32(host_ip->words[3]);
+        hash = rte_softrss((uint32_t *)&tuple,RTE_THASH_V4_L3_LEN,rss_key);
+    }
+    else{
+        if(afpacket_mode){
+            return afpacket_fanout_member_ipv6(client_ip->words,host_ip->words,nb_workers);
+        }
+        for(int i = 0; i < 4; i++){
+            ((uint32_t *)tuple.v6.src_addr)[i] = rte_be_to_cpu_32(client_ip->words[i]);
+            ((uint32_t *)tuple.v6.dst_addr)[i] = rte_be_to_cpu_32(host_ip->words[i]);
+        }
+        hash = rte_softrss((uint32_t *)&tuple,RTE_THASH_V6_L3_LEN,rss_key);
+    }
+    if(pipeline_mode){
+        return hash % nb_workers;
+    }
+    return (hash % reta_size) % nb_rx_queues;
+}
+
+/**
+ * Gets the parse worker a packet should be handed to by the rx stage of the pipeline
+ * @param pkt packet to hand over
+ * @param desc offsets of the headers of the packet
+ * @returns index of the owning worker
+ */
+static uint16_t
+worker_for_packet(struct rte_mbuf *pkt, const struct pkt_desc *desc){
+    uint32_t x = rte_pktmbuf_data_len(pkt);
+    struct ip_addr src, dst;
+    if(nb_workers == 1){
+        return 0;
+    }
+    if(RTE_ETH_IS_IPV4_HDR(desc->ptype) && desc->l3_offset + sizeof(struct rte_ipv4_hdr) <= x){
+        struct rte_ipv4_hdr *ipv4_hdr = rte_pktmbuf_mtod_offset(pkt,struct rte_ipv4_hdr *,desc->l3_offset);
+        src = ip_addr_from_ipv4(ipv4_hdr->src_addr);
+        dst = ip_addr_from_ipv4(ipv4_hdr->dst_addr);
+        return worker_for_pair(&src,&dst);
+    }
+    if(RTE_ETH_IS_IPV6_HDR(desc->ptype) && desc->l3_offset + sizeof(struct rte_ipv6_hdr) <= x){
+        struct rte_ipv6_hdr *ipv6_hdr = rte_pktmbuf_mtod_offset(pkt,struct rte_ipv6_hdr *,desc->l3_offset);
+        src = ip_addr_from_ipv6(ipv6_hdr->src_addr);
+        dst = ip_addr_from_ipv6(ipv6_hdr->dst_addr);
+        return worker_for_pair(&src,&dst);
+    }
+    return 0;
+}
+
+/// Points tunnels, ike_sas, esp_sas, timers, replays and journal_queue at those of the worker owning a tunnel loaded from file
+static void
+select_worker(struct tunnel *tunnel){
+    struct worker *worker = &workers[worker_for_pair(&tunnel->client_ip,&tunnel->host_ip)];
+    tunnels = worker->tunnels;
+    half_open = worker->half_open;
+    ike_sas = worker->ike_sas;
+    esp_sas = worker->esp_sas;
+    timers = worker->timers;
+    replays = worker->replays;
+    journal_queue = tunnel_journal_queue(journal,worker - workers);
+}
+
+/// Snapshot restore_workers is restoring
+static const struct tunnel_snapshot *restoring;
+
+/// Restores the tunnels of restoring that a worker owns, run on a thread per worker
+static void *
+restore_worker(void *arg){
+    struct worker *worker = arg;
+    tunnels = worker->tunnels;
+    half_open = worker->half_open;
+    ike_sas = worker->ike_sas;
+    esp_sas = worker->esp_sas;
+    timers = worker->timers;
+    replays = worker->replays;
+    journal_queue = tunnel_journal_queue(journal,worker - workers);
+    restore_snapshot(restoring,worker - workers,worker_for_pair);
+    return NULL;
+}
+
+/**
+ * Restores a snapshot into every worker at once, each worker filling its own tunnels and indexes on a thread of its
+ * own as inserting the tunnels, which misses the cache on every index, is most of the time of a restart
+ * @param snapshot mapped snapshot
+ */
+static void
+restore_workers(const struct tunnel_snapshot *snapshot){
+    pthread_t threads[RTE_MAX_LCORE];
+    bool started[RTE_MAX_LCORE];
+    restoring = snapshot;
+    for(uint16_t w = 0; w < nb_workers; w++){
+        started[w] = nb_workers > 1 && pthread_create(&threads[w],NULL,restore_worker,&workers[w]) == 0;
+        if(!started[w]){
+            restore_worker(&workers[w]);
+        }
+    }
+    for(uint16_t w = 0; w < nb_workers; w++){
+        if(started[w]){
+            pthread_join(threads[w],NULL);
         }
     }
-       
-	return nb_pkts;
+}
+
+/**
+ * Spreads the entries of the redirection table of a port evenly over the rx queues so that
+ * queue_for_pair can tell which queue a hash lands on
+ * @param port port to configure
+ * @returns 0 on success, negative errno if otherwise
+ */
+static int
+rss_reta_init(uint16_t port){
+    struct rte_eth_rss_reta_entry64 *reta_conf;
+    int retval;
+    reta_conf = calloc(reta_size / RTE_RETA_GROUP_SIZE + 1,sizeof(struct rte_eth_rss_reta_entry64));
+    if(reta_conf == NULL){
+        return -ENOMEM;
+    }
+    for(uint16_t i = 0; i < reta_size; i++){
+        reta_conf[i / RTE_RETA_GROUP_SIZE].mask |= 1ULL << (i % RTE_RETA_GROUP_SIZE);
+        reta_conf[i / RTE_RETA_GROUP_SIZE].reta[i % RTE_RETA_GROUP_SIZE] = i % nb_rx_queues;
+    }
+    retval = rte_eth_dev_rss_reta_update(port,reta_conf,reta_size);
+    free(reta_conf);
+    return retval;
 }
 
 /// Init ports used to capture packets
@@ -576,7 +1198,7 @@ int port_init(uint16_t port,struct rte_mempool *mbufpool){
             .max_rx_pkt_len = RTE_ETHER_MAX_LEN // max packet size
         }
     };
-    const uint16_t rx_rings = 1, tx_rings = 1;
+    const uint16_t rx_rings = nb_rx_queues, tx_rings = 1;
     uint16_t nb_rxd = RX_RING_SIZE;
     uint16_t nb_txd = TX_RING_SIZE;
     int retval;
@@ -598,11 +1220,25 @@ int port_init(uint16_t port,struct rte_mempool *mbufpool){
         port_conf.txmode.offloads |= DEV_TX_OFFLOAD_MBUF_FAST_FREE;
     }
 
+    if(rx_rings > 1){
+        /* Hash on the ip addresses only so IKE, NAT-T and ESP packets of a pair all land on the
+           same queue whatever ports they use */
+        port_conf.rxmode.mq_mode = ETH_MQ_RX_RSS;
+        port_conf.rx_adv_conf.rss_conf.rss_key = rss_key;
+        port_conf.rx_adv_conf.rss_conf.rss_key_len = rss_key_len;
+        port_conf.rx_adv_conf.rss_conf.rss_hf = ETH_RSS_IP & dev_info.flow_type_rss_offloads;
+        if(port_conf.rx_adv_conf.rss_conf.rss_hf == 0){
+            printf("Port %u cannot hash on ip addresses\n",port);
+            return -ENOTSUP;
+        }
+    }
+
     retval = rte_eth_dev_configure(port,rx_rings,tx_rings,&port_conf);
     if(retval != 0){
         return retval;
     }
 
+    rxconf = dev_info.default_rxconf;
     for(q = 0; q<rx_rings;q++){
         retval = rte_eth_rx_queue_setup(port,q,nb_rxd,rte_eth_dev_socket_id(port),&rxconf,mbufpool);
         if(retval !=0){
@@ -610,10 +1246,26 @@ int port_init(uint16_t port,struct rte_mempool *mbufpool){
         }
     }
 
+    //packets the port does not give a layer 4 packet type to are classified in software
+    if(rte_eth_dev_get_supported_ptypes(port,RTE_PTYPE_L4_MASK,NULL,0) > 0){
+        printf("Port %u classifies packets in hardware\n",port);
+    }
+    else{
+        printf("Port %u does not classify packets, using software classification\n",port);
+    }
+
     retval = rte_eth_dev_start(port);
     if(retval !=0){
         return retval;
     }
+
+    if(rx_rings > 1){
+        retval = rss_reta_init(port);
+        if(retval != 0){
+            printf("Failed to set redirection table of port %u\n",port);
+            return retval;
+        }
+    }
     struct rte_ether_addr addr;
     
     retval = rte_eth_macaddr_get(port,&addr);
@@ -629,47 +1281,899 @@ int port_init(uint16_t port,struct rte_mempool *mbufpool){
     if(retval != 0){
         return retval;
     }
-    rte_eth_add_rx_callback(port,0,read_data,NULL);
     return 0;
 }
 
-/// Function to run for each port to capture packets and process them
-static void 
-lcore_main(void){
+/**
+ * Works out how many rx queues to use, which is one per receiving lcore capped by what every port
+ * supports, and sizes the RSS key and redirection table to what the ports accept
+ * @param nb_rx_lcores number of lcores that will receive packets
+ */
+static void
+rss_config_init(unsigned nb_rx_lcores){
+    uint16_t portid;
+    struct rte_eth_dev_info dev_info;
+
+    nb_rx_queues = nb_rx_lcores;
+    RTE_ETH_FOREACH_DEV(portid){
+        if(rte_eth_dev_info_get(portid,&dev_info) != 0){
+            continue;
+        }
+        nb_rx_queues = RTE_MIN(nb_rx_queues,dev_info.max_rx_queues);
+        if(dev_info.hash_key_size != 0 && dev_info.hash_key_size <= sizeof(rss_key)){
+            rss_key_len = dev_info.hash_key_size;
+        }
+        reta_size = dev_info.reta_size;
+    }
+    if(nb_rx_queues == 0){
+        nb_rx_queues = 1;
+    }
+    if(nb_rx_queues > 1 && reta_size == 0){
+        printf("Ports do not support RSS, only one rx queue will be used\n");
+        nb_rx_queues = 1;
+    }
+    if(nb_rx_queues < nb_rx_lcores){
+        printf("Only %u of %u lcores will receive packets\n",nb_rx_queues,nb_rx_lcores);
+    }
+    for(uint8_t i = 0; i < sizeof(rss_key); i++){
+        rss_key[i] = i % 2 == 0 ? 0x6d : 0x5a;
+    }
+}
+
+/**
+ * Refreshes the console if a second has passed since the last refresh and packets were processed since
+ * @param last_print cycles at the last refresh
+ * @param printed_total total packets processed at the last refresh
+ */
+static void
+print_stats_periodic(uint64_t *last_print, uint64_t *printed_total){
+    uint64_t now = rte_get_timer_cycles();
+    if(now - *last_print >= rte_get_timer_hz()){
+        uint64_t total = 0;
+        for(uint16_t w = 0; w < nb_workers; w++){
+            total += workers[w].stats.total_processed;
+        }
+        if(total != *printed_total){
+            print_stats();
+            *printed_total = total;
+        }
+        *last_print = now;
+    }
+}
+
+/**
+ * Hands packets over to the workers owning them, through the parse ring or the handoff ring of each worker.
+ * Packets are dropped rather than waiting when a ring is full
+ * @param bufs packets to hand over
+ * @param owner index of the worker owning each packet
+ * @param nb_pkts number of packets
+ * @param handoff whether if the packets go to the handoff rings rather than the parse rings
+ * @returns number of packets dropped
+ */
+static unsigned
+hand_over(struct rte_mbuf **bufs, const uint16_t *owner, uint16_t nb_pkts, bool handoff){
+    struct rte_mbuf *batch[MAX_BURST_SIZE];
+    unsigned drops = 0;
+    for(uint16_t w = 0; w < nb_workers; w++){
+        uint16_t n = 0;
+        for(uint16_t i = 0; i < nb_pkts; i++){
+            if(owner[i] == w){
+                batch[n++] = bufs[i];
+            }
+        }
+        if(n == 0){
+            continue;
+        }
+        unsigned sent = rte_ring_enqueue_burst(handoff ? workers[w].handoff : workers[w].ring,(void **)batch,n,NULL);
+        if(unlikely(sent < n)){
+            drops += n - sent;
+            rte_pktmbuf_free_bulk(batch + sent,n - sent);
+        }
+    }
+    return drops;
+}
+
+/**
+ * Parses a burst and hands the IPsec packets of pairs owned by other workers over to them, which happens
+ * when the NIC does not hash every packet of a pair on its addresses alone. Only the owner of a pair then
+ * changes its tunnels, without any lock
+ * @param worker calling worker
+ * @param bufs burst received, left with the packets kept, parsed
+ * @param nb_rx number of packets received
+ * @returns number of packets kept
+ */
+static uint16_t
+hand_off_foreign(struct worker *worker, struct rte_mbuf **bufs, uint16_t nb_rx){
+    struct rte_mbuf *foreign[MAX_BURST_SIZE];
+    uint16_t owner[MAX_BURST_SIZE];
+    const uint16_t self = worker - workers;
+    uint16_t nb_kept = 0, nb_foreign = 0;
+    for(uint16_t i = 0; i < nb_rx; i++){
+        struct pkt_desc *desc = pkt_desc_field(bufs[i]);
+        uint16_t w = self;
+        parse_packet(bufs[i],desc);
+        switch(classify_packet(bufs[i],desc)){
+            case PKT_CLASS_ESP:
+            case PKT_CLASS_IKE:
+            case PKT_CLASS_IKE_NAT_T:
+            case PKT_CLASS_FRAGMENT:
+                w = worker_for_packet(bufs[i],desc);
+                break;
+            default:
+                //other packets are only counted, any worker will do
+                break;
+        }
+        if(w == self){
+            bufs[nb_kept++] = bufs[i];
+        }
+        else{
+            owner[nb_foreign] = w;
+            foreign[nb_foreign++] = bufs[i];
+        }
+    }
+    if(nb_foreign > 0){
+        worker->handed_off += nb_foreign;
+        worker->handoff_drops += hand_over(foreign,owner,nb_foreign,true);
+    }
+    return nb_kept;
+}
+
+/**
+ * Function run by every worker lcore. Polls the worker's rx queue on every port, analyses the packets
+ * received and those handed over by other workers, and ages the worker's tunnels. The worker on the main
+ * lcore also refreshes the console every second
+ * @param arg worker to run
+ */
+static int
+lcore_main(void *arg){
+    struct worker *worker = arg;
     uint16_t port;
-    for(;;){
+    struct rte_mbuf *bufs[MAX_BURST_SIZE];
+    const bool print = worker->lcore_id == rte_get_main_lcore();
+    uint64_t last_print = 0;
+    uint64_t printed_total = 0;
+
+    tunnels = worker->tunnels;
+    half_open = worker->half_open;
+    ike_sas = worker->ike_sas;
+    esp_sas = worker->esp_sas;
+    timers = worker->timers;
+    stats = &worker->stats;
+    reasm = worker->reasm;
+    limiter = worker->limiter;
+    replays = worker->replays;
+    journal_queue = tunnel_journal_queue(journal,worker - workers);
+    flood = &worker->flood;
+    while(!force_quit){
         RTE_ETH_FOREACH_DEV(port){
-            struct rte_mbuf *bufs[BURST_SIZE];
-            const uint16_t nb_rx = rte_eth_rx_burst(port,0,bufs,BURST_SIZE);
+            const uint16_t nb_rx = rte_eth_rx_burst(port,worker->queue_id,bufs,burst_size);
             if (unlikely(nb_rx == 0)){
                 continue;
             }
-			const uint16_t nb_tx = 0;
-			if (unlikely(nb_tx < nb_rx)) {
-				uint16_t buf;
-				for (buf = nb_tx; buf < nb_rx; buf++)
-					rte_pktmbuf_free(bufs[buf]);
-			}
+            if(worker->handoff != NULL){
+                const uint16_t nb_kept = hand_off_foreign(worker,bufs,nb_rx);
+                process_burst(bufs,nb_kept,true);
+                rte_pktmbuf_free_bulk(bufs,nb_kept);
+            }
+            else{
+                process_burst(bufs,nb_rx,false);
+                rte_pktmbuf_free_bulk(bufs,nb_rx);
+            }
+        }
+        if(worker->handoff != NULL){
+            const unsigned n = rte_ring_dequeue_burst(worker->handoff,(void **)bufs,burst_size,NULL);
+            if(n > 0){
+                process_burst(bufs,n,true);
+                rte_pktmbuf_free_bulk(bufs,n);
+            }
+        }
+        run_timers();
+        take_checkpoint(worker);
+        if(print){
+            print_stats_periodic(&last_print,&printed_total);
+        }
+    }
+    return 0;
+}
+
+/**
+ * rx stage of the pipeline. Polls an rx queue on every port and hands each packet to the parse
+ * worker owning its client/host pair. Packets are dropped rather than waiting when a ring is full
+ * @param arg rx stage to run
+ */
+static int
+lcore_rx(void *arg){
+    struct rx_stage *rx = arg;
+    uint16_t port;
+    struct rte_mbuf *bufs[MAX_BURST_SIZE];
+    uint16_t owner[MAX_BURST_SIZE];
+
+    while(!force_quit){
+        RTE_ETH_FOREACH_DEV(port){
+            const uint16_t nb_rx = rte_eth_rx_burst(port,rx->queue_id,bufs,burst_size);
+            if (unlikely(nb_rx == 0)){
+                continue;
+            }
+            rx->rx_pkts += nb_rx;
+            //parse once here, the parse stage reuses the descriptor
+            for(uint16_t i = 0; i < nb_rx; i++){
+                struct pkt_desc *desc = pkt_desc_field(bufs[i]);
+                parse_packet(bufs[i],desc);
+                owner[i] = worker_for_packet(bufs[i],desc);
+            }
+            rx->ring_drops += hand_over(bufs,owner,nb_rx,false);
+        }
+    }
+    return 0;
+}
+
+/**
+ * Parse stage of the pipeline. Analyses the packets handed over by the rx stages and ages the worker's tunnels
+ * @param arg worker to run
+ */
+static int
+lcore_parse(void *arg){
+    struct worker *worker = arg;
+    struct rte_mbuf *bufs[MAX_BURST_SIZE];
+    unsigned available;
+
+    tunnels = worker->tunnels;
+    half_open = worker->half_open;
+    ike_sas = worker->ike_sas;
+    esp_sas = worker->esp_sas;
+    timers = worker->timers;
+    stats = &worker->stats;
+    reasm = worker->reasm;
+    limiter = worker->limiter;
+    replays = worker->replays;
+    journal_queue = tunnel_journal_queue(journal,worker - workers);
+    flood = &worker->flood;
+    while(!force_quit){
+        unsigned n = rte_ring_dequeue_burst(worker->ring,(void **)bufs,burst_size,&available);
+        run_timers();
+        take_checkpoint(worker);
+        if(n == 0){
+            continue;
+        }
+        if(n + available > worker->ring_peak){
+            worker->ring_peak = n + available;
+        }
+        process_burst(bufs,n,true);
+        rte_pktmbuf_free_bulk(bufs,n);
+    }
+    return 0;
+}
+
+/**
+ * Logging stage of the pipeline. Writes the logs queued by the parse workers and refreshes the console every second
+ * @param arg unused
+ */
+static int
+lcore_log(void *arg __rte_unused){
+    uint64_t last_print = 0;
+    uint64_t printed_total = 0;
+    while(!force_quit){
+        log_stage_poll();
+        print_stats_periodic(&last_print,&printed_total);
+    }
+    return 0;
+}
+
+/// Prints the application options
+static void
+print_usage(const char *prgname){
+    printf("%s [EAL options] -- [--burst-size N] [--pipeline RX:PARSE:LOG] [--ring-size N] [--max-tunnels N] [--max-half-open N] [--replay-window N]\n"
+    "    [--checkpoint-interval N]\n"
+    "%s --backend afpacket --iface IFACE [--threads N] [--burst-size N] [--max-tunnels N] [--max-half-open N] [--replay-window N]\n"
+    "    [--checkpoint-interval N]\n"
+    "%s --read-pcap FILE [--burst-size N] [--max-tunnels N] [--max-half-open N] [--replay-window N]\n"
+    "  --backend dpdk|afpacket: receive from DPDK ports (default) or from a kernel interface through a TPACKET_V3 ring, without EAL\n"
+    "  --iface IFACE: interface received from by the afpacket backend\n"
+    "  --threads N: threads receiving from the interface with the afpacket backend (1-%d, default 1)\n"
+    "  --read-pcap FILE: analyse a pcap or pcapng file as fast as possible without EAL, then report the packet rate\n"
+    "  --burst-size N: number of packets to receive per poll (1-%d, default %d)\n"
+    "  --pipeline RX:PARSE:LOG: receive, parse and log on separate lcores, eg. 1:2-4:5. RX and PARSE are lists of lcores\n"
+    "  --ring-size N: number of entries of the rings between pipeline stages or workers (power of 2, default %d)\n"
+    "  --max-tunnels N: authenticated tunnels each worker can hold, allocated at startup (1-%d, default %d). When full,\n"
+    "    a new tunnel replaces an unresponsive or idle one\n"
+    "  --max-half-open N: IKE SAs yet to authenticate each worker can track, allocated at startup (1-%d, default %d).\n"
+    "    When full, a new one replaces the oldest\n"
+    "  --replay-window N: sequence numbers of the anti-replay window of each ESP SA (power of 2, %d-%d, default %d)\n"
+    "  --checkpoint-interval N: seconds between checkpoints of the tunnels to the tunnel snapshot, written by a thread\n"
+    "    of their own while the workers run (0 for none, at most %d, default %d). Tunnels are also saved on exit\n",
+    prgname,prgname,prgname,RTE_MAX_LCORE,MAX_BURST_SIZE,DEFAULT_BURST_SIZE,DEFAULT_RING_SIZE,MAX_TUNNELS_LIMIT,TUNNEL_POOL_SIZE,
+    MAX_TUNNELS_LIMIT,DEFAULT_MAX_HALF_OPEN,REPLAY_WINDOW_MIN,REPLAY_WINDOW_MAX,DEFAULT_REPLAY_WINDOW,MAX_CHECKPOINT_INTERVAL,
+    DEFAULT_CHECKPOINT_INTERVAL);
+}
+
+/**
+ * Parses a list of lcores such as 1,3-5
+ * @param list string containing the list, parsing stops at the first ':' or end of string
+ * @param lcores array to store the lcores found
+ * @param end set to the character after the list
+ * @returns number of lcores found, -1 if the list is invalid
+ */
+static int
+parse_lcore_list(const char *list, unsigned *lcores, const char **end){
+    int count = 0;
+    char *next;
+    while(true){
+        unsigned long first = strtoul(list,&next,10);
+        unsigned long last = first;
+        if(next == list){
+            return -1;
+        }
+        if(*next == '-'){
+            list = next + 1;
+            last = strtoul(list,&next,10);
+            if(next == list || last < first){
+                return -1;
+            }
+        }
+        for(unsigned long lcore = first; lcore <= last; lcore++){
+            if(lcore >= RTE_MAX_LCORE || count == RTE_MAX_LCORE || !rte_lcore_is_enabled(lcore)){
+                printf("lcore %lu is not enabled\n",lcore);
+                return -1;
+            }
+            lcores[count++] = lcore;
+        }
+        if(*next != ','){
+            break;
+        }
+        list = next + 1;
+    }
+    *end = next;
+    return count;
+}
+
+/**
+ * Parses the lcores given to each stage with --pipeline RX:PARSE:LOG
+ * @param arg value of the option
+ * @returns 0 if the stages are valid, -1 if otherwise
+ */
+static int
+parse_pipeline(const char *arg){
+    const char *end;
+    unsigned log_lcores[RTE_MAX_LCORE];
+    int n = parse_lcore_list(arg,rx_lcores,&end);
+    if(n <= 0 || *end != ':'){
+        return -1;
+    }
+    nb_rx_lcores = n;
+    n = parse_lcore_list(end + 1,parse_lcores,&end);
+    if(n <= 0 || *end != ':'){
+        return -1;
+    }
+    nb_parse_lcores = n;
+    n = parse_lcore_list(end + 1,log_lcores,&end);
+    if(n != 1 || *end != '\0'){
+        return -1;
+    }
+    log_lcore = log_lcores[0];
+
+    //every stage needs a lcore of its own
+    bool used[RTE_MAX_LCORE] = {false};
+    used[log_lcore] = true;
+    for(unsigned i = 0; i < nb_rx_lcores + nb_parse_lcores; i++){
+        unsigned lcore = i < nb_rx_lcores ? rx_lcores[i] : parse_lcores[i - nb_rx_lcores];
+        if(used[lcore]){
+            printf("lcore %u is given to more than one stage\n",lcore);
+            return -1;
+        }
+        used[lcore] = true;
+    }
+    pipeline_mode = true;
+    return 0;
+}
+
+/**
+ * Parses the application options found after the EAL options
+ * @param argc number of arguments left after rte_eal_init
+ * @param argv arguments left after rte_eal_init
+ * @returns 0 if all options are valid, -1 if otherwise
+ */
+static int
+parse_args(int argc, char **argv){
+    static struct option long_options[] = {
+        {"burst-size", required_argument, 0, 'b'},
+        {"pipeline", required_argument, 0, 'p'},
+        {"ring-size", required_argument, 0, 'r'},
+        {"read-pcap", required_argument, 0, 'f'},
+        {"backend", required_argument, 0, 'B'},
+        {"iface", required_argument, 0, 'i'},
+        {"threads", required_argument, 0, 't'},
+        {"max-tunnels", required_argument, 0, 'm'},
+        {"max-half-open", required_argument, 0, 'H'},
+        {"replay-window", required_argument, 0, 'w'},
+        {"checkpoint-interval", required_argument, 0, 'c'},
+        {0, 0, 0, 0}
+    };
+    int opt;
+    while((opt = getopt_long(argc,argv,"b:p:r:f:B:i:t:m:H:w:c:",long_options,NULL)) != -1){
+        switch(opt){
+            case 'b':{
+                long size = strtol(optarg,NULL,10);
+                if(size < 1 || size > MAX_BURST_SIZE){
+                    printf("Burst size must be between 1 and %d\n",MAX_BURST_SIZE);
+                    return -1;
+                }
+                burst_size = size;
+                break;
+            }
+            case 'p':
+                if(parse_pipeline(optarg) < 0){
+                    printf("Invalid pipeline %s\n",optarg);
+                    return -1;
+                }
+                break;
+            case 'r':{
+                long size = strtol(optarg,NULL,10);
+                if(size < MAX_BURST_SIZE || !rte_is_power_of_2(size)){
+                    printf("Ring size must be a power of 2 of at least %d\n",MAX_BURST_SIZE);
+                    return -1;
+                }
+                ring_size = size;
+                break;
+            }
+            case 'f':
+                pcap_path = optarg;
+                break;
+            case 'B':
+                if(strcmp(optarg,"afpacket") == 0){
+                    afpacket_mode = true;
+                }
+                else if(strcmp(optarg,"dpdk") == 0){
+                    afpacket_mode = false;
+                }
+                else{
+                    printf("Unknown backend %s\n",optarg);
+                    return -1;
+                }
+                break;
+            case 'i':
+                afpacket_iface = optarg;
+                break;
+            case 't':{
+                long threads = strtol(optarg,NULL,10);
+                if(threads < 1 || threads > RTE_MAX_LCORE){
+                    printf("Number of threads must be between 1 and %d\n",RTE_MAX_LCORE);
+                    return -1;
+                }
+                afpacket_threads = threads;
+                break;
+            }
+            case 'm':{
+                long tunnel_count = strtol(optarg,NULL,10);
+                if(tunnel_count < 1 || tunnel_count > MAX_TUNNELS_LIMIT){
+                    printf("Maximum number of tunnels must be between 1 and %d\n",MAX_TUNNELS_LIMIT);
+                    return -1;
+                }
+                max_tunnels = tunnel_count;
+                break;
+            }
+            case 'H':{
+                long half_open_count = strtol(optarg,NULL,10);
+                if(half_open_count < 1 || half_open_count > MAX_TUNNELS_LIMIT){
+                    printf("Maximum number of half-open IKE SAs must be between 1 and %d\n",MAX_TUNNELS_LIMIT);
+                    return -1;
+                }
+                max_half_open = half_open_count;
+                break;
+            }
+            case 'w':{
+                long size = strtol(optarg,NULL,10);
+                if(size < REPLAY_WINDOW_MIN || size > REPLAY_WINDOW_MAX || !rte_is_power_of_2(size)){
+                    printf("Replay window must be a power of 2 between %d and %d\n",REPLAY_WINDOW_MIN,REPLAY_WINDOW_MAX);
+                    return -1;
+                }
+                replay_size = size;
+                break;
+            }
+            case 'c':{
+                long seconds = strtol(optarg,NULL,10);
+                if(seconds < 0 || seconds > MAX_CHECKPOINT_INTERVAL){
+                    printf("Checkpoint interval must be between 0 and %d seconds\n",MAX_CHECKPOINT_INTERVAL);
+                    return -1;
+                }
+                checkpoint_interval = seconds;
+                break;
+            }
+            default:
+                return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Allocates the tunnels, their indexes and timers and the reassembly table of a worker
+ * @param worker worker to initialise
+ * @param lcore_id lcore the worker will run on
+ */
+static void
+worker_init(struct worker *worker, unsigned lcore_id){
+    worker->lcore_id = lcore_id;
+    if(tunnel_rcu == NULL){
+        tunnel_rcu = tunnel_rcu_create();
+        if(tunnel_rcu == NULL){
+            rte_exit(EXIT_FAILURE,"Cannot allocate RCU variable of tunnels\n");
+        }
+    }
+    worker->tunnels = tunnel_pool_create(max_tunnels,tunnel_rcu);
+    if(worker->tunnels == NULL){
+        rte_exit(EXIT_FAILURE,"Cannot allocate tunnels\n");
+    }
+    //only the worker reads its half-open IKE SAs, their slots are reused at once
+    worker->half_open = tunnel_pool_create(max_half_open,NULL);
+    if(worker->half_open == NULL){
+        rte_exit(EXIT_FAILURE,"Cannot allocate half-open IKE SAs\n");
+    }
+    //sized for full pools with every child SA indexed, so that adding to the indexes never fails
+    worker->ike_sas = ike_sa_index_create(max_tunnels + max_half_open);
+    if(worker->ike_sas == NULL){
+        rte_exit(EXIT_FAILURE,"Cannot allocate IKE SA index\n");
+    }
+    worker->esp_sas = esp_sa_index_create(max_tunnels * ESP_SAS_PER_TUNNEL);
+    if(worker->esp_sas == NULL){
+        rte_exit(EXIT_FAILURE,"Cannot allocate ESP SA index\n");
+    }
+    worker->timers = timer_wheel_create(timer_now());
+    if(worker->timers == NULL){
+        rte_exit(EXIT_FAILURE,"Cannot allocate timers\n");
+    }
+    worker->reasm = reasm_create();
+    if(worker->reasm == NULL){
+        rte_exit(EXIT_FAILURE,"Cannot allocate reassembly table\n");
+    }
+    //only authenticated tunnels get ESP packets, the windows follow the handles of their pool
+    worker->replays = replay_table_create(max_tunnels * TUNNEL_CHILD_SAS,replay_size);
+    if(worker->replays == NULL){
+        rte_exit(EXIT_FAILURE,"Cannot allocate replay windows\n");
+    }
+    worker->limiter = source_limiter_create(SOURCE_INIT_RATE,SOURCE_INIT_BURST);
+    if(worker->limiter == NULL){
+        rte_exit(EXIT_FAILURE,"Cannot allocate IKE_SA_INIT budgets\n");
+    }
+}
+
+/// Stops the workers and the console on SIGINT and SIGTERM
+static void
+signal_handler(int signum){
+    if(signum == SIGINT || signum == SIGTERM){
+        force_quit = true;
+    }
+}
+
+/**
+ * Gets the tunnels of every worker into the checkpoint records, allocated the first time with a part for each worker
+ * as large as its pool. While the workers run, each is asked to copy its own tunnels from its loop with
+ * take_checkpoint and waited for, otherwise they are copied here
+ * @param running whether the workers run
+ * @returns the number of tunnels copied, -1 if the records cannot be allocated or the workers stopped first
+ */
+static int64_t
+copy_tunnels(bool running){
+    uint64_t epoch;
+    uint64_t count = 0;
+    if(checkpoint.header == NULL){
+        uint64_t capacity = 0;
+        for(uint16_t w = 0; w < nb_workers; w++){
+            capacity += workers[w].tunnels->capacity;
+        }
+        if(tunnel_snapshot_alloc(&checkpoint,capacity) != 0){
+            return -1;
+        }
+        capacity = 0;
+        for(uint16_t w = 0; w < nb_workers; w++){
+            workers[w].checkpoint_records = checkpoint.tunnels + capacity;
+            capacity += workers[w].tunnels->capacity;
+        }
+    }
+    if(running){
+        epoch = __atomic_add_fetch(&checkpoint_epoch,1,__ATOMIC_RELEASE);
+        for(uint16_t w = 0; w < nb_workers; w++){
+            //a worker stopping first leaves its part to the last checkpoint, taken once every worker stopped
+            while(__atomic_load_n(&workers[w].checkpoint_done,__ATOMIC_ACQUIRE) != epoch){
+                if(force_quit){
+                    return -1;
+                }
+                usleep(1000);
+            }
+        }
+    }
+    else{
+        for(uint16_t w = 0; w < nb_workers; w++){
+            tunnels = workers[w].tunnels;
+            half_open = workers[w].half_open;
+            replays = workers[w].replays;
+            workers[w].checkpoint_count = snapshot_tunnels(workers[w].checkpoint_records);
+        }
+    }
+    //the parts are packed together for the snapshot and copied into again by the next checkpoint
+    for(uint16_t w = 0; w < nb_workers; w++){
+        memmove(checkpoint.tunnels + count,workers[w].checkpoint_records,
+        workers[w].checkpoint_count * sizeof(struct snapshot_tunnel));
+        count += workers[w].checkpoint_count;
+    }
+    return count;
+}
+
+/**
+ * Writes the tunnels of every worker to the tunnel snapshot, which takes the place of the previous one once it is on
+ * disk. The seq of the tunnel journal is taken before the workers copy their tunnels, so that the records they
+ * append meanwhile are replayed over the snapshot on restore
+ * @param running whether the workers run
+ * @returns the number of tunnels written, -1 if the snapshot cannot be written
+ */
+static int64_t
+write_snapshot(bool running){
+    const uint64_t seq = tunnel_journal_seq(journal);
+    const int64_t count = copy_tunnels(running);
+    if(count < 0 || tunnel_snapshot_write(&checkpoint,tunnel_snapshot_file,count,seq) != 0){
+        return -1;
+    }
+    tunnel_journal_checkpoint(journal,seq);
+    return count;
+}
+
+/**
+ * Writes a checkpoint of the tunnels every checkpoint_interval seconds while the workers run, so that a restart
+ * after a crash restores their replay windows and only replays the journal written since
+ * @param arg unused
+ */
+static void *
+checkpoint_loop(void *arg __rte_unused){
+    uint32_t elapsed = 0;
+    while(!force_quit){
+        struct timespec start, end;
+        int64_t count;
+        sleep(1);
+        if(++elapsed < checkpoint_interval || force_quit){
+            continue;
+        }
+        elapsed = 0;
+        clock_gettime(CLOCK_MONOTONIC,&start);
+        count = write_snapshot(true);
+        clock_gettime(CLOCK_MONOTONIC,&end);
+        if(count < 0){
+            checkpoint_errors++;
+            continue;
+        }
+        checkpoints++;
+        checkpoint_tunnels = count;
+        checkpoint_ms = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+    }
+    return NULL;
+}
+
+/// Starts the checkpoint thread once the tunnels are loaded, unless checkpoints are off or tunnels are not saved
+static void
+start_checkpoints(void){
+    if(checkpoint_interval == 0 || journal == NULL){
+        return;
+    }
+    if(pthread_create(&checkpointer,NULL,checkpoint_loop,NULL) != 0){
+        printf("Cannot start the checkpoint thread, tunnels are only saved to %s on exit\n",tunnel_snapshot_file);
+        return;
+    }
+    checkpointing = true;
+}
+
+/**
+ * Saves the tunnels of every worker to the tunnel snapshot, restored on the next start, then closes the tunnel
+ * journal. Only called once the workers stopped
+ */
+static void
+save_tunnels(void){
+    int64_t count;
+    if(checkpointing){
+        pthread_join(checkpointer,NULL);
+        checkpointing = false;
+    }
+    if(journal == NULL){
+        return;
+    }
+    count = write_snapshot(false);
+    if(count >= 0){
+        printf("Saved %" PRId64 " tunnels to %s\n",count,tunnel_snapshot_file);
+    }
+    else{
+        printf("Cannot write %s, tunnels will be restored from %s\n",tunnel_snapshot_file,tunnel_journal_file);
+    }
+    close_tunnel_journal();
+    if(checkpoint.header != NULL){
+        tunnel_snapshot_free(&checkpoint);
+    }
+}
+
+/**
+ * Analyses every packet of a capture file on the calling thread as fast as possible, then prints the
+ * counters and the rate packets were analysed at. Runs without EAL, the packets are views into the
+ * mapped file and tunnels start empty and are not saved so that runs over the same file are repeatable
+ * @param path path of the pcap or pcapng file
+ * @returns 0 on success, -1 if the file cannot be read
+ */
+static int
+read_pcap(const char *path){
+    struct pcap_file file;
+    struct rte_mbuf views[MAX_BURST_SIZE];
+    struct rte_mbuf *bufs[MAX_BURST_SIZE];
+    struct timespec start, end;
+    uint64_t bytes = 0;
+    uint16_t n;
+
+    if(pcap_open(&file,path) != 0){
+        return -1;
+    }
+    nb_workers = 1;
+    worker_init(&workers[0],0);
+    tunnels = workers[0].tunnels;
+    half_open = workers[0].half_open;
+    ike_sas = workers[0].ike_sas;
+    esp_sas = workers[0].esp_sas;
+    timers = workers[0].timers;
+    stats = &workers[0].stats;
+    reasm = workers[0].reasm;
+    limiter = workers[0].limiter;
+    replays = workers[0].replays;
+    flood = &workers[0].flood;
+
+    clock_gettime(CLOCK_MONOTONIC,&start);
+    while((n = pcap_next_burst(&file,views,bufs,burst_size)) > 0){
+        process_burst(bufs,n,false);
+        for(uint16_t i = 0; i < n; i++){
+            bytes += rte_pktmbuf_pkt_len(bufs[i]);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC,&end);
+    report_init_flood(timer_now());
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    uint64_t packets = workers[0].stats.total_processed;
+    print_stats();
+    printf("| Read %" PRIu64 " packets (%" PRIu64 " skipped) from %s in %.3f s\n",packets,file.skipped,path,seconds);
+    if(seconds > 0){
+        printf("| %.0f packets/s, %.1f Mbit/s\n",packets / seconds,bytes * 8 / seconds / 1e6);
+    }
+    printf("================================\n");
+    pcap_close(&file);
+    return 0;
+}
+
+/**
+ * Function run by every thread of the afpacket backend. Receives bursts from the thread's socket,
+ * analyses them in place in the ring and ages the worker's tunnels
+ * @param arg worker to run, its queue id is the index of its socket
+ */
+static void *
+afpacket_worker(void *arg){
+    struct worker *worker = arg;
+    struct afpacket_rx *rx = &afpacket_rxs[worker->queue_id];
+    struct rte_mbuf views[MAX_BURST_SIZE];
+    struct rte_mbuf *bufs[MAX_BURST_SIZE];
+
+    tunnels = worker->tunnels;
+    half_open = worker->half_open;
+    ike_sas = worker->ike_sas;
+    esp_sas = worker->esp_sas;
+    timers = worker->timers;
+    stats = &worker->stats;
+    reasm = worker->reasm;
+    limiter = worker->limiter;
+    replays = worker->replays;
+    journal_queue = tunnel_journal_queue(journal,worker - workers);
+    flood = &worker->flood;
+    while(!force_quit){
+        const uint16_t nb_rx = afpacket_rx_burst(rx,views,bufs,burst_size);
+        if(nb_rx > 0){
+            process_burst(bufs,nb_rx,false);
+        }
+        run_timers();
+        take_checkpoint(worker);
+    }
+    return NULL;
+}
+
+/**
+ * Receives from a kernel interface without EAL. Every thread opens its own socket in a fanout group
+ * so that the kernel spreads client/host pairs over the threads, each thread owning the tunnels of
+ * its pairs. The calling thread refreshes the console every second until SIGINT or SIGTERM, then saves the tunnels
+ * @param iface interface to receive from
+ * @returns 0 once stopped, -1 if the sockets cannot be opened
+ */
+static int
+run_afpacket(const char *iface){
+    uint64_t printed_total = 0;
+    const uint16_t fanout_id = getpid() & 0xFFFF;
+
+    nb_workers = afpacket_threads;
+    for(uint16_t w = 0; w < nb_workers; w++){
+        worker_init(&workers[w],w);
+        workers[w].queue_id = w;
+        if(afpacket_open(&afpacket_rxs[w],iface,fanout_id,nb_workers > 1) != 0){
+            return -1;
+        }
+    }
+    load_tunnel(nb_workers,select_worker,restore_workers);
+    signal(SIGINT,signal_handler);
+    signal(SIGTERM,signal_handler);
+    start_checkpoints();
+
+    printf("\n\n\n\n\n\n\n\n\n\n\n\n=====================\nNow monitoring %s...\n=====================\n\n",iface);
+    for(uint16_t w = 0; w < nb_workers; w++){
+        if(pthread_create(&workers[w].thread,NULL,afpacket_worker,&workers[w]) != 0){
+            printf("Cannot start thread %u\n",w);
+            return -1;
         }
     }
+    while(!force_quit){
+        uint64_t total = 0;
+        uint64_t drops = 0;
+        sleep(1);
+        for(uint16_t w = 0; w < nb_workers; w++){
+            total += workers[w].stats.total_processed;
+            drops += afpacket_drops(&afpacket_rxs[w]);
+        }
+        if(total != printed_total){
+            print_stats();
+            printf("| Dropped by %s: %" PRIu64 "\n================================\n",iface,drops);
+            printed_total = total;
+        }
+    }
+    for(uint16_t w = 0; w < nb_workers; w++){
+        pthread_join(workers[w].thread,NULL);
+    }
+    save_tunnels();
+    return 0;
 }
 
 int main(int argc, char **argv){
     struct rte_mempool *mbuf_pool;
     uint16_t nb_ports;
     uint16_t portid;
+    //function and argument each lcore is launched with
+    lcore_function_t *lcore_function[RTE_MAX_LCORE] = {NULL};
+    void *lcore_arg[RTE_MAX_LCORE];
+    unsigned lcore_id;
     
     static const struct rte_mbuf_dynfield params = {
-        .name = "testing",
-        .size = sizeof(uint64_t),
-        .align = __alignof__(uint64_t)
+        .name = "snart_pkt_desc",
+        .size = sizeof(struct pkt_desc),
+        .align = __alignof__(struct pkt_desc)
     };
 
+    //offline mode and the afpacket backend run without EAL, so look for them before rte_eal_init gets the arguments
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i],"--read-pcap") == 0 || strncmp(argv[i],"--read-pcap=",12) == 0 ||
+        (strcmp(argv[i],"--backend") == 0 && i + 1 < argc && strcmp(argv[i + 1],"afpacket") == 0) ||
+        strcmp(argv[i],"--backend=afpacket") == 0){
+            if(parse_args(argc,argv) < 0 || pipeline_mode){
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            if(pcap_path != NULL){
+                return read_pcap(pcap_path) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+            }
+            if(afpacket_iface == NULL){
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            return run_afpacket(afpacket_iface) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
     int ret = rte_eal_init(argc,argv);
 
     if(ret < 0){
         rte_exit(EXIT_FAILURE,"Error with EAL initialisation\n");
     }
+    argc -= ret;
+    argv += ret;
+
+    if(parse_args(argc,argv) < 0){
+        print_usage(argv[0]);
+        rte_exit(EXIT_FAILURE,"Invalid arguments\n");
+    }
 
     //count number of avaliable ports
     nb_ports = rte_eth_dev_count_avail();
@@ -677,9 +2181,17 @@ int main(int argc, char **argv){
     if(nb_ports < 1){
         rte_exit(EXIT_FAILURE,"No ports are available!\n");        
     }
+    rss_config_init(pipeline_mode ? nb_rx_lcores : rte_lcore_count());
 
-    //create mbuf_pool
-    mbuf_pool = rte_pktmbuf_pool_create("MBUF_POOL",NUM_MBUFS * nb_ports,MBUF_CACHE_SIZE,
+    //create mbuf_pool, large enough to fill every rx queue (and ring) while each lcore holds a burst and its cache
+    unsigned nb_mbufs = RTE_MAX(NUM_MBUFS,nb_rx_queues * (RX_RING_SIZE + MAX_BURST_SIZE) + rte_lcore_count() * MBUF_CACHE_SIZE);
+    if(pipeline_mode){
+        nb_mbufs += nb_parse_lcores * ring_size;
+    }
+    else if(nb_rx_queues > 1){
+        nb_mbufs += nb_rx_queues * ring_size;
+    }
+    mbuf_pool = rte_pktmbuf_pool_create("MBUF_POOL",nb_mbufs * nb_ports,MBUF_CACHE_SIZE,
     0,RTE_MBUF_DEFAULT_BUF_SIZE,rte_socket_id());
 
     if(mbuf_pool == NULL){
@@ -687,9 +2199,9 @@ int main(int argc, char **argv){
     }
     
     //register dynamic field
-    rte_mbuf_dynfield_offset = rte_mbuf_dynfield_register(&params);
+    pkt_desc_offset = rte_mbuf_dynfield_register(&params);
 
-    if(rte_mbuf_dynfield_offset < 0){
+    if(pkt_desc_offset < 0){
         rte_exit(EXIT_FAILURE,"Cannot register mbuf field\n");
     }
 
@@ -699,16 +2211,73 @@ int main(int argc, char **argv){
             rte_exit(EXIT_FAILURE,"Failed to initialise port %u\n",portid);
         }
     }
-    tunnels = malloc(sizeof(struct Array));
+
+    if(pipeline_mode){
+        //rx stages, parse workers each fed by a ring and one logging stage
+        for(uint16_t q = 0; q < nb_rx_queues; q++){
+            rx_stages[q].lcore_id = rx_lcores[q];
+            rx_stages[q].queue_id = q;
+            lcore_function[rx_lcores[q]] = lcore_rx;
+            lcore_arg[rx_lcores[q]] = &rx_stages[q];
+        }
+        nb_workers = nb_parse_lcores;
+        for(uint16_t w = 0; w < nb_workers; w++){
+            char name[RTE_RING_NAMESIZE];
+            worker_init(&workers[w],parse_lcores[w]);
+            snprintf(name,sizeof(name),"PARSE_RING_%u",w);
+            workers[w].ring = rte_ring_create(name,ring_size,rte_lcore_to_socket_id(parse_lcores[w]),RING_F_SC_DEQ);
+            if(workers[w].ring == NULL){
+                rte_exit(EXIT_FAILURE,"Cannot create ring of parse lcore %u\n",parse_lcores[w]);
+            }
+            lcore_function[parse_lcores[w]] = lcore_parse;
+            lcore_arg[parse_lcores[w]] = &workers[w];
+        }
+        if(log_stage_init(ring_size,rte_lcore_to_socket_id(log_lcore)) != 0){
+            rte_exit(EXIT_FAILURE,"Cannot create ring of logging lcore\n");
+        }
+        lcore_function[log_lcore] = lcore_log;
+        lcore_arg[log_lcore] = NULL;
+    }
+    else{
+        //give each rx queue a worker, starting with the main lcore
+        nb_workers = nb_rx_queues;
+        lcore_id = rte_get_main_lcore();
+        for(uint16_t q = 0; q < nb_rx_queues; q++){
+            if(q != 0){
+                lcore_id = rte_get_next_lcore(lcore_id,1,0);
+            }
+            worker_init(&workers[q],lcore_id);
+            workers[q].queue_id = q;
+            if(nb_rx_queues > 1){
+                char name[RTE_RING_NAMESIZE];
+                snprintf(name,sizeof(name),"HANDOFF_RING_%u",q);
+                workers[q].handoff = rte_ring_create(name,ring_size,rte_lcore_to_socket_id(lcore_id),RING_F_SC_DEQ);
+                if(workers[q].handoff == NULL){
+                    rte_exit(EXIT_FAILURE,"Cannot create handoff ring of lcore %u\n",lcore_id);
+                }
+            }
+            lcore_function[lcore_id] = lcore_main;
+            lcore_arg[lcore_id] = &workers[q];
+        }
+    }
+    load_tunnel(nb_workers,select_worker,restore_workers);
+    signal(SIGINT,signal_handler);
+    signal(SIGTERM,signal_handler);
+    start_checkpoints();
+
     printf("\n\n\n\n\n\n\n\n\n\n\n\n=====================\nNow monitoring...\n=====================\n\n");
-    if (tunnels) {
-        initArray(tunnels,0,object,false,sizeof(struct tunnel));
-        pthread_t thread;
-        pthread_create(&thread,NULL,timeout,NULL);
-        load_tunnel();
-        lcore_main();
-        rte_eal_cleanup();
+    RTE_LCORE_FOREACH_WORKER(lcore_id){
+        if(lcore_function[lcore_id] != NULL){
+            rte_eal_remote_launch(lcore_function[lcore_id],lcore_arg[lcore_id],lcore_id);
+        }
+    }
+    lcore_id = rte_get_main_lcore();
+    if(lcore_function[lcore_id] != NULL){
+        lcore_function[lcore_id](lcore_arg[lcore_id]);
     }
+    rte_eal_mp_wait_lcore();
+    save_tunnels();
+    rte_eal_cleanup();
 
     return 0;
-}   
+}
@@ -0,0 +1,202 @@
+#include "../include/afpacket.h"
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+
+/// Index of the instruction returning 0 in fanout_filter
+#define FANOUT_RET_0 37
+
+/**
+ * Classic BPF program picking the socket of the fanout group for a packet, the kernel takes the value
+ * returned modulo the number of sockets. The source and destination addresses are added so that both
+ * directions of a client/host pair go to the same socket, whatever the udp ports are, then mixed by
+ * AFPACKET_FANOUT_MIX. Packets that are not ip go to the first socket. The kernel runs it before the
+ * ethernet header is pushed back, so offsets are from the ip header and the ether type is read from
+ * the protocol of the packet
+ */
+static struct sock_filter fanout_filter[] = {
+    BPF_STMT(BPF_LD | BPF_H | BPF_ABS, SKF_AD_OFF + SKF_AD_PROTOCOL),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_IP, 0, 7),
+    //ipv4: source + destination
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 12),
+    BPF_STMT(BPF_MISC | BPF_TAX, 0),
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 16),
+    BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+    BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, AFPACKET_FANOUT_MIX),
+    BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 16),
+    BPF_STMT(BPF_RET | BPF_A, 0),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_IPV6, 0, FANOUT_RET_0 - 10),
+    //ipv6: sum of the 8 words of the source and destination
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 8),
+    BPF_STMT(BPF_MISC | BPF_TAX, 0),
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 12),
+    BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+    BPF_STMT(BPF_MISC | BPF_TAX, 0),
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 16),
+    BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+    BPF_STMT(BPF_MISC | BPF_TAX, 0),
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 20),
+    BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+    BPF_STMT(BPF_MISC | BPF_TAX, 0),
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 24),
+    BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+    BPF_STMT(BPF_MISC | BPF_TAX, 0),
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 28),
+    BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+    BPF_STMT(BPF_MISC | BPF_TAX, 0),
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 32),
+    BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+    BPF_STMT(BPF_MISC | BPF_TAX, 0),
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 36),
+    BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+    BPF_STMT(BPF_MISC | BPF_TAX, 0),
+    BPF_STMT(BPF_MISC | BPF_TXA, 0),
+    BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, AFPACKET_FANOUT_MIX),
+    BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 16),
+    BPF_STMT(BPF_RET | BPF_A, 0),
+    BPF_STMT(BPF_RET | BPF_K, 0),
+};
+
+int afpacket_open(struct afpacket_rx *rx, const char *iface, uint16_t fanout_id, bool fanout){
+    int version = TPACKET_V3;
+    struct tpacket_req3 req;
+    struct sockaddr_ll addr;
+    struct packet_mreq mreq;
+
+    memset(rx,0,sizeof(struct afpacket_rx));
+    rx->ring = MAP_FAILED;
+    rx->fd = socket(AF_PACKET,SOCK_RAW,htons(ETH_P_ALL));
+    if(rx->fd < 0){
+        printf("Cannot open packet socket: %s\n",strerror(errno));
+        return -1;
+    }
+    unsigned ifindex = if_nametoindex(iface);
+    if(ifindex == 0){
+        printf("Unknown interface %s\n",iface);
+        goto fail;
+    }
+    if(setsockopt(rx->fd,SOL_PACKET,PACKET_VERSION,&version,sizeof(version)) != 0){
+        printf("TPACKET_V3 is not supported: %s\n",strerror(errno));
+        goto fail;
+    }
+
+    memset(&req,0,sizeof(req));
+    req.tp_block_size = AFPACKET_BLOCK_SIZE;
+    req.tp_block_nr = AFPACKET_BLOCK_NR;
+    req.tp_frame_size = AFPACKET_FRAME_SIZE;
+    req.tp_frame_nr = (AFPACKET_BLOCK_SIZE / AFPACKET_FRAME_SIZE) * AFPACKET_BLOCK_NR;
+    req.tp_retire_blk_tov = AFPACKET_BLOCK_TIMEOUT;
+    if(setsockopt(rx->fd,SOL_PACKET,PACKET_RX_RING,&req,sizeof(req)) != 0){
+        printf("Cannot create rx ring: %s\n",strerror(errno));
+        goto fail;
+    }
+    rx->ring_size = (size_t)AFPACKET_BLOCK_SIZE * AFPACKET_BLOCK_NR;
+    rx->ring = mmap(NULL,rx->ring_size,PROT_READ | PROT_WRITE,MAP_SHARED | MAP_LOCKED,rx->fd,0);
+    if(rx->ring == MAP_FAILED){
+        //locking the ring is only an optimisation
+        rx->ring = mmap(NULL,rx->ring_size,PROT_READ | PROT_WRITE,MAP_SHARED,rx->fd,0);
+    }
+    if(rx->ring == MAP_FAILED){
+        printf("Cannot map rx ring: %s\n",strerror(errno));
+        goto fail;
+    }
+
+    memset(&addr,0,sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(ETH_P_ALL);
+    addr.sll_ifindex = ifindex;
+    if(bind(rx->fd,(struct sockaddr *)&addr,sizeof(addr)) != 0){
+        printf("Cannot bind to %s: %s\n",iface,strerror(errno));
+        goto fail;
+    }
+
+    memset(&mreq,0,sizeof(mreq));
+    mreq.mr_ifindex = ifindex;
+    mreq.mr_type = PACKET_MR_PROMISC;
+    if(setsockopt(rx->fd,SOL_PACKET,PACKET_ADD_MEMBERSHIP,&mreq,sizeof(mreq)) != 0){
+        printf("Cannot set %s in promiscuous mode: %s\n",iface,strerror(errno));
+    }
+
+    if(fanout){
+        int fanout_arg = fanout_id | (PACKET_FANOUT_CBPF << 16);
+        struct sock_fprog prog = {
+            .len = sizeof(fanout_filter) / sizeof(fanout_filter[0]),
+            .filter = fanout_filter
+        };
+        if(setsockopt(rx->fd,SOL_PACKET,PACKET_FANOUT,&fanout_arg,sizeof(fanout_arg)) != 0 ||
+        setsockopt(rx->fd,SOL_PACKET,PACKET_FANOUT_DATA,&prog,sizeof(prog)) != 0){
+            printf("Cannot join fanout group %u: %s\n",fanout_id,strerror(errno));
+            goto fail;
+        }
+    }
+    return 0;
+
+fail:
+    afpacket_close(rx);
+    return -1;
+}
+
+uint16_t afpacket_rx_burst(struct afpacket_rx *rx, struct rte_mbuf *views, struct rte_mbuf **pkts, uint16_t n){
+    uint16_t count = 0;
+
+    //every packet of the current block was analysed, give it back to the kernel
+    if(rx->block != NULL && rx->pkts_left == 0){
+        __atomic_store_n(&rx->block->hdr.bh1.block_status,TP_STATUS_KERNEL,__ATOMIC_RELEASE);
+        rx->block = NULL;
+        rx->block_index = (rx->block_index + 1) % AFPACKET_BLOCK_NR;
+    }
+    if(rx->block == NULL){
+        struct tpacket_block_desc *block = (struct tpacket_block_desc *)(rx->ring + (size_t)rx->block_index * AFPACKET_BLOCK_SIZE);
+        if((__atomic_load_n(&block->hdr.bh1.block_status,__ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0){
+            struct pollfd pfd = {
+                .fd = rx->fd,
+                .events = POLLIN | POLLERR
+            };
+            poll(&pfd,1,AFPACKET_POLL_TIMEOUT);
+            if((__atomic_load_n(&block->hdr.bh1.block_status,__ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0){
+                return 0;
+            }
+        }
+        rx->block = block;
+        rx->pkts_left = block->hdr.bh1.num_pkts;
+        rx->next_pkt = (const uint8_t *)block + block->hdr.bh1.offset_to_first_pkt;
+    }
+    while(count < n && rx->pkts_left > 0){
+        const struct tpacket3_hdr *hdr = (const struct tpacket3_hdr *)rx->next_pkt;
+        pkt_view_init(&views[count],rx->next_pkt + hdr->tp_mac,hdr->tp_snaplen);
+        pkts[count] = &views[count];
+        count++;
+        rx->pkts_left--;
+        rx->next_pkt += hdr->tp_next_offset;
+    }
+    return count;
+}
+
+uint64_t afpacket_drops(struct afpacket_rx *rx){
+    struct tpacket_stats_v3 stats;
+    socklen_t len = sizeof(stats);
+    //the kernel resets its counters every time they are read
+    if(getsockopt(rx->fd,SOL_PACKET,PACKET_STATISTICS,&stats,&len) == 0){
+        rx->drops += stats.tp_drops;
+    }
+    return rx->drops;
+}
+
+void afpacket_close(struct afpacket_rx *rx){
+    if(rx->ring != MAP_FAILED && rx->ring != NULL){
+        munmap(rx->ring,rx->ring_size);
+    }
+    rx->ring = NULL;
+    if(rx->fd >= 0){
+        close(rx->fd);
+    }
+    rx->fd = -1;
+}
@@ -1,4 +1,26 @@
 #include "../include/ike.h"
+#include "../include/sa_index.h"
+#include "../include/tunnel_pool.h"
+#include "../include/replay.h"
+#include "../include/tunnel_journal.h"
+#include "../include/tunnel_snapshot.h"
+#include <unistd.h>
+
+__thread struct ip_addr src_ip;
+__thread struct ip_addr dst_ip;
+__thread char src_addr[128];
+__thread char dst_addr[128];
+__thread char current_time[24];
+__thread struct tunnel_pool *tunnels;
+__thread struct tunnel_pool *half_open;
+__thread struct ike_sa_index *ike_sas;
+__thread struct esp_sa_index *esp_sas;
+__thread struct timer_wheel *timers;
+__thread struct replay_table *replays;
+struct tunnel_journal *journal;
+__thread struct journal_queue *journal_queue;
+__thread uint64_t current_tick;
+__thread bool ike_quiet;
 
 
 int get_response_flag(struct rte_isakmp_hdr *isakmp_hdr){
@@ -78,72 +100,198 @@ int analyse_KE(struct rte_mbuf *pkt,uint16_t offset,struct rte_isakmp_hdr *isakm
     return check;
 }
 
+/// Gets the pool of a tunnel of the calling thread, half_open until it authenticates
+static inline struct tunnel_pool *
+tunnel_pool_of(const struct tunnel *tunnel){
+    return tunnel_pool_holds(tunnels,tunnel) ? tunnels : half_open;
+}
+
+/// Gets the replay window of a direction of a child SA of an authenticated tunnel of the calling thread
+static inline struct replay_window *
+child_sa_window(const struct tunnel *tunnel, uint8_t child, uint8_t dir){
+    return replay_window(replays,tunnel_pool_child(tunnels,tunnel,child),dir);
+}
+
+/**
+ * Indexes the ESP SAs of a tunnel once it is authenticated: both directions, and the child SAs of a
+ * tunnel loaded from file, whose sequence numbers went on while they were not watched
+ * @param tunnel tunnel authenticated
+ */
+static void
+index_esp_sas(struct tunnel *tunnel){
+    const struct tunnel_ike *ike = tunnel_ike(tunnel);
+    for(uint8_t dir = ESP_DIR_CLIENT; dir <= ESP_DIR_HOST; dir++){
+        esp_sa_index_add(esp_sas,tunnel,dir,0,0);
+        for(uint8_t child = 0; child < TUNNEL_CHILD_SAS; child++){
+            if(ike->children[child].state == CHILD_SA_ACTIVE && ike->children[child].spi[dir] != 0){
+                replay_window_clear(replays,child_sa_window(tunnel,child,dir));
+                esp_sa_index_add(esp_sas,tunnel,dir,ike->children[child].spi[dir],child);
+            }
+        }
+    }
+}
+
+/// Checks whether if both spis of a child SA are learnt, which is when it is saved to the tunnel journal
+static inline bool
+child_sa_saved(const struct child_sa *sa){
+    return sa->state == CHILD_SA_ACTIVE && sa->spi[ESP_DIR_CLIENT] != 0 && sa->spi[ESP_DIR_HOST] != 0;
+}
+
+/**
+ * Unindexes a child SA of a tunnel of the calling thread and frees its slot. The tunnel journal is left to the caller
+ * @param tunnel tunnel of the SA
+ * @param child child SA to retire
+ * @returns whether if the tunnel journal held the SA
+ */
+static bool
+retire_child_sa(struct tunnel *tunnel, uint8_t child){
+    struct tunnel_ike *ike = tunnel_ike(tunnel);
+    struct child_sa *sa = &ike->children[child];
+    const bool saved = ike->saved && child_sa_saved(sa);
+    for(uint8_t dir = ESP_DIR_CLIENT; dir <= ESP_DIR_HOST; dir++){
+        if(sa->spi[dir] != 0){
+            esp_sa_index_del(esp_sas,tunnel,dir,sa->spi[dir]);
+        }
+    }
+    memset(sa,0,sizeof(struct child_sa));
+    return saved;
+}
+
+/**
+ * Checks whether if a child SA carried no ESP packet since the timer of its tunnel last fired, in the
+ * directions whose spi is learnt
+ * @param tunnel authenticated tunnel of the calling thread
+ * @param child child SA
+ */
+static bool
+child_sa_idle(const struct tunnel *tunnel, uint8_t child){
+    const struct child_sa *sa = &tunnel_ike(tunnel)->children[child];
+    for(uint8_t dir = ESP_DIR_CLIENT; dir <= ESP_DIR_HOST; dir++){
+        if(sa->spi[dir] != 0 && (uint32_t)child_sa_window(tunnel,child,dir)->top != sa->swept[dir]){
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Unindexes a tunnel of the calling thread, cancels its timer and frees its slot
+ * @param tunnel tunnel to free
+ */
+static void
+free_tunnel(struct tunnel *tunnel){
+    ike_sa_index_del(ike_sas,tunnel);
+    if(tunnel->auth){
+        for(uint8_t dir = ESP_DIR_CLIENT; dir <= ESP_DIR_HOST; dir++){
+            esp_sa_index_del(esp_sas,tunnel,dir,0);
+        }
+        //a single delete in the journal rather than an update per child SA retired
+        remove_tunnel(tunnel);
+        for(uint8_t child = 0; child < TUNNEL_CHILD_SAS; child++){
+            if(tunnel_ike(tunnel)->children[child].state != CHILD_SA_FREE){
+                retire_child_sa(tunnel,child);
+            }
+        }
+    }
+    timer_wheel_cancel(timers,&tunnel_ike(tunnel)->timer);
+    tunnel_pool_free(tunnel_pool_of(tunnel),tunnel);
+}
+
+/**
+ * Moves an IKE SA that authenticated from half_open to tunnels, where its ESP SAs get indexed and its
+ * idle timer starts. IKE_AUTH sets up the first child SA
+ * @param tunnel half-open tunnel, freed
+ * @returns the authenticated tunnel, NULL if tunnels is full of tunnels worth keeping
+ */
+static struct tunnel *
+promote_tunnel(struct tunnel *tunnel){
+    struct tunnel established = *tunnel;
+    struct tunnel_ike ike = *tunnel_ike(tunnel);
+    struct tunnel *added;
+    free_tunnel(tunnel);
+    established.auth = true;
+    added = insert_tunnel(&established,&ike);
+    if(added != NULL){
+        child_sa_negotiated(added,0);
+    }
+    return added;
+}
+
+/**
+ * Works out what an encrypted IKE message does to its tunnel from the exchange type, flags and first
+ * payload of the message, which is all that can be seen without decrypting it
+ * @param isakmp_hdr isakmp header of the message
+ * @param tunnel tunnel of the message
+ * @param first_payload next payload of the Encrypted payload, or of fragment 1 of a fragmented message
+ */
+static void
+analyse_encrypted(struct rte_isakmp_hdr *isakmp_hdr,struct tunnel *tunnel,int8_t first_payload){
+    char log[2048] = {0};
+    if(first_payload == NO && isakmp_hdr->exchange_type == INFORMATIONAL){
+        //Dead peer detection
+        //responder will send the request and initiator has to respond within 6 requests
+        if(get_initiator_flag(isakmp_hdr) == 0 && get_response_flag(isakmp_hdr) == 0){
+            // DPD start/continue
+            struct tunnel_ike *ike = tunnel_ike(tunnel);
+            ike->dpd_count += 1;
+            if(ike->dpd_count == 6){
+                //give client 10secs to reply last request
+                tunnel_timer_arm(tunnel,TUNNEL_TIMER_DPD,TUNNEL_DPD_GRACE);
+            }
+        }
+        else if(get_initiator_flag(isakmp_hdr) == 1 && get_response_flag(isakmp_hdr) == 1){
+            //Peer has responded and is not dead , hence refresh dpd is reset
+            tunnel_ike(tunnel)->dpd_count = 0;
+        }
+        else if(get_initiator_flag(isakmp_hdr) == 0 && get_response_flag(isakmp_hdr) == 1){
+            if(tunnel_ike(tunnel)->deleting){
+                snprintf(log,2048,"%s;Session ended btw %s and %s\n",current_time,
+                src_addr,dst_addr);
+                write_log(ipsec_log,log,LOG_INFO);
+                delete_tunnel(isakmp_hdr->initiator_spi,isakmp_hdr->responder_spi,src_ip,dst_ip);
+            }
+        }
+    }
+    else if(first_payload == D && isakmp_hdr->exchange_type == INFORMATIONAL){
+        //Either side ends connection, so delete tunnel. Only the answer to the deletion of child SAs has
+        //Delete payloads, the IKE SA goes on
+        tunnel_ike(tunnel)->deleting = get_response_flag(isakmp_hdr) == 0;
+    }
+    else if(first_payload == SA && isakmp_hdr->exchange_type == CREATE_CHILD_SA){
+        //the responder accepted a new or rekeyed child SA, or a rekey of the IKE SA which looks the same
+        if(get_response_flag(isakmp_hdr) == 1 && tunnel->auth){
+            child_sa_negotiated(tunnel,CHILD_SA_NEGOTIATE_TIMEOUT);
+        }
+    }
+    else if(first_payload == AUTH && isakmp_hdr->exchange_type == IKE_AUTH){
+        //99.9% means authenticated once responder sends this payload unless server kena gon
+        if(get_response_flag(isakmp_hdr) == 1){
+            snprintf(log,2048,"%s;IKE Authentication between %s and %s succeeded\n",current_time,
+            src_addr,dst_addr);
+            write_log(ipsec_log,log,LOG_INFO);
+            if(!tunnel->auth && promote_tunnel(tunnel) == NULL){
+                snprintf(log,2048,"%s;TUNNEL_TABLE_FULL;%s;%s;%lx;%lx\n",current_time
+                ,src_addr, dst_addr, isakmp_hdr->initiator_spi,isakmp_hdr->responder_spi);
+                write_log(ipsec_log,log,LOG_WARNING);
+            }
+        }
+    }
+    else if(first_payload == N && isakmp_hdr->exchange_type == INFORMATIONAL && get_initiator_flag(isakmp_hdr) == 0 && get_response_flag(isakmp_hdr) == 1){
+        // for now it prob means smth went wrong
+        snprintf(log,2048,"%s;IKE Authentication between %s and %s failed\n",current_time,
+        src_addr, dst_addr);
+        write_log(ipsec_log,log,LOG_NOTICE);
+        delete_tunnel(isakmp_hdr->initiator_spi,isakmp_hdr->responder_spi,src_ip,dst_ip);
+    }
+}
+
 int analyse_SK(struct rte_mbuf *pkt, uint16_t offset, struct rte_isakmp_hdr *isakmp_hdr){
     if(offset + sizeof(struct isakmp_payload_hdr) <= rte_pktmbuf_data_len(pkt)){
         struct isakmp_payload_hdr *payload_hdr;
         payload_hdr = rte_pktmbuf_mtod_offset(pkt,struct isakmp_payload_hdr *,offset);
-        for(int i = 1;i <= tunnels->size; i++){
-            struct tunnel *tunnel = tunnels->array[i];
-            char log[2048] = {0};
-            if(check_ike_spi(isakmp_hdr->initiator_spi,isakmp_hdr->responder_spi,src_addr_int,dst_addr_int,tunnel) == 1){
-                //nid to ensure spi is the same
-                if(payload_hdr->nxt_payload == NO && isakmp_hdr->exchange_type == INFORMATIONAL){
-                    //Dead peer detection
-                    //responder will send the request and initiator has to respond within 6 requests
-                    if(get_initiator_flag(isakmp_hdr) == 0 && get_response_flag(isakmp_hdr) == 0){
-                        // DPD start/continue
-                        tunnel->dpd_count += 1;
-                        if(tunnel->dpd_count == 6){
-                           tunnel->timeout = 50; //give client 10secs to reply last request
-                        }
-                    }
-                    else if(get_initiator_flag(isakmp_hdr) == 1 && get_response_flag(isakmp_hdr) == 1){
-                        //Peer has responded and is not dead , hence refresh dpd is reset
-                        tunnel->dpd_count = 0;
-                    }
-                    else if(get_initiator_flag(isakmp_hdr) == 0 && get_response_flag(isakmp_hdr) == 1){
-                        for(int i = 1;i<=tunnels->size;i++){
-                            struct tunnel *tunnel = (struct tunnel *)tunnels->array[i];
-                            if(check_ike_spi(isakmp_hdr->initiator_spi,isakmp_hdr->responder_spi,src_addr_int,dst_addr_int,tunnel) == 1){
-                                if(tunnel->deleting){
-                                    char log[2048] = {0};
-                                    snprintf(log,2048,"%s;Session ended btw %s and %s\n",current_time,
-                                    src_addr,dst_addr);
-                                    write_log(ipsec_log,log,LOG_INFO);
-                                    delete_tunnel(isakmp_hdr->initiator_spi,isakmp_hdr->responder_spi,src_addr_int,dst_addr_int);
-                                }
-                            }
-                        }
-                    }
-                }
-                else if(payload_hdr->nxt_payload == D && isakmp_hdr->exchange_type == INFORMATIONAL){
-                    //Either side ends connection, so delete tunnel
-                   for(int i = 1;i<=tunnels->size;i++){
-                        struct tunnel *tunnel = (struct tunnel *)tunnels->array[i];
-                        if(check_ike_spi(isakmp_hdr->initiator_spi,isakmp_hdr->responder_spi,src_addr_int,dst_addr_int,tunnel) == 1){
-                            tunnel->deleting = true;
-                        }
-                    }
-                }
-                else if(payload_hdr->nxt_payload == AUTH && isakmp_hdr->exchange_type == IKE_AUTH){
-                    //99.9% means authenticated once responder sends this payload unless server kena gon
-                    if(get_response_flag(isakmp_hdr) == 1){
-                        snprintf(log,2048,"%s;IKE Authentication between %s and %s succeeded\n",current_time,
-                        src_addr,dst_addr);
-                        write_log(ipsec_log,log,LOG_INFO);
-                        tunnel->auth = true;
-                    }
-                }
-                else if(payload_hdr->nxt_payload == N && isakmp_hdr->exchange_type == INFORMATIONAL && get_initiator_flag(isakmp_hdr) == 0 && get_response_flag(isakmp_hdr) == 1){
-                    // for now it prob means smth went wrong
-                    snprintf(log,2048,"%s;IKE Authentication between %s and %s failed\n",current_time,
-                    src_addr, dst_addr);
-                    write_log(ipsec_log,log,LOG_NOTICE);
-                    delete_tunnel(isakmp_hdr->initiator_spi,isakmp_hdr->responder_spi,src_addr_int,dst_addr_int);
-                }
-                
-            }
-                
+        struct tunnel *tunnel = ike_sa_index_lookup(ike_sas,isakmp_hdr->initiator_spi,isakmp_hdr->responder_spi,src_ip,dst_ip);
+        if(tunnel != NULL){
+            analyse_encrypted(isakmp_hdr,tunnel,payload_hdr->nxt_payload);
         }
         return 1;
     }
@@ -153,6 +301,48 @@ int analyse_SK(struct rte_mbuf *pkt, uint16_t offset, struct rte_isakmp_hdr *isa
     
 }
 
+int analyse_SKF(struct rte_mbuf *pkt, uint16_t offset, struct rte_isakmp_hdr *isakmp_hdr){
+    struct skf_payload *payload;
+    struct tunnel *tunnel;
+    struct skf_state *state;
+    uint16_t number, total;
+    if(offset + sizeof(struct skf_payload) > rte_pktmbuf_data_len(pkt)){
+        return 0;
+    }
+    payload = rte_pktmbuf_mtod_offset(pkt,struct skf_payload *,offset);
+    number = rte_be_to_cpu_16(payload->fragment_number);
+    total = rte_be_to_cpu_16(payload->total_fragments);
+    if(number == 0 || number > total || total > SKF_MAX_FRAGMENTS){
+        return 0;
+    }
+    tunnel = ike_sa_index_lookup(ike_sas,isakmp_hdr->initiator_spi,isakmp_hdr->responder_spi,src_ip,dst_ip);
+    if(tunnel == NULL){
+        return 1;
+    }
+    state = &tunnel_ike(tunnel)->skf[get_response_flag(isakmp_hdr)];
+    if(state->total == 0 || state->message_id != isakmp_hdr->message_id || total > state->total){
+        //a new message, or the same one split into more fragments after a retransmission
+        state->message_id = isakmp_hdr->message_id;
+        state->total = total;
+        state->first_payload = NO;
+        state->complete = false;
+        state->received = 0;
+    }
+    else if(total < state->total || state->complete){
+        //fragments of an older split or of a message already analysed
+        return 1;
+    }
+    if(number == 1){
+        state->first_payload = payload->hdr.nxt_payload;
+    }
+    state->received |= 1ULL << (number - 1);
+    if(state->received == (total == 64 ? UINT64_MAX : (1ULL << total) - 1)){
+        state->complete = true;
+        analyse_encrypted(isakmp_hdr,tunnel,state->first_payload);
+    }
+    return 1;
+}
+
 
 int analyse_N(struct rte_mbuf *pkt, uint16_t offset,struct rte_isakmp_hdr *isakmp_hdr){
     int check = 1;
@@ -186,7 +376,7 @@ int analyse_N(struct rte_mbuf *pkt, uint16_t offset,struct rte_isakmp_hdr *isakm
                     special_error = true;
                 }
                 if(error){
-                    delete_tunnel(isakmp_hdr->initiator_spi,isakmp_hdr->responder_spi,src_addr_int,dst_addr_int);
+                    delete_tunnel(isakmp_hdr->initiator_spi,isakmp_hdr->responder_spi,src_ip,dst_ip);
                     
                     snprintf(log,2048,"%s;%s",current_time,
                     failed_msg);
@@ -337,6 +527,7 @@ void get_transformations(struct rte_mbuf *pkt, int offset,int size,char *buf,int
             }
             else{
                 *check = 0;
+                break;
             }
             
         }while(transform->hdr->nxt_payload != 0);
@@ -364,14 +555,10 @@ int analyse_SA(struct rte_mbuf *pkt,uint16_t offset,struct rte_isakmp_hdr *isakm
                 }
                 else{
                     snprintf(log,4096,"%s;Proposals proposed by %s: %s\n",current_time,src_addr,proposal);
-                    for(int i = 1;i <= tunnels->size; i++){
-                        struct tunnel *tunnel = tunnels->array[i];
-                        if(check_ike_spi(isakmp_hdr->initiator_spi,isakmp_hdr->responder_spi,src_addr_int,dst_addr_int,tunnel) == 1){
-                            break;
-                        }
-                    }
                 }
-                write_log(ipsec_log,log,LOG_INFO);
+                if(!ike_quiet){
+                    write_log(ipsec_log,log,LOG_INFO);
+                }
                 proposal = NULL;
                 free(proposal);
             }
@@ -390,32 +577,248 @@ int analyse_SA(struct rte_mbuf *pkt,uint16_t offset,struct rte_isakmp_hdr *isakm
     
 }
 
-void delete_tunnel(uint64_t initiator_spi,uint64_t responder_spi,int src_addr,int dst_addr){
-    for(int i = 1;i <= tunnels->size; i++){
-        struct tunnel *tunnel = tunnels->array[i];
-        if(check_ike_spi(initiator_spi,responder_spi,src_addr,dst_addr,tunnel) == 1){
-            remove_tunnel(tunnel);
-            removeIndex(tunnels,i);
+void delete_tunnel(uint64_t initiator_spi,uint64_t responder_spi,struct ip_addr src_addr,struct ip_addr dst_addr){
+    struct tunnel *tunnel = ike_sa_index_lookup(ike_sas,initiator_spi,responder_spi,src_addr,dst_addr);
+    if(tunnel != NULL){
+        free_tunnel(tunnel);
+    }
+}
+
+/**
+ * Ranks how little a tunnel is worth keeping when a new one needs its slot. Half-open tunnels go first,
+ * then those whose peer does not answer dead peer detection, then authenticated ones quiet for EVICT_IDLE
+ * seconds. Tunnels with recent ESP traffic are never evicted
+ * @param tunnel live tunnel of the calling thread
+ * @returns the rank, the lowest is evicted first, -1 if the tunnel is kept
+ */
+static inline int
+eviction_rank(const struct tunnel *tunnel){
+    if(!tunnel->auth){
+        return 0;
+    }
+    if(tunnel->timer_class == TUNNEL_TIMER_DPD){
+        return 1;
+    }
+    //activity pushes the deadline back to the idle timeout, so an early deadline means a quiet tunnel
+    if(tunnel->deadline <= current_tick + (uint64_t)(TUNNEL_IDLE_TIMEOUT - EVICT_IDLE) * TIMER_HZ){
+        return 2;
+    }
+    return -1;
+}
+
+/**
+ * Ends a tunnel of a full pool of the calling thread to make room for a new one. Tunnels are looked at in
+ * walking order from where the last eviction stopped, until EVICT_SAMPLE could be evicted or EVICT_SCAN
+ * were looked at, so that a new tunnel costs the same however many tunnels an attack left in the pool.
+ * The lowest ranked is evicted, the one closest to timing out among equals
+ * @param pool tunnels or half_open
+ * @returns whether if a tunnel was evicted
+ */
+static bool
+evict_tunnel(struct tunnel_pool *pool){
+    const uint32_t count = pool->count;
+    struct tunnel *victim = NULL;
+    int victim_rank = -1;
+    unsigned candidates = 0;
+    for(uint32_t i = 0; i < EVICT_SCAN && i < count && candidates < EVICT_SAMPLE; i++){
+        struct tunnel *tunnel;
+        int rank;
+        if(pool->evict_cursor >= count){
+            pool->evict_cursor = 0;
+        }
+        tunnel = tunnel_pool_at(pool,pool->evict_cursor++);
+        rank = eviction_rank(tunnel);
+        if(rank < 0){
+            continue;
+        }
+        candidates++;
+        if(victim == NULL || rank < victim_rank || (rank == victim_rank && tunnel->deadline < victim->deadline)){
+            victim = tunnel;
+            victim_rank = rank;
+        }
+    }
+    if(victim == NULL){
+        return false;
+    }
+    //half-open tunnels are what floods fill the pool with, only the end of a session is worth a line
+    if(victim->auth){
+        char client_ip[INET6_ADDRSTRLEN];
+        char host_ip[INET6_ADDRSTRLEN];
+        char log[2048];
+        get_ip_addr_string(&victim->client_ip,client_ip);
+        get_ip_addr_string(&victim->host_ip,host_ip);
+        snprintf(log,2048,"%s;Session between %s and %s evicted to make room for a new tunnel\n",current_time
+        ,client_ip, host_ip);
+        write_log(ipsec_log,log,LOG_NOTICE);
+    }
+    free_tunnel(victim);
+    pool->evicted++;
+    return true;
+}
+
+struct tunnel *insert_tunnel(const struct tunnel *tunnel, const struct tunnel_ike *ike){
+    //IKE SAs are kept apart until they authenticate, so that a flood of them only evicts its own
+    struct tunnel_pool *pool = tunnel->auth ? tunnels : half_open;
+    struct tunnel *added = tunnel_pool_alloc(pool,tunnel,ike);
+    if(added == NULL && evict_tunnel(pool)){
+        added = tunnel_pool_alloc(pool,tunnel,ike);
+    }
+    if(added == NULL){
+        pool->refused++;
+        return NULL;
+    }
+    if(ike_sa_index_add(ike_sas,added) != 0){
+        tunnel_pool_free(pool,added);
+        return NULL;
+    }
+    if(added->auth){
+        index_esp_sas(added);
+    }
+    memset(&tunnel_ike(added)->timer,0,sizeof(struct timer_node));
+    if(added->auth){
+        tunnel_timer_arm(added,TUNNEL_TIMER_IDLE,TUNNEL_IDLE_TIMEOUT);
+    }
+    else{
+        tunnel_timer_arm(added,TUNNEL_TIMER_HALF_OPEN,TUNNEL_HALF_OPEN_TIMEOUT);
+    }
+    return added;
+}
+
+void child_sa_negotiated(struct tunnel *tunnel, uint32_t seconds){
+    struct tunnel_ike *ike = tunnel_ike(tunnel);
+    struct child_sa *sa;
+    int slot = -1;
+    bool slot_idle = false;
+    for(uint8_t child = 0; child < TUNNEL_CHILD_SAS; child++){
+        const struct child_sa *candidate = &ike->children[child];
+        bool idle;
+        if(candidate->state == CHILD_SA_FREE ||
+        (candidate->state == CHILD_SA_NEGOTIATED && candidate->learn_until < current_tick)){
+            slot = child;
             break;
         }
+        //an SA replaced by a rekey goes quiet, otherwise the oldest is the likeliest to have been replaced
+        idle = candidate->state == CHILD_SA_ACTIVE && child_sa_idle(tunnel,child);
+        if(slot < 0 || (idle && !slot_idle) ||
+        (idle == slot_idle && (int16_t)(candidate->serial - ike->children[slot].serial) < 0)){
+            slot = child;
+            slot_idle = idle;
+        }
+    }
+    if(ike->children[slot].state != CHILD_SA_FREE && retire_child_sa(tunnel,slot)){
+        add_tunnel(tunnel);
+    }
+    sa = &ike->children[slot];
+    sa->state = CHILD_SA_NEGOTIATED;
+    sa->learn_until = seconds == 0 ? UINT64_MAX : current_tick + (uint64_t)seconds * TIMER_HZ;
+    sa->serial = ike->next_serial++;
+}
+
+bool child_sa_awaits(const struct tunnel *tunnel, uint8_t dir){
+    const struct tunnel_ike *ike = tunnel_ike(tunnel);
+    for(uint8_t child = 0; child < TUNNEL_CHILD_SAS; child++){
+        const struct child_sa *sa = &ike->children[child];
+        if(sa->state != CHILD_SA_FREE && sa->spi[dir] == 0 && sa->learn_until >= current_tick){
+            return true;
+        }
     }
+    return false;
 }
 
-int check_ike_spi(uint64_t initiator_spi,uint64_t responder_spi,int src_addr,int dst_addr,struct tunnel* tunnel){
-    return (tunnel->initiator_spi == initiator_spi 
-                && tunnel->responder_spi == responder_spi) && ((tunnel->client_ip == src_addr && tunnel->host_ip == dst_addr) || 
-                (tunnel->host_ip == src_addr && tunnel->client_ip == dst_addr)) ? 1 : 0;
+int child_sa_learn(struct tunnel *tunnel, uint8_t dir, rte_be32_t spi, uint32_t seq){
+    struct tunnel_ike *ike = tunnel_ike(tunnel);
+    struct child_sa *sa;
+    int child = -1;
+    //spi 0 is reserved and would be taken for the entry of the direction in the index
+    if(spi == 0){
+        return -1;
+    }
+    for(uint8_t i = 0; i < TUNNEL_CHILD_SAS; i++){
+        const struct child_sa *candidate = &ike->children[i];
+        if(candidate->state == CHILD_SA_FREE || candidate->spi[dir] != 0 || candidate->learn_until < current_tick){
+            continue;
+        }
+        //an SA whose other direction is learnt is completed first, then the oldest negotiated
+        if(child < 0 || candidate->state > ike->children[child].state ||
+        (candidate->state == ike->children[child].state && (int16_t)(candidate->serial - ike->children[child].serial) < 0)){
+            child = i;
+        }
+    }
+    if(child < 0){
+        return -1;
+    }
+    sa = &ike->children[child];
+    sa->spi[dir] = spi;
+    sa->swept[dir] = seq;
+    sa->state = CHILD_SA_ACTIVE;
+    replay_window_reset(replays,child_sa_window(tunnel,child,dir),seq);
+    esp_sa_index_add(esp_sas,tunnel,dir,spi,child);
+    if(sa->spi[!dir] != 0){
+        add_tunnel(tunnel);
+    }
+    return child;
 }
 
-int check_if_tunnel_exists(struct rte_isakmp_hdr *isakmp_hdr,struct rte_ipv4_hdr *ipv4_hdr){
-    for(int i = 1;i<=tunnels->size;i++){
-        struct tunnel *tunnel = (struct tunnel *)tunnels->array[i];
-        if(check_ike_spi(isakmp_hdr->initiator_spi,isakmp_hdr->responder_spi,src_addr_int,dst_addr_int,tunnel) == 1){
-            tunnel->timeout = 0;
-            return 1;
+void child_sa_sweep(struct tunnel *tunnel){
+    struct tunnel_ike *ike = tunnel_ike(tunnel);
+    bool idle[TUNNEL_CHILD_SAS] = {false};
+    bool active = false;
+    bool saved = false;
+    for(uint8_t child = 0; child < TUNNEL_CHILD_SAS; child++){
+        struct child_sa *sa = &ike->children[child];
+        if(sa->state != CHILD_SA_ACTIVE){
+            continue;
+        }
+        idle[child] = child_sa_idle(tunnel,child);
+        active |= !idle[child];
+        for(uint8_t dir = ESP_DIR_CLIENT; dir <= ESP_DIR_HOST; dir++){
+            if(sa->spi[dir] != 0){
+                sa->swept[dir] = child_sa_window(tunnel,child,dir)->top;
+            }
+        }
+    }
+    //a quiet tunnel keeps its SAs until it times out
+    if(!active){
+        return;
+    }
+    for(uint8_t child = 0; child < TUNNEL_CHILD_SAS; child++){
+        if(idle[child]){
+            saved |= retire_child_sa(tunnel,child);
         }
     }
-    return 0;
+    //a single update for every SA retired
+    if(saved){
+        add_tunnel(tunnel);
+    }
+}
+
+void tunnel_timer_arm(struct tunnel *tunnel, uint8_t timer_class, uint32_t seconds){
+    tunnel->timer_class = timer_class;
+    tunnel->deadline = current_tick + (uint64_t)seconds * TIMER_HZ;
+    timer_wheel_arm(timers,&tunnel_ike(tunnel)->timer,tunnel->deadline);
+}
+
+struct tunnel_ike *tunnel_ike(const struct tunnel *tunnel){
+    return tunnel_pool_ike(tunnel_pool_of(tunnel),tunnel);
+}
+
+struct tunnel *tunnel_from_ike(const struct tunnel_ike *ike){
+    return tunnel_pool_from_ike(tunnel_pool_holds_ike(tunnels,ike) ? tunnels : half_open,ike);
+}
+
+int check_ike_spi(uint64_t initiator_spi,uint64_t responder_spi,struct ip_addr src_addr,struct ip_addr dst_addr,struct tunnel* tunnel){
+    const struct tunnel_ike *ike = tunnel_ike(tunnel);
+    return (ike->initiator_spi == initiator_spi 
+                && ike->responder_spi == responder_spi) && tunnel_links(tunnel,&src_addr,&dst_addr) ? 1 : 0;
+}
+
+int check_if_tunnel_exists(struct rte_isakmp_hdr *isakmp_hdr){
+    struct tunnel *tunnel = ike_sa_index_lookup(ike_sas,isakmp_hdr->initiator_spi,isakmp_hdr->responder_spi,src_ip,dst_ip);
+    if(tunnel == NULL){
+        return 0;
+    }
+    tunnel_touch(tunnel);
+    return 1;
 }
 
 void get_ip_address_string(rte_be32_t addr,char *ip){
@@ -426,85 +829,454 @@ void get_ip_address_string(rte_be32_t addr,char *ip){
     sprintf(ip,"%u.%u.%u.%u",bit1,bit2,bit3,bit4);
 }   
 
+void get_ip_addr_string(const struct ip_addr *addr,char *ip){
+    if(ip_addr_is_ipv4(addr)){
+        get_ip_address_string(addr->words[3],ip);
+    }
+    else{
+        //appends to the string
+        ip[0] = 0;
+        get_ipv6_address_string((uint8_t *)addr->bytes,ip);
+    }
+}
+
+/**
+ * Packs the saved part of a tunnel into a record of the tunnel journal: the child SAs with both spis learnt,
+ * oldest first
+ * @param tunnel tunnel to save
+ * @param ike IKE part of the tunnel
+ * @param record record to fill
+ * @returns the number of child SAs saved
+ */
+static uint8_t
+tunnel_to_record(const struct tunnel *tunnel, const struct tunnel_ike *ike, struct journal_tunnel *record){
+    uint8_t saved = 0;
+    memset(record,0,sizeof(struct journal_tunnel));
+    record->initiator_spi = ike->initiator_spi;
+    record->responder_spi = ike->responder_spi;
+    record->client_ip = tunnel->client_ip;
+    record->host_ip = tunnel->host_ip;
+    for(uint8_t child = 0; child < TUNNEL_CHILD_SAS; child++){
+        const struct child_sa *sa = &ike->children[child];
+        uint8_t rank = 0;
+        if(!child_sa_saved(sa)){
+            continue;
+        }
+        for(uint8_t other = 0; other < TUNNEL_CHILD_SAS; other++){
+            rank += child_sa_saved(&ike->children[other]) && (int16_t)(ike->children[other].serial - sa->serial) < 0;
+        }
+        record->spi[rank][ESP_DIR_CLIENT] = sa->spi[ESP_DIR_CLIENT];
+        record->spi[rank][ESP_DIR_HOST] = sa->spi[ESP_DIR_HOST];
+        saved++;
+    }
+    return saved;
+}
+
+/**
+ * Unpacks a record of the tunnel journal, its child SAs taking the first slots of the tunnel in the order saved
+ * @param tunnel tunnel to fill
+ * @param ike IKE part to fill
+ * @param record record of the tunnel
+ */
+static void
+tunnel_from_record(struct tunnel *tunnel, struct tunnel_ike *ike, const struct journal_tunnel *record){
+    uint8_t nb_children = 0;
+    ike->initiator_spi = record->initiator_spi;
+    ike->responder_spi = record->responder_spi;
+    tunnel->client_ip = record->client_ip;
+    tunnel->host_ip = record->host_ip;
+    for(uint8_t i = 0; i < TUNNEL_CHILD_SAS; i++){
+        struct child_sa *sa = &ike->children[nb_children];
+        if(record->spi[i][ESP_DIR_CLIENT] == 0 || record->spi[i][ESP_DIR_HOST] == 0){
+            continue;
+        }
+        sa->spi[ESP_DIR_CLIENT] = record->spi[i][ESP_DIR_CLIENT];
+        sa->spi[ESP_DIR_HOST] = record->spi[i][ESP_DIR_HOST];
+        sa->state = CHILD_SA_ACTIVE;
+        sa->serial = nb_children++;
+    }
+    ike->next_serial = nb_children;
+    ike->saved = true;
+}
+
+/**
+ * Makes the ESP spis of a record of the tunnel file the first child SA of a tunnel
+ * @param ike IKE part of the tunnel, with the spis in the first child SA
+ */
+static void
+child_sa_from_line(struct tunnel_ike *ike){
+    ike->children[0].state = CHILD_SA_ACTIVE;
+    ike->next_serial = 1;
+}
+
+/**
+ * Unpacks a record of the tunnel file
+ * @param tunnel tunnel to fill
+ * @param ike IKE part to fill
+ * @param record decoded record, serialize_size bytes
+ */
+static void
+tunnel_from_line(struct tunnel *tunnel, struct tunnel_ike *ike, const char *record){
+    memcpy(&ike->initiator_spi,record,sizeof(uint64_t));
+    memcpy(&ike->responder_spi,record + 8,sizeof(uint64_t));
+    memcpy(&tunnel->client_ip,record + 16,sizeof(struct ip_addr));
+    memcpy(&tunnel->host_ip,record + 32,sizeof(struct ip_addr));
+    memcpy(&ike->children[0].spi[ESP_DIR_CLIENT],record + 48,sizeof(uint32_t));
+    memcpy(&ike->children[0].spi[ESP_DIR_HOST],record + 52,sizeof(uint32_t));
+    child_sa_from_line(ike);
+}
+
+/**
+ * Converts a record of the tunnel file saved before IPv6 support, which had 4 byte IPv4 addresses
+ * @param tunnel tunnel to fill
+ * @param ike IKE part to fill
+ * @param record decoded record, legacy_serialize_size bytes
+ */
+static void
+tunnel_from_legacy(struct tunnel *tunnel, struct tunnel_ike *ike, const char *record){
+    rte_be32_t client_ip, host_ip;
+    memcpy(&ike->initiator_spi,record,sizeof(uint64_t));
+    memcpy(&ike->responder_spi,record + 8,sizeof(uint64_t));
+    memcpy(&client_ip,record + 16,sizeof(client_ip));
+    memcpy(&host_ip,record + 20,sizeof(host_ip));
+    memcpy(&ike->children[0].spi[ESP_DIR_CLIENT],record + 24,sizeof(uint32_t));
+    memcpy(&ike->children[0].spi[ESP_DIR_HOST],record + 28,sizeof(uint32_t));
+    tunnel->client_ip = ip_addr_from_ipv4(client_ip);
+    tunnel->host_ip = ip_addr_from_ipv4(host_ip);
+    child_sa_from_line(ike);
+}
+
 void add_tunnel(struct tunnel* add){
-    char* bytes = malloc(serialize_size);
-    if(bytes){
-        memcpy(bytes,add,serialize_size);
-        char* tunnel = b64_encode(bytes,serialize_size);
-        FILE* fp = fopen(tunnel_log, "a+");
-        fprintf(fp,"%s\n",tunnel);
-        fclose(fp);
+    struct tunnel_ike *ike = tunnel_ike(add);
+    struct journal_tunnel record;
+    if(tunnel_to_record(add,ike,&record) == 0){
+        remove_tunnel(add);
+        return;
+    }
+    if(journal_queue != NULL && tunnel_journal_append(journal_queue,ike->saved ? JOURNAL_UPDATE : JOURNAL_ADD,&record) == 0){
+        ike->saved = true;
     }
-    free(bytes);
 }
 
 void remove_tunnel(struct tunnel* remove){
-    char* bytes = malloc(serialize_size);
-    char* line;
-    long file_size;
+    struct tunnel_ike *ike = tunnel_ike(remove);
+    struct journal_tunnel record;
+    if(!ike->saved){
+        return;
+    }
+    tunnel_to_record(remove,ike,&record);
+    tunnel_journal_append(journal_queue,JOURNAL_DELETE,&record);
+    ike->saved = false;
+}
+
+/**
+ * Adds a tunnel of the tunnel journal to the worker that owns it
+ * @param record record of the tunnel
+ * @param arg select_worker passed to load_tunnel
+ */
+static void
+restore_tunnel(const struct journal_tunnel *record, void *arg){
+    void (**select_worker)(struct tunnel *tunnel) = arg;
+    struct tunnel tunnel = {0};
+    struct tunnel_ike ike = {0};
+    tunnel_from_record(&tunnel,&ike,record);
+    tunnel.auth = true;
+    (*select_worker)(&tunnel);
+    //the journal only holds the tunnels the workers do
+    if(insert_tunnel(&tunnel,&ike) == NULL){
+        tunnel_journal_append(journal_queue,JOURNAL_DELETE,record);
+    }
+}
+
+/**
+ * Moves the tunnels of the tunnel file the journal replaced to the journal, then removes the file
+ * @param select_worker points tunnels and ike_sas at those of the worker that owns a loaded tunnel
+ */
+static void
+load_tunnel_file(void (*select_worker)(struct tunnel *tunnel)){
+    FILE* fp = fopen(tunnel_log, "r");
+    char* line = NULL;
+    char* decoded;
     size_t len = 0;
-    size_t size = 0;
-    size_t read = 0;
-    int offset = 0;
-    if(bytes){
-        memcpy(bytes,remove,serialize_size);
-        char* tunnel = b64_encode(bytes,serialize_size);
-        FILE* fp = fopen(tunnel_log, "r+");
-        fseek(fp,0, SEEK_END);
-        file_size = ftell(fp);
-        fseek(fp, 0L, SEEK_SET);
-        char* og_file = calloc(file_size,sizeof(char));
-        if(og_file){
-            fread(og_file,sizeof(char),file_size,fp);
-            fseek(fp, 0L, SEEK_SET);
-            while(read = getline(&line,&len,fp) != -1){
-                int line_len = strlen(line);
-                line[line_len-1] = NULL;
-                if(strcmp(line,tunnel) == 0){
-                    
-                    long move_size = file_size - offset - line_len;
-                    memmove(og_file + offset,og_file + offset + line_len,move_size);
-                    int newSize = file_size - line_len;
-                    fclose(fp);
-                    FILE *writefp = fopen(tunnel_log, "w+");
-                    fwrite(og_file,sizeof(char),newSize,writefp);
-                    fclose(writefp);
-                    break;
-                }
-                offset += read;
+    size_t decoded_len;
+    if(fp == NULL){
+        return;
+    }
+    while(getline(&line,&len,fp) != -1){
+        line[strcspn(line,"\n")] = 0;
+        decoded = b64_decode_ex(line,strlen(line),&decoded_len);
+        if(decoded && (decoded_len == serialize_size || decoded_len == legacy_serialize_size)){
+            struct tunnel tunnel = {0};
+            struct tunnel_ike ike = {0};
+            struct tunnel *added;
+            if(decoded_len == legacy_serialize_size){
+                tunnel_from_legacy(&tunnel,&ike,decoded);
+            }
+            else{
+                tunnel_from_line(&tunnel,&ike,decoded);
+            }
+            tunnel.auth = true;
+            select_worker(&tunnel);
+            added = insert_tunnel(&tunnel,&ike);
+            if(added != NULL){
+                add_tunnel(added);
             }
         }
-        free(og_file);
+        free(decoded);
     }
-    free(bytes);
+    fclose(fp);
+    free(line);
+    unlink(tunnel_log);
 }
 
-void load_tunnel(){
-    FILE* fp = fopen(tunnel_log, "r+");
-    char* line;
-    char* decoded;
-    size_t len = 0;
-    size_t read = 0;
-    if(fp != NULL){
-        while(read = getline(&line,&len,fp) != -1){
-            int line_len = strlen(line);
-            line[line_len-1] = NULL;
-            decoded = b64_decode(line,strlen(line));
-            if(decoded){
-                struct tunnel *tunnel = calloc(1,sizeof(struct tunnel));
-                if(tunnel){
-                    memcpy(tunnel,decoded,serialize_size);
-                    tunnel->client_loaded = true;
-                    tunnel->host_loaded = true;
-                    tunnel->auth = true;
-                    tunnel->dpd = false;
-                    push(tunnels,tunnel);
+/**
+ * Packs an authenticated tunnel of the calling thread into a record of a snapshot, with the state of its child SAs
+ * @param tunnel tunnel to pack
+ * @param record record to fill
+ */
+static void
+tunnel_to_snapshot(const struct tunnel *tunnel, struct snapshot_tunnel *record){
+    const struct tunnel_ike *ike = tunnel_ike(tunnel);
+    memset(record,0,sizeof(struct snapshot_tunnel));
+    record->initiator_spi = ike->initiator_spi;
+    record->responder_spi = ike->responder_spi;
+    record->client_ip = tunnel->client_ip;
+    record->host_ip = tunnel->host_ip;
+    record->next_serial = ike->next_serial;
+    record->encap = tunnel->encap;
+    record->dpd_count = ike->dpd_count;
+    record->flags = (ike->dpd ? SNAPSHOT_DPD : 0) | (ike->deleting ? SNAPSHOT_DELETING : 0) | (ike->saved ? SNAPSHOT_SAVED : 0);
+    for(uint8_t child = 0; child < TUNNEL_CHILD_SAS; child++){
+        const struct child_sa *sa = &ike->children[child];
+        struct snapshot_child *saved = &record->children[child];
+        //a child SA that can no longer learn its spis is as good as free
+        const bool learning = sa->state != CHILD_SA_FREE && sa->learn_until >= current_tick &&
+        (sa->spi[ESP_DIR_CLIENT] == 0 || sa->spi[ESP_DIR_HOST] == 0);
+        if(sa->state == CHILD_SA_FREE || (sa->state == CHILD_SA_NEGOTIATED && !learning)){
+            continue;
+        }
+        saved->state = sa->state;
+        saved->serial = sa->serial;
+        if(learning){
+            saved->learn = sa->learn_until == UINT64_MAX ? SNAPSHOT_LEARN_FOREVER :
+            (uint32_t)((sa->learn_until - current_tick) / TIMER_HZ) + 1;
+        }
+        for(uint8_t dir = ESP_DIR_CLIENT; dir <= ESP_DIR_HOST; dir++){
+            const struct replay_window *window = child_sa_window(tunnel,child,dir);
+            saved->spi[dir] = sa->spi[dir];
+            if(sa->spi[dir] != 0){
+                saved->windows[dir].top = window->top;
+                saved->windows[dir].recent = replay_window_recent(replays,window);
+            }
+        }
+    }
+}
+
+/**
+ * Unpacks a record of a snapshot, the replay windows are restored once the tunnel has its slot
+ * @param tunnel tunnel to fill
+ * @param ike IKE part to fill
+ * @param record record of the tunnel
+ */
+static void
+tunnel_from_snapshot(struct tunnel *tunnel, struct tunnel_ike *ike, const struct snapshot_tunnel *record){
+    ike->initiator_spi = record->initiator_spi;
+    ike->responder_spi = record->responder_spi;
+    tunnel->client_ip = record->client_ip;
+    tunnel->host_ip = record->host_ip;
+    tunnel->encap = record->encap;
+    tunnel->auth = true;
+    ike->next_serial = record->next_serial;
+    ike->dpd_count = record->dpd_count;
+    ike->dpd = record->flags & SNAPSHOT_DPD;
+    ike->deleting = record->flags & SNAPSHOT_DELETING;
+    ike->saved = record->flags & SNAPSHOT_SAVED;
+    for(uint8_t child = 0; child < TUNNEL_CHILD_SAS; child++){
+        const struct snapshot_child *saved = &record->children[child];
+        struct child_sa *sa = &ike->children[child];
+        sa->state = saved->state;
+        sa->serial = saved->serial;
+        sa->learn_until = saved->learn == SNAPSHOT_LEARN_FOREVER ? UINT64_MAX :
+        current_tick + (uint64_t)saved->learn * TIMER_HZ;
+        for(uint8_t dir = ESP_DIR_CLIENT; dir <= ESP_DIR_HOST; dir++){
+            sa->spi[dir] = saved->spi[dir];
+            sa->swept[dir] = saved->windows[dir].top;
+        }
+    }
+}
+
+uint64_t snapshot_tunnels(struct snapshot_tunnel *records){
+    const uint32_t count = tunnel_pool_count(tunnels);
+    current_tick = timer_now();
+    for(uint32_t i = 0; i < count; i++){
+        tunnel_to_snapshot(tunnel_pool_at(tunnels,i),&records[i]);
+    }
+    return count;
+}
+
+void restore_snapshot(const struct tunnel_snapshot *snapshot, uint16_t worker,
+uint16_t (*worker_for_pair)(const struct ip_addr *client_ip, const struct ip_addr *host_ip)){
+    current_tick = timer_now();
+    for(uint64_t i = 0; i < snapshot->header->count; i++){
+        const struct snapshot_tunnel *record = &snapshot->tunnels[i];
+        struct tunnel tunnel = {0};
+        struct tunnel_ike ike = {0};
+        struct tunnel *added;
+        if(worker_for_pair(&record->client_ip,&record->host_ip) != worker){
+            continue;
+        }
+        tunnel_from_snapshot(&tunnel,&ike,record);
+        added = insert_tunnel(&tunnel,&ike);
+        if(added == NULL){
+            //the journal only holds the tunnels the workers do
+            if(ike.saved){
+                struct journal_tunnel removed;
+                tunnel_to_record(&tunnel,&ike,&removed);
+                tunnel_journal_append(journal_queue,JOURNAL_DELETE,&removed);
+            }
+            continue;
+        }
+        for(uint8_t child = 0; child < TUNNEL_CHILD_SAS; child++){
+            for(uint8_t dir = ESP_DIR_CLIENT; dir <= ESP_DIR_HOST; dir++){
+                if(ike.children[child].state == CHILD_SA_ACTIVE && ike.children[child].spi[dir] != 0){
+                    replay_window_restore(replays,child_sa_window(added,child,dir),record->children[child].windows[dir].top,
+                    record->children[child].windows[dir].recent);
                 }
             }
         }
     }
 }
 
+/**
+ * Makes the child SAs of a restored tunnel those of a later record of the tunnel journal. The child SAs the record
+ * still holds keep their replay windows, the others are retired, and those it adds start theirs from the next packet
+ * @param tunnel authenticated tunnel of the calling thread
+ * @param record record of the tunnel
+ */
+static void
+child_sas_from_record(struct tunnel *tunnel, const struct journal_tunnel *record){
+    struct tunnel_ike *ike = tunnel_ike(tunnel);
+    bool held[TUNNEL_CHILD_SAS] = {false};
+    for(uint8_t child = 0; child < TUNNEL_CHILD_SAS; child++){
+        const struct child_sa *sa = &ike->children[child];
+        int same = -1;
+        bool taken = false;
+        if(sa->state == CHILD_SA_FREE){
+            continue;
+        }
+        for(uint8_t i = 0; i < TUNNEL_CHILD_SAS; i++){
+            if(!held[i] && sa->spi[ESP_DIR_CLIENT] == record->spi[i][ESP_DIR_CLIENT] &&
+            sa->spi[ESP_DIR_HOST] == record->spi[i][ESP_DIR_HOST]){
+                same = i;
+            }
+            for(uint8_t dir = ESP_DIR_CLIENT; dir <= ESP_DIR_HOST; dir++){
+                taken |= sa->spi[dir] != 0 && sa->spi[dir] == record->spi[i][dir];
+            }
+        }
+        //a child SA still learning its spis is kept unless the record has one of them
+        if(child_sa_saved(sa) && same >= 0){
+            held[same] = true;
+        }
+        else if(child_sa_saved(sa) || taken){
+            retire_child_sa(tunnel,child);
+        }
+    }
+    for(uint8_t i = 0; i < TUNNEL_CHILD_SAS; i++){
+        struct child_sa *sa = NULL;
+        uint8_t slot;
+        if(held[i] || record->spi[i][ESP_DIR_CLIENT] == 0 || record->spi[i][ESP_DIR_HOST] == 0){
+            continue;
+        }
+        //a free slot, or one still learning its spis
+        for(slot = 0; slot < TUNNEL_CHILD_SAS && ike->children[slot].state != CHILD_SA_FREE; slot++);
+        if(slot == TUNNEL_CHILD_SAS){
+            for(slot = 0; slot < TUNNEL_CHILD_SAS && child_sa_saved(&ike->children[slot]); slot++);
+            if(slot == TUNNEL_CHILD_SAS){
+                break;
+            }
+            retire_child_sa(tunnel,slot);
+        }
+        sa = &ike->children[slot];
+        sa->state = CHILD_SA_ACTIVE;
+        sa->serial = ike->next_serial++;
+        for(uint8_t dir = ESP_DIR_CLIENT; dir <= ESP_DIR_HOST; dir++){
+            sa->spi[dir] = record->spi[i][dir];
+            replay_window_clear(replays,child_sa_window(tunnel,slot,dir));
+            esp_sa_index_add(esp_sas,tunnel,dir,sa->spi[dir],slot);
+        }
+    }
+    ike->saved = true;
+}
+
+/**
+ * Replays a record of the tunnel journal appended after the snapshot restored over the tunnel it keys
+ * @param type an enum journal_type
+ * @param record record of the tunnel
+ * @param arg select_worker passed to load_tunnel
+ */
+static void
+replay_tunnel(uint8_t type, const struct journal_tunnel *record, void *arg){
+    void (**select_worker)(struct tunnel *tunnel) = arg;
+    struct tunnel key = {0};
+    struct tunnel *restored;
+    key.client_ip = record->client_ip;
+    key.host_ip = record->host_ip;
+    (*select_worker)(&key);
+    restored = ike_sa_index_lookup(ike_sas,record->initiator_spi,record->responder_spi,record->client_ip,record->host_ip);
+    if(type == JOURNAL_DELETE){
+        if(restored != NULL){
+            //the journal already has the delete
+            tunnel_ike(restored)->saved = false;
+            free_tunnel(restored);
+        }
+    }
+    else if(restored == NULL){
+        restore_tunnel(record,arg);
+    }
+    else{
+        child_sas_from_record(restored,record);
+    }
+}
+
+void load_tunnel(uint16_t nb_workers, void (*select_worker)(struct tunnel *tunnel),
+void (*restore_workers)(const struct tunnel_snapshot *snapshot)){
+    struct tunnel_snapshot snapshot;
+    bool mapped;
+    //nothing may have been logged yet on a fresh host, the journal is created in the log directory
+    create_log_directory();
+    mapped = tunnel_snapshot_map(&snapshot,tunnel_snapshot_file) == 0;
+    //loading runs before the workers, the timers of the tunnels start from now
+    current_tick = timer_now();
+    journal = tunnel_journal_open(tunnel_journal_file,mapped ? snapshot.header->journal_seq : UINT64_MAX,nb_workers);
+    if(journal == NULL){
+        printf("Cannot open %s, tunnels are not saved\n",tunnel_journal_file);
+        if(mapped){
+            tunnel_snapshot_free(&snapshot);
+        }
+        return;
+    }
+    //the workers do not run yet, loading waits for the journal rather than dropping records
+    tunnel_journal_wait(journal,true);
+    if(mapped){
+        //a journal ending before the snapshot adds nothing to it, the snapshot is restored all the same
+        restore_workers(&snapshot);
+        tunnel_journal_replay_after(journal,snapshot.header->journal_seq,replay_tunnel,&select_worker);
+        tunnel_snapshot_free(&snapshot);
+    }
+    else{
+        tunnel_journal_replay(journal,restore_tunnel,&select_worker);
+    }
+    load_tunnel_file(select_worker);
+    tunnel_journal_wait(journal,false);
+}
+
+void close_tunnel_journal(void){
+    if(journal != NULL){
+        tunnel_journal_close(journal);
+        journal = NULL;
+    }
+}
+
 void get_ipv6_address_string(uint8_t* addr,char *ip)
 {
     for(int i = 0;i<16;i+=2){
@@ -534,17 +1306,13 @@ int analyse_isakmp_payload(struct rte_mbuf *pkt,struct rte_isakmp_hdr *isakmp_hd
     switch(nxt_payload){
         case NO:
             if(get_initiator_flag(isakmp_hdr) == 0){
-                for(int i = 1;i<=tunnels->size;i++){
-                    struct tunnel *tunnel = (struct tunnel *)tunnels->array[i];
-                    if(check_ike_spi(isakmp_hdr->initiator_spi,isakmp_hdr->responder_spi,src_addr_int,dst_addr_int,tunnel) == 1){
-                        if(tunnel->deleting){
-                            char log[2048] = {0};
-                            snprintf(log,2048,"%s;Session ended btw %s and %s\n",current_time,
-                            src_addr,dst_addr);
-                            write_log(ipsec_log,log,LOG_INFO);
-                            delete_tunnel(isakmp_hdr->initiator_spi,isakmp_hdr->responder_spi,src_addr_int,dst_addr_int);
-                        }
-                    }
+                struct tunnel *tunnel = ike_sa_index_lookup(ike_sas,isakmp_hdr->initiator_spi,isakmp_hdr->responder_spi,src_ip,dst_ip);
+                if(tunnel != NULL && tunnel_ike(tunnel)->deleting){
+                    char log[2048] = {0};
+                    snprintf(log,2048,"%s;Session ended btw %s and %s\n",current_time,
+                    src_addr,dst_addr);
+                    write_log(ipsec_log,log,LOG_INFO);
+                    delete_tunnel(isakmp_hdr->initiator_spi,isakmp_hdr->responder_spi,src_ip,dst_ip);
                 }
             }
         case SA:
@@ -562,11 +1330,9 @@ int analyse_isakmp_payload(struct rte_mbuf *pkt,struct rte_isakmp_hdr *isakmp_hd
         case D:{
             if(get_initiator_flag(isakmp_hdr) == 1){
                 //Session is deleted
-                for(int i = 1;i<=tunnels->size;i++){
-                    struct tunnel *tunnel = (struct tunnel *)tunnels->array[i];
-                    if(check_ike_spi(isakmp_hdr->initiator_spi,isakmp_hdr->responder_spi,src_addr_int,dst_addr_int,tunnel) == 1){
-                        tunnel->deleting = true;
-                    }
+                struct tunnel *tunnel = ike_sa_index_lookup(ike_sas,isakmp_hdr->initiator_spi,isakmp_hdr->responder_spi,src_ip,dst_ip);
+                if(tunnel != NULL){
+                    tunnel_ike(tunnel)->deleting = true;
                 }
             }
             
@@ -575,6 +1341,10 @@ int analyse_isakmp_payload(struct rte_mbuf *pkt,struct rte_isakmp_hdr *isakmp_hd
         case SK:
             check = analyse_SK(pkt,offset,isakmp_hdr);
             break;
+
+        case SKF:
+            check = analyse_SKF(pkt,offset,isakmp_hdr);
+            break;
         
         case CERT:
             check = analyse_CERT(pkt,offset,isakmp_hdr);
@@ -588,7 +1358,11 @@ int analyse_isakmp_payload(struct rte_mbuf *pkt,struct rte_isakmp_hdr *isakmp_hd
             if(offset + sizeof(struct isakmp_payload_hdr) <= rte_pktmbuf_data_len(pkt) ){
                 struct isakmp_payload_hdr *payload_hdr;
                 payload_hdr = rte_pktmbuf_mtod_offset(pkt,struct isakmp_payload_hdr *,offset);
-                if(nxt_payload != SKF){
+                if(rte_be_to_cpu_16(payload_hdr->length) < sizeof(struct isakmp_payload_hdr)){
+                    //would analyse the same payload forever
+                    check = 0;
+                }
+                else{
                     check = analyse_isakmp_payload(pkt,isakmp_hdr,offset + rte_be_to_cpu_16(payload_hdr->length),payload_hdr->nxt_payload);
                 }
             }
@@ -1,20 +1,172 @@
 #include "../include/log.h"
 #include <dirent.h>
 #include <errno.h>
+#include <sys/stat.h>
 
-void write_log(char* file_name,char log[],int priority){
+/// Number of log lines written by the logging stage per poll
+#define LOG_STAGE_BURST 64
+/// Number of distinct log files the logging stage keeps open
+#define LOG_STAGE_FILES 4
+/// Most events a log line spans
+#define LOG_EVENT_CHAIN ((LOG_LINE_MAX + LOG_EVENT_SIZE - 1) / LOG_EVENT_SIZE)
+
+static struct rte_ring *log_ring = NULL;
+static struct rte_mempool *log_pool = NULL;
+static struct log_stage_stats log_stats;
+/// Line the logging stage is putting together from its events, it may span several polls
+static char log_line[LOG_LINE_MAX];
+static size_t log_line_length;
+
+/// Log files kept open by the logging stage so that a burst of logs costs one write per file
+static struct{
+    const char *file_name;
+    FILE *fp;
+} log_files[LOG_STAGE_FILES];
+
+void create_log_directory(void){
     DIR* dir = opendir(directory);
     if (ENOENT == errno) {
         /* Directory does not exist. */
         mkdir(directory, 0700);
     } 
+    else if(dir){
+        closedir(dir);
+    }
+}
+
+void write_log_now(const char* file_name,const char log[],int priority){
+    create_log_directory();
     sd_journal_print(priority,"%s",log);
     FILE* fp = fopen(file_name, "a+");
-    fprintf(fp,"%s",log);
-    fclose(fp);
+    if(fp){
+        fprintf(fp,"%s",log);
+        fclose(fp);
+    }
     
 }
 
+void write_log(char* file_name,char log[],int priority){
+    struct log_event *events[LOG_EVENT_CHAIN];
+    size_t length;
+    bool truncated = false;
+    unsigned n;
+    if(log_ring == NULL){
+        write_log_now(file_name,log,priority);
+        return;
+    }
+    length = strlen(log);
+    if(length > LOG_LINE_MAX - 1){
+        truncated = log[length - 1] == '\n';
+        length = LOG_LINE_MAX - 1;
+        __atomic_fetch_add(&log_stats.truncated,1,__ATOMIC_RELAXED);
+    }
+    n = length == 0 ? 1 : (length + LOG_EVENT_SIZE - 1) / LOG_EVENT_SIZE;
+    //never block the caller, drop the log if the logging stage cannot keep up
+    if(rte_mempool_get_bulk(log_pool,(void **)events,n) != 0){
+        __atomic_fetch_add(&log_stats.drops,1,__ATOMIC_RELAXED);
+        return;
+    }
+    for(unsigned i = 0;i < n;i++){
+        size_t offset = (size_t)i * LOG_EVENT_SIZE;
+        events[i]->file_name = file_name;
+        events[i]->priority = priority;
+        events[i]->length = RTE_MIN(length - offset,(size_t)LOG_EVENT_SIZE);
+        events[i]->more = i + 1 < n;
+        memcpy(events[i]->log,log + offset,events[i]->length);
+    }
+    if(truncated){
+        //keep the end of line so that the next line is not glued to the cut one
+        events[n - 1]->log[events[n - 1]->length - 1] = '\n';
+    }
+    //all or nothing, so that the events of the line stay together in the ring
+    if(rte_ring_enqueue_bulk(log_ring,(void **)events,n,NULL) == 0){
+        rte_mempool_put_bulk(log_pool,(void **)events,n);
+        __atomic_fetch_add(&log_stats.drops,1,__ATOMIC_RELAXED);
+    }
+}
+
+int log_stage_init(unsigned ring_size,int socket_id){
+    log_pool = rte_mempool_create("LOG_EVENT_POOL",ring_size * 2 - 1,sizeof(struct log_event),
+    LOG_STAGE_BURST,0,NULL,NULL,NULL,NULL,socket_id,0);
+    if(log_pool == NULL){
+        return -1;
+    }
+    log_ring = rte_ring_create("LOG_RING",ring_size,socket_id,RING_F_SC_DEQ);
+    if(log_ring == NULL){
+        rte_mempool_free(log_pool);
+        log_pool = NULL;
+        return -1;
+    }
+    create_log_directory();
+    return 0;
+}
+
+/// Gets the open log file for a file name, opening it if needed
+static FILE *
+log_stage_file(const char *file_name){
+    int i;
+    for(i = 0;i < LOG_STAGE_FILES && log_files[i].file_name != NULL;i++){
+        if(log_files[i].file_name == file_name || strcmp(log_files[i].file_name,file_name) == 0){
+            return log_files[i].fp;
+        }
+    }
+    if(i == LOG_STAGE_FILES){
+        return NULL;
+    }
+    log_files[i].fp = fopen(file_name,"a+");
+    if(log_files[i].fp != NULL){
+        log_files[i].file_name = file_name;
+    }
+    return log_files[i].fp;
+}
+
+unsigned log_stage_poll(void){
+    struct log_event *events[LOG_STAGE_BURST];
+    unsigned available;
+    unsigned n = rte_ring_dequeue_burst(log_ring,(void **)events,LOG_STAGE_BURST,&available);
+    if(n == 0){
+        return 0;
+    }
+    if(n + available > log_stats.peak){
+        log_stats.peak = n + available;
+    }
+    for(unsigned i = 0;i < n;i++){
+        FILE *fp;
+        memcpy(log_line + log_line_length,events[i]->log,events[i]->length);
+        log_line_length += events[i]->length;
+        if(events[i]->more){
+            continue;
+        }
+        log_line[log_line_length] = '\0';
+        log_line_length = 0;
+        fp = log_stage_file(events[i]->file_name);
+        sd_journal_print(events[i]->priority,"%s",log_line);
+        if(fp != NULL){
+            fputs(log_line,fp);
+        }
+        else{
+            write_log_now(events[i]->file_name,log_line,events[i]->priority);
+        }
+        log_stats.written++;
+    }
+    for(int i = 0;i < LOG_STAGE_FILES && log_files[i].file_name != NULL;i++){
+        fflush(log_files[i].fp);
+    }
+    rte_mempool_put_bulk(log_pool,(void **)events,n);
+    return n;
+}
+
+struct rte_ring *log_stage_ring(void){
+    return log_ring;
+}
+
+void log_stage_get_stats(struct log_stage_stats *stats){
+    stats->written = log_stats.written;
+    stats->drops = __atomic_load_n(&log_stats.drops,__ATOMIC_RELAXED);
+    stats->truncated = __atomic_load_n(&log_stats.truncated,__ATOMIC_RELAXED);
+    stats->peak = log_stats.peak;
+}
+
 void get_current_time(char* buf){
     time_t rawtime;
     struct tm * timeinfo;
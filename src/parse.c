@@ -0,0 +1,181 @@
+#include "../include/parse.h"
+#include <string.h>
+#include <stdbool.h>
+#include <netinet/in.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_udp.h>
+#include <rte_tcp.h>
+
+/// Gets the layer 4 packet type of an ip protocol
+static inline uint32_t
+proto_ptype(uint8_t proto){
+    switch(proto){
+        case IPPROTO_TCP:
+            return RTE_PTYPE_L4_TCP;
+        case IPPROTO_UDP:
+            return RTE_PTYPE_L4_UDP;
+        case IPPROTO_ICMP:
+        case IPPROTO_ICMPV6:
+            return RTE_PTYPE_L4_ICMP;
+        default:
+            return RTE_PTYPE_L4_NONFRAG;
+    }
+}
+
+/**
+ * Walks the IPv6 extension headers following the fixed header
+ * @param data start of the packet
+ * @param len length of the packet
+ * @param desc descriptor with the offset of the ip header, gets the layer 4 offset and protocol
+ * @returns layer 3 and 4 packet type, with the layer 4 type unknown if the chain is truncated
+ */
+static uint32_t
+parse_ipv6(const uint8_t *data,uint32_t len,struct pkt_desc *desc){
+    const struct rte_ipv6_hdr *ipv6_hdr = (const struct rte_ipv6_hdr *)(data + desc->l3_offset);
+    uint32_t offset = desc->l3_offset + sizeof(struct rte_ipv6_hdr);
+    uint8_t proto = ipv6_hdr->proto;
+    uint32_t l3 = RTE_PTYPE_L3_IPV6;
+    bool fragment = false;
+
+    for(int i = 0; i < PARSE_MAX_IPV6_EXTS; i++){
+        if(proto == IPPROTO_HOPOPTS || proto == IPPROTO_ROUTING || proto == IPPROTO_DSTOPTS){
+            if(offset + 2 > len){
+                return l3;
+            }
+            proto = data[offset];
+            offset += (data[offset + 1] + 1) * 8;
+        }
+        else if(proto == IPPROTO_AH){
+            if(offset + 2 > len){
+                return l3;
+            }
+            proto = data[offset];
+            offset += (data[offset + 1] + 2) * 4;
+        }
+        else if(proto == IPPROTO_FRAGMENT){
+            uint16_t frag_data;
+            if(offset + 8 > len){
+                return l3;
+            }
+            memcpy(&frag_data,data + offset + 2,sizeof(frag_data));
+            //fragment offset or more fragments flag set
+            fragment = (frag_data & RTE_BE16(0xFFF9)) != 0;
+            proto = data[offset];
+            offset += 8;
+            if(fragment){
+                //what follows is part of the fragmented payload, the fragment header stays right before it
+                l3 = RTE_PTYPE_L3_IPV6_EXT;
+                break;
+            }
+        }
+        else{
+            break;
+        }
+        l3 = RTE_PTYPE_L3_IPV6_EXT;
+    }
+    if(offset > len || offset > UINT16_MAX){
+        return l3;
+    }
+    desc->l4_offset = offset;
+    desc->l4_proto = proto;
+    return l3 | (fragment ? RTE_PTYPE_L4_FRAG : proto_ptype(proto));
+}
+
+void parse_packet(const struct rte_mbuf *pkt,struct pkt_desc *desc){
+    const uint8_t *data = rte_pktmbuf_mtod(pkt,const uint8_t *);
+    const uint32_t len = rte_pktmbuf_data_len(pkt);
+    const uint32_t hw_ptype = pkt->packet_type;
+    uint32_t offset = sizeof(struct rte_ether_hdr);
+    uint32_t l2 = RTE_PTYPE_L2_ETHER;
+    uint16_t ether_type;
+
+    memset(desc,0,sizeof(struct pkt_desc));
+    if(sizeof(struct rte_ether_hdr) > len){
+        return;
+    }
+
+    if((hw_ptype & RTE_PTYPE_L2_MASK) == RTE_PTYPE_L2_ETHER && (hw_ptype & RTE_PTYPE_L3_MASK) == RTE_PTYPE_L3_IPV4){
+        //the port found no VLAN tag nor IPv4 options
+        ether_type = RTE_BE16(RTE_ETHER_TYPE_IPV4);
+    }
+    else{
+        ether_type = ((const struct rte_ether_hdr *)data)->ether_type;
+        for(int i = 0; i < PARSE_MAX_VLANS && (ether_type == RTE_BE16(RTE_ETHER_TYPE_VLAN) || ether_type == RTE_BE16(RTE_ETHER_TYPE_QINQ)); i++){
+            if(offset + sizeof(struct rte_vlan_hdr) > len){
+                return;
+            }
+            ether_type = ((const struct rte_vlan_hdr *)(data + offset))->eth_proto;
+            offset += sizeof(struct rte_vlan_hdr);
+            l2 = l2 == RTE_PTYPE_L2_ETHER ? RTE_PTYPE_L2_ETHER_VLAN : RTE_PTYPE_L2_ETHER_QINQ;
+        }
+    }
+    desc->l3_offset = offset;
+    desc->ptype = l2;
+
+    if(ether_type == RTE_BE16(RTE_ETHER_TYPE_IPV4)){
+        const struct rte_ipv4_hdr *ipv4_hdr = (const struct rte_ipv4_hdr *)(data + offset);
+        uint32_t ihl;
+        desc->ptype |= RTE_PTYPE_L3_IPV4;
+        if(offset + sizeof(struct rte_ipv4_hdr) > len){
+            return;
+        }
+        ihl = (ipv4_hdr->version_ihl & RTE_IPV4_HDR_IHL_MASK) * 4;
+        if(ihl < sizeof(struct rte_ipv4_hdr) || offset + ihl > len){
+            return;
+        }
+        if(ihl > sizeof(struct rte_ipv4_hdr)){
+            desc->ptype = l2 | RTE_PTYPE_L3_IPV4_EXT;
+        }
+        desc->l4_offset = offset + ihl;
+        desc->l4_proto = ipv4_hdr->next_proto_id;
+        if((ipv4_hdr->fragment_offset & RTE_BE16(RTE_IPV4_HDR_MF_FLAG | RTE_IPV4_HDR_OFFSET_MASK)) != 0){
+            desc->ptype |= RTE_PTYPE_L4_FRAG;
+            return;
+        }
+        desc->ptype |= proto_ptype(desc->l4_proto);
+    }
+    else if(ether_type == RTE_BE16(RTE_ETHER_TYPE_IPV6)){
+        if(offset + sizeof(struct rte_ipv6_hdr) > len){
+            desc->ptype |= RTE_PTYPE_L3_IPV6;
+            return;
+        }
+        desc->ptype |= parse_ipv6(data,len,desc);
+    }
+    else{
+        return;
+    }
+
+    switch(desc->ptype & RTE_PTYPE_L4_MASK){
+        case RTE_PTYPE_L4_NONFRAG:
+            if(desc->l4_proto == IPPROTO_ESP){
+                //ESP directly over ip, its header is checked against the length when classified
+                desc->ptype |= RTE_PTYPE_TUNNEL_ESP;
+                desc->payload_offset = desc->l4_offset;
+            }
+            break;
+        case RTE_PTYPE_L4_UDP:{
+            const struct rte_udp_hdr *udp_hdr = (const struct rte_udp_hdr *)(data + desc->l4_offset);
+            if(desc->l4_offset + sizeof(struct rte_udp_hdr) > len){
+                desc->ptype &= ~RTE_PTYPE_L4_MASK;
+                return;
+            }
+            desc->src_port = rte_be_to_cpu_16(udp_hdr->src_port);
+            desc->dst_port = rte_be_to_cpu_16(udp_hdr->dst_port);
+            desc->payload_offset = desc->l4_offset + sizeof(struct rte_udp_hdr);
+            break;
+        }
+        case RTE_PTYPE_L4_TCP:{
+            const struct rte_tcp_hdr *tcp_hdr = (const struct rte_tcp_hdr *)(data + desc->l4_offset);
+            if(desc->l4_offset + sizeof(struct rte_tcp_hdr) > len){
+                desc->ptype &= ~RTE_PTYPE_L4_MASK;
+                return;
+            }
+            desc->src_port = rte_be_to_cpu_16(tcp_hdr->src_port);
+            desc->dst_port = rte_be_to_cpu_16(tcp_hdr->dst_port);
+            break;
+        }
+        default:
+            break;
+    }
+}
@@ -0,0 +1,225 @@
+#include "../include/pcap.h"
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <byteswap.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define PCAP_MAGIC 0xa1b2c3d4
+#define PCAP_MAGIC_NS 0xa1b23c4d
+#define PCAP_HDR_SIZE 24
+#define PCAP_RECORD_HDR_SIZE 16
+
+#define PCAPNG_SHB 0x0A0D0D0A
+#define PCAPNG_IDB 0x00000001
+#define PCAPNG_SPB 0x00000003
+#define PCAPNG_EPB 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+/// Size of the type and the two length fields around every pcapng block
+#define PCAPNG_BLOCK_OVERHEAD 12
+
+/// Reads a 16 bit field written in the byte order of the file
+static inline uint16_t
+read_16(const struct pcap_file *file,size_t offset){
+    uint16_t value;
+    memcpy(&value,file->data + offset,sizeof(value));
+    return file->swapped ? bswap_16(value) : value;
+}
+
+/// Reads a 32 bit field written in the byte order of the file
+static inline uint32_t
+read_32(const struct pcap_file *file,size_t offset){
+    uint32_t value;
+    memcpy(&value,file->data + offset,sizeof(value));
+    return file->swapped ? bswap_32(value) : value;
+}
+
+/**
+ * Reads a pcapng section header block and resets the interfaces described
+ * @returns 0 if the block is valid, -1 if otherwise
+ */
+static int
+read_section_header(struct pcap_file *file){
+    uint32_t magic;
+    if(file->offset + PCAPNG_BLOCK_OVERHEAD + 4 > file->size){
+        return -1;
+    }
+    memcpy(&magic,file->data + file->offset + 8,sizeof(magic));
+    if(magic == PCAPNG_BYTE_ORDER_MAGIC){
+        file->swapped = false;
+    }
+    else if(magic == bswap_32(PCAPNG_BYTE_ORDER_MAGIC)){
+        file->swapped = true;
+    }
+    else{
+        return -1;
+    }
+    file->nb_interfaces = 0;
+    return 0;
+}
+
+int pcap_open(struct pcap_file *file,const char *path){
+    struct stat st;
+    uint32_t magic;
+    int fd = open(path,O_RDONLY);
+    memset(file,0,sizeof(struct pcap_file));
+    if(fd < 0){
+        printf("Cannot open %s\n",path);
+        return -1;
+    }
+    if(fstat(fd,&st) != 0 || st.st_size < PCAP_HDR_SIZE){
+        printf("%s is not a capture file\n",path);
+        close(fd);
+        return -1;
+    }
+    file->size = st.st_size;
+    file->data = mmap(NULL,file->size,PROT_READ,MAP_PRIVATE,fd,0);
+    close(fd);
+    if(file->data == MAP_FAILED){
+        printf("Cannot map %s\n",path);
+        file->data = NULL;
+        return -1;
+    }
+    madvise((void *)file->data,file->size,MADV_SEQUENTIAL | MADV_WILLNEED);
+
+    memcpy(&magic,file->data,sizeof(magic));
+    if(magic == PCAP_MAGIC || magic == PCAP_MAGIC_NS || magic == bswap_32(PCAP_MAGIC) || magic == bswap_32(PCAP_MAGIC_NS)){
+        file->swapped = magic == bswap_32(PCAP_MAGIC) || magic == bswap_32(PCAP_MAGIC_NS);
+        file->linktype[0] = read_32(file,20);
+        file->snaplen[0] = read_32(file,16);
+        file->nb_interfaces = 1;
+        file->offset = PCAP_HDR_SIZE;
+        return 0;
+    }
+    if(magic == PCAPNG_SHB){
+        file->pcapng = true;
+        if(read_section_header(file) == 0){
+            return 0;
+        }
+    }
+    printf("%s is not a pcap or pcapng file\n",path);
+    pcap_close(file);
+    return -1;
+}
+
+/**
+ * Reads the next packet of a pcap file
+ * @returns 1 if a packet was read, 0 if the packet was skipped, -1 at the end of the file
+ */
+static int
+next_pcap_packet(struct pcap_file *file,struct rte_mbuf *view){
+    uint32_t caplen;
+    size_t data_offset;
+    if(file->offset + PCAP_RECORD_HDR_SIZE > file->size){
+        return -1;
+    }
+    caplen = read_32(file,file->offset + 8);
+    data_offset = file->offset + PCAP_RECORD_HDR_SIZE;
+    if(data_offset + caplen > file->size){
+        return -1;
+    }
+    file->offset = data_offset + caplen;
+    if(file->linktype[0] != PCAP_LINKTYPE_ETHERNET || caplen > UINT16_MAX){
+        file->skipped++;
+        return 0;
+    }
+    pkt_view_init(view,file->data + data_offset,caplen);
+    return 1;
+}
+
+/**
+ * Reads the next block of a pcapng file
+ * @returns 1 if the block was a packet that was read, 0 if it was skipped, -1 at the end of the file
+ */
+static int
+next_pcapng_packet(struct pcap_file *file,struct rte_mbuf *view){
+    uint32_t type;
+    uint32_t block_len;
+    size_t block = file->offset;
+    uint32_t interface = 0;
+    uint32_t caplen;
+    size_t data_offset;
+
+    if(block + PCAPNG_BLOCK_OVERHEAD > file->size){
+        return -1;
+    }
+    memcpy(&type,file->data + block,sizeof(type));
+    if(type == PCAPNG_SHB){
+        //a new section can switch byte order
+        file->offset = block;
+        if(read_section_header(file) != 0){
+            return -1;
+        }
+    }
+    else{
+        type = read_32(file,block);
+    }
+    block_len = read_32(file,block + 4);
+    if(block_len < PCAPNG_BLOCK_OVERHEAD || block_len % 4 != 0 || block + block_len > file->size){
+        return -1;
+    }
+    file->offset = block + block_len;
+
+    switch(type){
+        case PCAPNG_IDB:
+            if(block_len >= PCAPNG_BLOCK_OVERHEAD + 8 && file->nb_interfaces < PCAP_MAX_INTERFACES){
+                file->linktype[file->nb_interfaces] = read_16(file,block + 8);
+                file->snaplen[file->nb_interfaces] = read_32(file,block + 12);
+                file->nb_interfaces++;
+            }
+            return 0;
+        case PCAPNG_EPB:
+            if(block_len < PCAPNG_BLOCK_OVERHEAD + 20){
+                return 0;
+            }
+            interface = read_32(file,block + 8);
+            caplen = read_32(file,block + 20);
+            data_offset = block + 28;
+            break;
+        case PCAPNG_SPB:
+            if(block_len < PCAPNG_BLOCK_OVERHEAD + 4){
+                return 0;
+            }
+            caplen = RTE_MIN(read_32(file,block + 8),block_len - PCAPNG_BLOCK_OVERHEAD - 4);
+            if(file->nb_interfaces > 0 && file->snaplen[0] != 0){
+                caplen = RTE_MIN(caplen,file->snaplen[0]);
+            }
+            data_offset = block + 12;
+            break;
+        default:
+            return 0;
+    }
+    if(data_offset + caplen > block + block_len - 4){
+        file->skipped++;
+        return 0;
+    }
+    if(interface >= file->nb_interfaces || file->linktype[interface] != PCAP_LINKTYPE_ETHERNET || caplen > UINT16_MAX){
+        file->skipped++;
+        return 0;
+    }
+    pkt_view_init(view,file->data + data_offset,caplen);
+    return 1;
+}
+
+uint16_t pcap_next_burst(struct pcap_file *file,struct rte_mbuf *views,struct rte_mbuf **pkts,uint16_t n){
+    uint16_t count = 0;
+    while(count < n){
+        int read = file->pcapng ? next_pcapng_packet(file,&views[count]) : next_pcap_packet(file,&views[count]);
+        if(read < 0){
+            break;
+        }
+        if(read == 1){
+            pkts[count] = &views[count];
+            count++;
+        }
+    }
+    return count;
+}
+
+void pcap_close(struct pcap_file *file){
+    if(file->data != NULL){
+        munmap((void *)file->data,file->size);
+        file->data = NULL;
+    }
+}
@@ -0,0 +1,276 @@
+#include "../include/reasm.h"
+#include <time.h>
+#include <netinet/in.h>
+#include <rte_ip.h>
+#include <rte_udp.h>
+
+/// udp ports of IKE, the only datagrams reassembled
+#define REASM_ISAKMP_PORT 500
+#define REASM_NAT_T_PORT 4500
+
+/**
+ * @struct frag_info
+ * @brief Where a fragment belongs in its datagram
+ */
+struct frag_info{
+    struct ip_addr src;
+    struct ip_addr dst;
+    uint32_t id;
+    /** offset of the fragment payload in the datagram payload */
+    uint32_t offset;
+    /** length of the fragment payload */
+    uint32_t len;
+    /** whether if more fragments follow */
+    bool more;
+};
+
+struct reasm_table *reasm_create(void){
+    return calloc(1,sizeof(struct reasm_table));
+}
+
+/// Gets monotonic seconds, precise enough for REASM_TIMEOUT
+static inline uint64_t
+reasm_now(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE,&now);
+    return now.tv_sec;
+}
+
+/**
+ * Reads the addresses, id and position of a fragment from its ip and fragment headers
+ * @returns 0 on success, -1 if the headers do not match the length of the packet
+ */
+static int
+frag_info_get(const struct rte_mbuf *pkt, const struct pkt_desc *desc, struct frag_info *info){
+    const uint8_t *data = rte_pktmbuf_mtod(pkt,const uint8_t *);
+    const uint32_t len = rte_pktmbuf_data_len(pkt);
+    uint32_t end;
+
+    if(RTE_ETH_IS_IPV4_HDR(desc->ptype)){
+        const struct rte_ipv4_hdr *ipv4_hdr = (const struct rte_ipv4_hdr *)(data + desc->l3_offset);
+        const uint16_t frag = rte_be_to_cpu_16(ipv4_hdr->fragment_offset);
+        info->src = ip_addr_from_ipv4(ipv4_hdr->src_addr);
+        info->dst = ip_addr_from_ipv4(ipv4_hdr->dst_addr);
+        info->id = ipv4_hdr->packet_id;
+        info->offset = (frag & RTE_IPV4_HDR_OFFSET_MASK) * REASM_UNIT;
+        info->more = (frag & RTE_IPV4_HDR_MF_FLAG) != 0;
+        end = desc->l3_offset + rte_be_to_cpu_16(ipv4_hdr->total_length);
+    }
+    else{
+        const struct rte_ipv6_hdr *ipv6_hdr = (const struct rte_ipv6_hdr *)(data + desc->l3_offset);
+        //the fragment header is right before the fragment payload
+        const uint8_t *frag_hdr = data + desc->l4_offset - 8;
+        uint16_t frag_data;
+        uint32_t id;
+        memcpy(&frag_data,frag_hdr + 2,sizeof(frag_data));
+        memcpy(&id,frag_hdr + 4,sizeof(id));
+        info->src = ip_addr_from_ipv6(ipv6_hdr->src_addr);
+        info->dst = ip_addr_from_ipv6(ipv6_hdr->dst_addr);
+        info->id = id;
+        info->offset = rte_be_to_cpu_16(frag_data) & 0xFFF8;
+        info->more = (rte_be_to_cpu_16(frag_data) & 1) != 0;
+        end = desc->l3_offset + sizeof(struct rte_ipv6_hdr) + rte_be_to_cpu_16(ipv6_hdr->payload_len);
+    }
+    if(end > len || end < desc->l4_offset){
+        return -1;
+    }
+    info->len = end - desc->l4_offset;
+    return 0;
+}
+
+/// Frees the fragments held by a flow and gives its slot back
+static void
+flow_free(struct reasm_table *table, struct reasm_flow *flow){
+    free(flow->buf);
+    table->memory -= flow->buf_size;
+    flow->buf = NULL;
+    flow->buf_size = 0;
+    flow->used = false;
+}
+
+/**
+ * Finds the flow of a fragment, giving up on the flows that timed out on the way
+ * @returns the flow, a new one if the fragment is the first seen of its datagram, NULL if the table is full
+ */
+static struct reasm_flow *
+flow_lookup(struct reasm_table *table, const struct frag_info *info, uint8_t proto, uint64_t now){
+    struct reasm_flow *free_flow = NULL;
+    for(int i = 0; i < REASM_MAX_FLOWS; i++){
+        struct reasm_flow *flow = &table->flows[i];
+        if(flow->used && now - flow->start >= REASM_TIMEOUT){
+            flow_free(table,flow);
+            table->timeouts++;
+        }
+        if(!flow->used){
+            if(free_flow == NULL){
+                free_flow = flow;
+            }
+            continue;
+        }
+        if(flow->id == info->id && flow->proto == proto && ip_addr_equal(flow->src,info->src) && ip_addr_equal(flow->dst,info->dst)){
+            return flow;
+        }
+    }
+    if(free_flow != NULL){
+        free_flow->src = info->src;
+        free_flow->dst = info->dst;
+        free_flow->id = info->id;
+        free_flow->proto = proto;
+        free_flow->used = true;
+        free_flow->not_ike = false;
+        free_flow->start = now;
+        free_flow->hdr_len = 0;
+        free_flow->total = 0;
+        free_flow->received = 0;
+        memset(free_flow->units,0,sizeof(free_flow->units));
+    }
+    return free_flow;
+}
+
+/**
+ * Marks the units of a fragment as received
+ * @returns false if some of them already were
+ */
+static bool
+flow_mark_units(struct reasm_flow *flow, const struct frag_info *info){
+    const uint32_t first = info->offset / REASM_UNIT;
+    const uint32_t last = (info->offset + info->len + REASM_UNIT - 1) / REASM_UNIT;
+    for(uint32_t u = first; u < last; u++){
+        if(flow->units[u / 64] & (1ULL << (u % 64))){
+            return false;
+        }
+    }
+    for(uint32_t u = first; u < last; u++){
+        flow->units[u / 64] |= 1ULL << (u % 64);
+    }
+    flow->received += info->len;
+    return true;
+}
+
+/**
+ * Grows the buffer of a flow to hold payload up to an offset, within the memory cap
+ * @returns 0 on success, -1 if the memory cap would be exceeded
+ */
+static int
+flow_reserve(struct reasm_table *table, struct reasm_flow *flow, uint32_t end){
+    uint32_t size = flow->buf_size;
+    uint8_t *buf;
+    if(REASM_MAX_HDR + end <= size){
+        return 0;
+    }
+    size = RTE_MAX(REASM_MAX_HDR + end,size * 2);
+    size = RTE_MIN(size,REASM_MAX_HDR + REASM_MAX_SIZE);
+    if(table->memory - flow->buf_size + size > REASM_MEMORY_CAP){
+        return -1;
+    }
+    buf = realloc(flow->buf,size);
+    if(buf == NULL){
+        return -1;
+    }
+    table->memory += size - flow->buf_size;
+    flow->buf = buf;
+    flow->buf_size = size;
+    return 0;
+}
+
+enum reasm_result reasm_add(struct reasm_table *table, const struct rte_mbuf *pkt, const struct pkt_desc *desc,
+struct rte_mbuf **datagram, struct pkt_desc *datagram_desc){
+    const uint8_t *data = rte_pktmbuf_mtod(pkt,const uint8_t *);
+    struct frag_info info;
+    struct reasm_flow *flow;
+
+    free(table->done);
+    table->done = NULL;
+
+    if(frag_info_get(pkt,desc,&info) != 0 || (info.more && (info.len == 0 || info.len % REASM_UNIT != 0)) ||
+    desc->l4_offset > REASM_MAX_HDR || desc->l4_offset + info.offset + info.len > REASM_MAX_SIZE){
+        return REASM_MALFORMED;
+    }
+    flow = flow_lookup(table,&info,desc->l4_proto,reasm_now());
+    if(flow == NULL){
+        table->drops++;
+        return REASM_DROPPED;
+    }
+
+    if(info.offset == 0 && !flow->not_ike){
+        const struct rte_udp_hdr *udp_hdr = (const struct rte_udp_hdr *)(data + desc->l4_offset);
+        uint16_t src_port, dst_port;
+        if(info.len < sizeof(struct rte_udp_hdr)){
+            flow_free(table,flow);
+            table->malformed++;
+            return REASM_MALFORMED;
+        }
+        src_port = rte_be_to_cpu_16(udp_hdr->src_port);
+        dst_port = rte_be_to_cpu_16(udp_hdr->dst_port);
+        if(src_port != REASM_ISAKMP_PORT && dst_port != REASM_ISAKMP_PORT &&
+        src_port != REASM_NAT_T_PORT && dst_port != REASM_NAT_T_PORT){
+            //the fragments held so far are not needed, only keep counting them to know when it ends
+            flow->not_ike = true;
+            table->memory -= flow->buf_size;
+            free(flow->buf);
+            flow->buf = NULL;
+            flow->buf_size = 0;
+        }
+    }
+
+    //overlapping fragments, a second last fragment or fragments past the last are never valid
+    if(!flow_mark_units(flow,&info) || (!info.more && flow->total != 0) ||
+    (flow->total != 0 && info.offset + info.len > flow->total)){
+        flow_free(table,flow);
+        table->malformed++;
+        return REASM_MALFORMED;
+    }
+    if(!info.more){
+        flow->total = info.offset + info.len;
+        for(uint32_t u = (flow->total + REASM_UNIT - 1) / REASM_UNIT; u < REASM_MAX_SIZE / REASM_UNIT + 1; u++){
+            if(flow->units[u / 64] & (1ULL << (u % 64))){
+                flow_free(table,flow);
+                table->malformed++;
+                return REASM_MALFORMED;
+            }
+        }
+    }
+
+    if(flow->not_ike){
+        if(flow->total != 0 && flow->received == flow->total){
+            flow_free(table,flow);
+        }
+        return REASM_NOT_IKE;
+    }
+
+    if(flow_reserve(table,flow,info.offset + info.len) != 0){
+        flow_free(table,flow);
+        table->drops++;
+        return REASM_DROPPED;
+    }
+    memcpy(flow->buf + REASM_MAX_HDR + info.offset,data + desc->l4_offset,info.len);
+    if(info.offset == 0){
+        flow->hdr_len = desc->l4_offset;
+        flow->desc = *desc;
+        memcpy(flow->buf + REASM_MAX_HDR - flow->hdr_len,data,flow->hdr_len);
+    }
+    if(flow->total == 0 || flow->received != flow->total){
+        return REASM_HELD;
+    }
+
+    //every fragment arrived, hand the datagram over with its headers in front of the payload
+    const uint8_t *start = flow->buf + REASM_MAX_HDR - flow->hdr_len;
+    const struct rte_udp_hdr *udp_hdr = (const struct rte_udp_hdr *)(flow->buf + REASM_MAX_HDR);
+    *datagram_desc = flow->desc;
+    datagram_desc->ptype = (flow->desc.ptype & ~RTE_PTYPE_L4_MASK) | RTE_PTYPE_L4_UDP;
+    datagram_desc->l4_proto = IPPROTO_UDP;
+    datagram_desc->src_port = rte_be_to_cpu_16(udp_hdr->src_port);
+    datagram_desc->dst_port = rte_be_to_cpu_16(udp_hdr->dst_port);
+    datagram_desc->payload_offset = flow->hdr_len + sizeof(struct rte_udp_hdr);
+    pkt_view_init(&table->view,start,flow->hdr_len + flow->total);
+    *datagram = &table->view;
+
+    //keep the buffer until the next call, the slot and memory are given back now
+    table->done = flow->buf;
+    table->memory -= flow->buf_size;
+    flow->buf = NULL;
+    flow->buf_size = 0;
+    flow->used = false;
+    table->reassembled++;
+    return REASM_DONE;
+}
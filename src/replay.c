@@ -0,0 +1,60 @@
+#include "../include/replay.h"
+#include <stdlib.h>
+#include <string.h>
+#include <rte_common.h>
+
+struct replay_table *replay_table_create(uint32_t capacity, uint32_t size){
+    struct replay_table *table = calloc(1,sizeof(struct replay_table));
+    if(table == NULL){
+        return NULL;
+    }
+    table->size = size;
+    //twice the window, so that the word the window starts in is never the one it ends in
+    table->word_mask = size * 2 / 64 - 1;
+    //both windows of a tunnel share a cache line with the smallest size
+    table->stride = RTE_ALIGN_CEIL(sizeof(struct replay_window) + (table->word_mask + 1) * sizeof(uint64_t),32);
+    table->windows = aligned_alloc(RTE_CACHE_LINE_SIZE,RTE_ALIGN_CEIL((uint64_t)capacity * 2 * table->stride,RTE_CACHE_LINE_SIZE));
+    if(table->windows == NULL){
+        free(table);
+        return NULL;
+    }
+    //committed up front like the tunnels they belong to
+    memset(table->windows,0,(uint64_t)capacity * 2 * table->stride);
+    return table;
+}
+
+void replay_window_reset(const struct replay_table *table, struct replay_window *window, uint32_t seq){
+    memset(window->bits,0,(table->word_mask + 1) * sizeof(uint64_t));
+    window->top = seq;
+    window->bits[(seq >> 6) & table->word_mask] = 1ULL << (seq & 63);
+}
+
+void replay_window_clear(const struct replay_table *table, struct replay_window *window){
+    memset(window->bits,0,(table->word_mask + 1) * sizeof(uint64_t));
+    window->top = 0;
+}
+
+uint64_t replay_window_recent(const struct replay_table *table, const struct replay_window *window){
+    const uint64_t offset = window->top & 63;
+    //the word of top holds it and the numbers below it in the word, the word before holds the rest
+    uint64_t recent = window->bits[(window->top >> 6) & table->word_mask] << (63 - offset);
+    if(offset < 63){
+        recent |= window->bits[((window->top >> 6) - 1) & table->word_mask] >> (offset + 1);
+    }
+    return recent;
+}
+
+void replay_window_restore(const struct replay_table *table, struct replay_window *window, uint64_t top, uint64_t recent){
+    const uint64_t offset = top & 63;
+    if(top == 0){
+        replay_window_clear(table,window);
+        return;
+    }
+    memset(window->bits,0xFF,(table->word_mask + 1) * sizeof(uint64_t));
+    window->top = top;
+    //the numbers above top in its word must not be set, the window does not clear the word it is in when it slides
+    window->bits[(top >> 6) & table->word_mask] = recent >> (63 - offset);
+    if(offset < 63){
+        window->bits[((top >> 6) - 1) & table->word_mask] = (recent << (offset + 1)) | ((1ULL << (offset + 1)) - 1);
+    }
+}
@@ -0,0 +1,235 @@
+#include "../include/sa_index.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <rte_common.h>
+#include <rte_memory.h>
+#include <rte_cycles.h>
+
+/**
+ * Allocates the zeroed slots of an index on transparent huge pages where the kernel allows it. Every SA a
+ * worker looks up or adds is at a random slot, which on small pages misses the TLB as well as the cache
+ * once the index is larger than the TLB covers. The slots are zeroed here so that the pages are committed
+ * up front rather than faulted in by the first SAs added
+ * @param size bytes of slots
+ * @returns the slots, NULL if they cannot be allocated
+ */
+static void *
+sa_index_slots_alloc(size_t size){
+    const size_t huge = RTE_PGSIZE_2M;
+    void *slots;
+    size = RTE_ALIGN_CEIL(size,huge);
+    slots = aligned_alloc(huge,size);
+    if(slots == NULL){
+        return NULL;
+    }
+    //only advice, small pages are used if huge ones are off or none is free
+    madvise(slots,size,MADV_HUGEPAGE);
+    memset(slots,0,size);
+    return slots;
+}
+
+/**
+ * Gets the number of slots of a new index, enough for it to stay at most half full while it holds at most
+ * capacity entries
+ * @param capacity entries the index is expected to hold
+ * @returns a power of two
+ */
+static uint32_t
+sa_index_size(uint32_t capacity){
+    const uint64_t size = rte_align64pow2((uint64_t)capacity * 2);
+    return size < SA_INDEX_INIT_SIZE ? SA_INDEX_INIT_SIZE : size;
+}
+
+struct ike_sa_index *ike_sa_index_create(uint32_t capacity){
+    const uint32_t size = sa_index_size(capacity);
+    struct ike_sa_index *index = calloc(1,sizeof(struct ike_sa_index));
+    if(index == NULL){
+        return NULL;
+    }
+    index->slots = sa_index_slots_alloc((size_t)size * sizeof(struct ike_sa_slot));
+    if(index->slots == NULL){
+        free(index);
+        return NULL;
+    }
+    index->mask = size - 1;
+    index->seed = (uint32_t)rte_rdtsc();
+    return index;
+}
+
+int ike_sa_index_add(struct ike_sa_index *index, struct tunnel *tunnel){
+    const struct tunnel_ike *ike = tunnel_ike(tunnel);
+    uint32_t s;
+    //a quarter of the slots is kept free so that probes stay short and end quickly on a miss
+    if((index->count + 1) * 4 > (index->mask + 1) * 3){
+        return -1;
+    }
+    s = ike_sa_hash(index,ike->initiator_spi,ike->responder_spi) & index->mask;
+    while(index->slots[s].tunnel != NULL){
+        s = (s + 1) & index->mask;
+    }
+    index->slots[s].initiator_spi = ike->initiator_spi;
+    index->slots[s].responder_spi = ike->responder_spi;
+    index->slots[s].tunnel = tunnel;
+    index->count++;
+    return 0;
+}
+
+void ike_sa_index_del(struct ike_sa_index *index, struct tunnel *tunnel){
+    const struct tunnel_ike *ike = tunnel_ike(tunnel);
+    uint32_t s = ike_sa_hash(index,ike->initiator_spi,ike->responder_spi) & index->mask;
+    uint32_t next;
+    while(index->slots[s].tunnel != tunnel){
+        if(index->slots[s].tunnel == NULL){
+            return;
+        }
+        s = (s + 1) & index->mask;
+    }
+    index->count--;
+    //shift back the entries after it that probed past the slot, so that no probe ever has to go past a hole
+    for(next = (s + 1) & index->mask; index->slots[next].tunnel != NULL; next = (next + 1) & index->mask){
+        const struct ike_sa_slot *slot = &index->slots[next];
+        const uint32_t home = ike_sa_hash(index,slot->initiator_spi,slot->responder_spi) & index->mask;
+        if(((next - home) & index->mask) >= ((next - s) & index->mask)){
+            index->slots[s] = *slot;
+            s = next;
+        }
+    }
+    index->slots[s].tunnel = NULL;
+}
+
+struct tunnel *ike_sa_index_lookup(const struct ike_sa_index *index, uint64_t initiator_spi, uint64_t responder_spi,
+struct ip_addr src_addr, struct ip_addr dst_addr){
+    uint32_t s = ike_sa_hash(index,initiator_spi,responder_spi) & index->mask;
+    while(index->slots[s].tunnel != NULL){
+        const struct ike_sa_slot *slot = &index->slots[s];
+        //the spis are in the slot, only the addresses are checked against the tunnel
+        if(slot->initiator_spi == initiator_spi && slot->responder_spi == responder_spi &&
+        tunnel_links(slot->tunnel,&src_addr,&dst_addr)){
+            return slot->tunnel;
+        }
+        s = (s + 1) & index->mask;
+    }
+    return NULL;
+}
+
+/// Checks whether if a packet with these addresses is sent in a direction of a tunnel
+static inline bool
+esp_sa_match(const struct tunnel *tunnel, uint8_t dir, const struct ip_addr *src, const struct ip_addr *dst){
+    if(dir == ESP_DIR_CLIENT){
+        return ip_addr_equal(tunnel->client_ip,*src) && ip_addr_equal(tunnel->host_ip,*dst);
+    }
+    return ip_addr_equal(tunnel->host_ip,*src) && ip_addr_equal(tunnel->client_ip,*dst);
+}
+
+/// Gets the source and destination addresses of the packets sent in a direction of a tunnel
+static inline void
+esp_sa_addresses(const struct tunnel *tunnel, uint8_t dir, const struct ip_addr **src, const struct ip_addr **dst){
+    *src = dir == ESP_DIR_CLIENT ? &tunnel->client_ip : &tunnel->host_ip;
+    *dst = dir == ESP_DIR_CLIENT ? &tunnel->host_ip : &tunnel->client_ip;
+}
+
+struct esp_sa_index *esp_sa_index_create(uint32_t capacity){
+    const uint32_t size = sa_index_size(capacity);
+    struct esp_sa_index *index = calloc(1,sizeof(struct esp_sa_index));
+    if(index == NULL){
+        return NULL;
+    }
+    index->slots = sa_index_slots_alloc((size_t)size * sizeof(struct esp_sa_slot));
+    if(index->slots == NULL){
+        free(index);
+        return NULL;
+    }
+    index->mask = size - 1;
+    index->seed = (uint32_t)rte_rdtsc();
+    return index;
+}
+
+int esp_sa_index_add(struct esp_sa_index *index, struct tunnel *tunnel, uint8_t dir, rte_be32_t spi, uint8_t child){
+    const struct ip_addr *src, *dst;
+    uint32_t s;
+    if((index->count + 1) * 4 > (index->mask + 1) * 3){
+        return -1;
+    }
+    esp_sa_addresses(tunnel,dir,&src,&dst);
+    s = esp_sa_hash(index,src,dst,spi) & index->mask;
+    while(index->slots[s].tunnel != NULL){
+        s = (s + 1) & index->mask;
+    }
+    index->slots[s].tunnel = tunnel;
+    index->slots[s].spi = spi;
+    index->slots[s].dir = dir;
+    index->slots[s].child = child;
+    index->count++;
+    return 0;
+}
+
+void esp_sa_index_del(struct esp_sa_index *index, struct tunnel *tunnel, uint8_t dir, rte_be32_t spi){
+    const struct ip_addr *src, *dst;
+    uint32_t s, next;
+    esp_sa_addresses(tunnel,dir,&src,&dst);
+    s = esp_sa_hash(index,src,dst,spi) & index->mask;
+    for(;;){
+        const struct esp_sa_slot *slot = &index->slots[s];
+        if(slot->tunnel == NULL){
+            return;
+        }
+        if(slot->tunnel == tunnel && slot->dir == dir && slot->spi == spi){
+            break;
+        }
+        s = (s + 1) & index->mask;
+    }
+    index->count--;
+    //shift back the entries after it that probed past the slot, so that no probe ever has to go past a hole
+    for(next = (s + 1) & index->mask; index->slots[next].tunnel != NULL; next = (next + 1) & index->mask){
+        const struct esp_sa_slot *slot = &index->slots[next];
+        uint32_t home;
+        esp_sa_addresses(slot->tunnel,slot->dir,&src,&dst);
+        home = esp_sa_hash(index,src,dst,slot->spi) & index->mask;
+        if(((next - home) & index->mask) >= ((next - s) & index->mask)){
+            index->slots[s] = *slot;
+            s = next;
+        }
+    }
+    index->slots[s].tunnel = NULL;
+}
+
+struct tunnel *esp_sa_index_lookup(const struct esp_sa_index *index, const struct ip_addr *src, const struct ip_addr *dst,
+rte_be32_t spi, uint8_t *dir, uint8_t *child){
+    uint32_t s;
+    if(spi == 0){
+        return NULL;
+    }
+    s = esp_sa_hash(index,src,dst,spi) & index->mask;
+    while(index->slots[s].tunnel != NULL){
+        const struct esp_sa_slot *slot = &index->slots[s];
+        if(slot->spi == spi && esp_sa_match(slot->tunnel,slot->dir,src,dst)){
+            *dir = slot->dir;
+            *child = slot->child;
+            return slot->tunnel;
+        }
+        s = (s + 1) & index->mask;
+    }
+    return NULL;
+}
+
+struct tunnel *esp_sa_index_lookup_pair(const struct esp_sa_index *index, const struct ip_addr *src, const struct ip_addr *dst,
+uint8_t *dir){
+    struct tunnel *found = NULL;
+    uint32_t s = esp_sa_hash(index,src,dst,0) & index->mask;
+    while(index->slots[s].tunnel != NULL){
+        const struct esp_sa_slot *slot = &index->slots[s];
+        if(slot->spi == 0 && esp_sa_match(slot->tunnel,slot->dir,src,dst)){
+            if(child_sa_awaits(slot->tunnel,slot->dir)){
+                *dir = slot->dir;
+                return slot->tunnel;
+            }
+            if(found == NULL){
+                found = slot->tunnel;
+                *dir = slot->dir;
+            }
+        }
+        s = (s + 1) & index->mask;
+    }
+    return found;
+}
@@ -0,0 +1,65 @@
+#include "../include/source_limit.h"
+#include <stdlib.h>
+#include <rte_cycles.h>
+#include <rte_hash_crc.h>
+
+struct source_limiter *source_limiter_create(uint32_t rate, uint32_t burst){
+    struct source_limiter *limiter = calloc(1,sizeof(struct source_limiter));
+    if(limiter == NULL){
+        return NULL;
+    }
+    limiter->rate = rate;
+    limiter->burst = burst;
+    limiter->seed = (uint32_t)rte_rdtsc();
+    return limiter;
+}
+
+/// Gets the set of a source address
+static inline uint32_t
+source_limit_set(const struct source_limiter *limiter, const struct ip_addr *addr){
+    return rte_hash_crc_8byte(addr->halves[1],rte_hash_crc_8byte(addr->halves[0],limiter->seed)) &
+    (SOURCE_LIMIT_SIZE / SOURCE_LIMIT_WAYS - 1);
+}
+
+bool source_limit_take(struct source_limiter *limiter, const struct ip_addr *addr, uint64_t now){
+    struct source_set *set = &limiter->sets[source_limit_set(limiter,addr)];
+    struct source_bucket *source = NULL, *idle = NULL;
+    for(int w = 0; w < SOURCE_LIMIT_WAYS; w++){
+        struct source_bucket *way = &set->ways[w];
+        if(way->bucket.updated != 0 && ip_addr_equal(way->addr,*addr)){
+            source = way;
+            break;
+        }
+        if(idle == NULL && (way->bucket.updated == 0 || token_bucket_full(&way->bucket,now,limiter->rate,limiter->burst))){
+            idle = way;
+        }
+    }
+    if(source == NULL && idle != NULL){
+        source = idle;
+        source->addr = *addr;
+        source->bucket.updated = now;
+        source->bucket.credit = (uint64_t)limiter->burst * TIMER_HZ;
+    }
+    else if(source == NULL){
+        //no slot can be taken without giving a fresh budget away, share the one of the sources left out
+        source = &set->shared;
+        source->addr = *addr;
+        if(source->bucket.updated == 0){
+            source->bucket.updated = now;
+            source->bucket.credit = (uint64_t)limiter->burst * TIMER_HZ;
+        }
+    }
+    source->over = !token_bucket_take(&source->bucket,now,limiter->rate,limiter->burst);
+    return !source->over;
+}
+
+bool source_limit_over(const struct source_limiter *limiter, const struct ip_addr *addr){
+    const struct source_set *set = &limiter->sets[source_limit_set(limiter,addr)];
+    for(int w = 0; w < SOURCE_LIMIT_WAYS; w++){
+        const struct source_bucket *way = &set->ways[w];
+        if(way->bucket.updated != 0 && ip_addr_equal(way->addr,*addr)){
+            return way->over;
+        }
+    }
+    return set->shared.over && ip_addr_equal(set->shared.addr,*addr);
+}
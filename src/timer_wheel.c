@@ -0,0 +1,123 @@
+#include "../include/timer_wheel.h"
+#include <stdlib.h>
+#include <time.h>
+
+/// Ticks a timer can be scheduled ahead of the wheel
+#define TIMER_WHEEL_SPAN ((uint64_t)1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+
+uint64_t timer_now(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE,&now);
+    return (uint64_t)now.tv_sec * TIMER_HZ + now.tv_nsec / (1000000000 / TIMER_HZ);
+}
+
+struct timer_wheel *timer_wheel_create(uint64_t now){
+    struct timer_wheel *wheel = calloc(1,sizeof(struct timer_wheel));
+    if(wheel == NULL){
+        return NULL;
+    }
+    wheel->now = now;
+    return wheel;
+}
+
+/// Links a timer into the slot its deadline falls in, relative to the next tick to run
+static void
+timer_wheel_link(struct timer_wheel *wheel, struct timer_node *timer){
+    struct timer_node **slot;
+    uint64_t delta;
+    unsigned level = 0;
+    if(timer->expires < wheel->now){
+        timer->expires = wheel->now;
+    }
+    else if(timer->expires - wheel->now >= TIMER_WHEEL_SPAN){
+        timer->expires = wheel->now + TIMER_WHEEL_SPAN - 1;
+    }
+    delta = timer->expires - wheel->now;
+    while(delta >= ((uint64_t)1 << (TIMER_WHEEL_BITS * (level + 1)))){
+        level++;
+    }
+    slot = &wheel->slots[level][(timer->expires >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1)];
+    timer->next = *slot;
+    if(*slot != NULL){
+        (*slot)->pprev = &timer->next;
+    }
+    timer->pprev = slot;
+    *slot = timer;
+}
+
+/// Unlinks a scheduled timer
+static void
+timer_wheel_unlink(struct timer_node *timer){
+    *timer->pprev = timer->next;
+    if(timer->next != NULL){
+        timer->next->pprev = timer->pprev;
+    }
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+void timer_wheel_arm(struct timer_wheel *wheel, struct timer_node *timer, uint64_t expires){
+    if(timer_pending(timer)){
+        timer_wheel_unlink(timer);
+    }
+    else{
+        wheel->count++;
+    }
+    timer->expires = expires;
+    timer_wheel_link(wheel,timer);
+}
+
+void timer_wheel_cancel(struct timer_wheel *wheel, struct timer_node *timer){
+    if(timer_pending(timer)){
+        timer_wheel_unlink(timer);
+        wheel->count--;
+    }
+}
+
+/**
+ * Moves the timers of a slot of an upper level down to the levels their deadline now falls in
+ * @returns the index of the slot, 0 when the level below it has to be cascaded as well
+ */
+static unsigned
+timer_wheel_cascade(struct timer_wheel *wheel, unsigned level){
+    const unsigned index = (wheel->now >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1);
+    struct timer_node *timer = wheel->slots[level][index];
+    wheel->slots[level][index] = NULL;
+    while(timer != NULL){
+        struct timer_node *next = timer->next;
+        timer_wheel_link(wheel,timer);
+        timer = next;
+    }
+    return index;
+}
+
+unsigned timer_wheel_run(struct timer_wheel *wheel, uint64_t now, timer_fire_t fire){
+    unsigned fired = 0;
+    while(wheel->now <= now){
+        struct timer_node *due;
+        if(wheel->count == 0){
+            //nothing can fire, skip the empty ticks
+            wheel->now = now + 1;
+            break;
+        }
+        //at the start of each turn of a level, the next slot of the level above comes down
+        if((wheel->now & (TIMER_WHEEL_SLOTS - 1)) == 0){
+            for(unsigned level = 1; level < TIMER_WHEEL_LEVELS && timer_wheel_cascade(wheel,level) == 0; level++);
+        }
+        due = wheel->slots[0][wheel->now & (TIMER_WHEEL_SLOTS - 1)];
+        wheel->slots[0][wheel->now & (TIMER_WHEEL_SLOTS - 1)] = NULL;
+        if(due != NULL){
+            due->pprev = &due;
+        }
+        //timers rescheduled while firing go to later ticks
+        wheel->now++;
+        while(due != NULL){
+            struct timer_node *timer = due;
+            timer_wheel_unlink(timer);
+            wheel->count--;
+            fire(wheel,timer);
+            fired++;
+        }
+    }
+    return fired;
+}
@@ -0,0 +1,627 @@
+#include "../include/tunnel_journal.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <rte_common.h>
+#include <rte_hash_crc.h>
+
+/// Bytes of the longest record
+#define JOURNAL_RECORD_MAX (sizeof(struct journal_record) + sizeof(struct journal_tunnel))
+/// Bytes of the shortest record, a delete
+#define JOURNAL_RECORD_MIN (sizeof(struct journal_record) + JOURNAL_KEY_SIZE)
+
+/**
+ * @struct journal_scan
+ * @brief Last record of each tunnel of a mapped journal, found by the key of the tunnel. The slot of a deleted
+ * tunnel keeps its delete so that probes go on past it
+ */
+struct journal_scan{
+    const struct journal_record **slots;
+    uint64_t mask;
+    /** bytes of the journal up to the end of its last whole record */
+    uint64_t end;
+    uint64_t records;
+    uint64_t live;
+    /** tunnels whose last record is a delete */
+    uint64_t deleted;
+    /** seq of the last record, 0 if none */
+    uint64_t last_seq;
+};
+
+/// Gets the CRC of a record, over everything but the CRC itself
+static uint32_t
+record_crc(const struct journal_record *record){
+    return rte_hash_crc((const uint8_t *)record + sizeof(record->crc),
+    sizeof(struct journal_record) - sizeof(record->crc) + record->length,0);
+}
+
+/// Gets the payload of a record
+static inline const struct journal_tunnel *
+record_tunnel(const struct journal_record *record){
+    return (const struct journal_tunnel *)(record + 1);
+}
+
+/**
+ * Gets the record at an offset of a mapped journal
+ * @param data mapped journal
+ * @param size bytes mapped
+ * @param offset offset of the record
+ * @returns the record, NULL if there is no whole record of this version with a matching CRC there
+ */
+static const struct journal_record *
+record_at(const uint8_t *data, uint64_t size, uint64_t offset){
+    const struct journal_record *record = (const struct journal_record *)(data + offset);
+    if(offset + sizeof(struct journal_record) > size){
+        return NULL;
+    }
+    if(record->type < JOURNAL_ADD || record->type > JOURNAL_DELETE ||
+    record->length != (record->type == JOURNAL_DELETE ? JOURNAL_KEY_SIZE : sizeof(struct journal_tunnel))){
+        return NULL;
+    }
+    if(offset + sizeof(struct journal_record) + record->length > size || record_crc(record) != record->crc){
+        return NULL;
+    }
+    return record;
+}
+
+/// Gets the slot of the key of a tunnel, empty if no record has the key
+static const struct journal_record **
+scan_slot(const struct journal_scan *scan, const struct journal_tunnel *key){
+    uint64_t s = rte_hash_crc(key,JOURNAL_KEY_SIZE,0) & scan->mask;
+    while(scan->slots[s] != NULL && memcmp(record_tunnel(scan->slots[s]),key,JOURNAL_KEY_SIZE) != 0){
+        s = (s + 1) & scan->mask;
+    }
+    return &scan->slots[s];
+}
+
+/// Checks whether if a record of a scanned journal is the last one of a live tunnel
+static inline bool
+scan_holds(const struct journal_scan *scan, const struct journal_record *record){
+    return record->type != JOURNAL_DELETE && *scan_slot(scan,record_tunnel(record)) == record;
+}
+
+/// Checks whether if a record of a scanned journal deletes a tunnel after a seq, for good
+static inline bool
+scan_deletes(const struct journal_scan *scan, const struct journal_record *record, uint64_t seq){
+    return record->type == JOURNAL_DELETE && record->seq > seq && *scan_slot(scan,record_tunnel(record)) == record;
+}
+
+/**
+ * Reads the records of a mapped journal up to the first that is not whole
+ * @param scan scan to fill, freed with free(scan->slots)
+ * @param data mapped journal, starting with a valid header, NULL if empty
+ * @param size bytes mapped
+ * @returns 0 on success, -1 if the slots cannot be allocated
+ */
+static int
+journal_scan(struct journal_scan *scan, const uint8_t *data, uint64_t size){
+    const struct journal_record *record;
+    uint64_t offset = sizeof(struct journal_header);
+    //a key takes at most one slot, and there are at most as many keys as records
+    const uint64_t nb_slots = rte_align64pow2(size / JOURNAL_RECORD_MIN * 2 + 2);
+    memset(scan,0,sizeof(struct journal_scan));
+    scan->slots = calloc(nb_slots,sizeof(*scan->slots));
+    if(scan->slots == NULL){
+        return -1;
+    }
+    scan->mask = nb_slots - 1;
+    if(data == NULL){
+        return 0;
+    }
+    while((record = record_at(data,size,offset)) != NULL){
+        const struct journal_record **slot = scan_slot(scan,record_tunnel(record));
+        if(*slot == NULL || (*slot)->type == JOURNAL_DELETE){
+            scan->live += record->type != JOURNAL_DELETE;
+            scan->deleted -= *slot != NULL && record->type != JOURNAL_DELETE;
+            scan->deleted += *slot == NULL && record->type == JOURNAL_DELETE;
+        }
+        else if(record->type == JOURNAL_DELETE){
+            scan->live--;
+            scan->deleted++;
+        }
+        *slot = record;
+        scan->records++;
+        scan->last_seq = record->seq;
+        offset += sizeof(struct journal_record) + record->length;
+    }
+    scan->end = offset;
+    return 0;
+}
+
+/**
+ * Maps a journal file read-only
+ * @param path journal file
+ * @param limit bytes of the file to map at most
+ * @param data set to the mapping, NULL if the file is missing, empty or not a journal of this version
+ * @param size set to the bytes mapped
+ * @returns 0 on success, -1 if the file cannot be read
+ */
+static int
+journal_map(const char *path, uint64_t limit, uint8_t **data, uint64_t *size){
+    const struct journal_header *header;
+    struct stat st;
+    int fd = open(path,O_RDONLY | O_CLOEXEC);
+    *data = NULL;
+    *size = 0;
+    if(fd < 0){
+        return errno == ENOENT ? 0 : -1;
+    }
+    if(fstat(fd,&st) != 0){
+        close(fd);
+        return -1;
+    }
+    *size = RTE_MIN((uint64_t)st.st_size,limit);
+    if(*size < sizeof(struct journal_header)){
+        close(fd);
+        *size = 0;
+        return 0;
+    }
+    *data = mmap(NULL,*size,PROT_READ,MAP_PRIVATE,fd,0);
+    close(fd);
+    if(*data == MAP_FAILED){
+        *data = NULL;
+        return -1;
+    }
+    header = (const struct journal_header *)*data;
+    if(header->magic != JOURNAL_MAGIC || header->version != JOURNAL_VERSION){
+        printf("%s is not a tunnel journal of version %u, it is started over\n",path,JOURNAL_VERSION);
+        munmap(*data,*size);
+        *data = NULL;
+        *size = 0;
+    }
+    //records are read once, in order
+    else{
+        madvise(*data,*size,MADV_SEQUENTIAL);
+    }
+    return 0;
+}
+
+/// Writes a whole buffer to a file
+static int
+write_all(int fd, const void *buf, size_t len){
+    const uint8_t *bytes = buf;
+    while(len > 0){
+        const ssize_t written = write(fd,bytes,len);
+        if(written < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            return -1;
+        }
+        bytes += written;
+        len -= written;
+    }
+    return 0;
+}
+
+/**
+ * Writes the last record of each live tunnel of a scanned journal to a new file, which then takes the place of
+ * the file of the journal, along with the last delete of each tunnel ended after a seq. Only called from the
+ * thread of the journal, or before it starts, so the file does not change meanwhile
+ * @param journal journal to rewrite
+ * @param data mapped journal the scan was made on
+ * @param scan scan of the records mapped
+ * @param keep_after seq of the last tunnel snapshot, the deletes after it are kept
+ * @returns 0 on success, -1 if the new file cannot be written, the old one is then kept
+ */
+static int
+journal_rewrite(struct tunnel_journal *journal, const uint8_t *data, const struct journal_scan *scan, uint64_t keep_after){
+    const struct journal_header header = {.magic = JOURNAL_MAGIC, .version = JOURNAL_VERSION};
+    char tmp_path[PATH_MAX];
+    uint64_t size = sizeof(struct journal_header);
+    uint64_t records = 0;
+    uint8_t *out = malloc(sizeof(struct journal_header) + scan->live * JOURNAL_RECORD_MAX + scan->deleted * JOURNAL_RECORD_MIN);
+    int fd = -1, ret = -1;
+    if(out == NULL){
+        return -1;
+    }
+    memcpy(out,&header,sizeof(struct journal_header));
+    for(uint64_t offset = sizeof(struct journal_header); offset < scan->end;){
+        const struct journal_record *record = (const struct journal_record *)(data + offset);
+        const size_t record_size = sizeof(struct journal_record) + record->length;
+        if(scan_holds(scan,record)){
+            struct journal_record *copy = (struct journal_record *)(out + size);
+            memcpy(copy,record,record_size);
+            //the only record of a tunnel in the new file adds it
+            copy->type = JOURNAL_ADD;
+            copy->crc = record_crc(copy);
+            size += record_size;
+            records++;
+        }
+        //the snapshot may still hold the tunnel
+        else if(scan_deletes(scan,record,keep_after)){
+            memcpy(out + size,record,record_size);
+            size += record_size;
+            records++;
+        }
+        offset += record_size;
+    }
+    snprintf(tmp_path,sizeof(tmp_path),"%s.tmp",journal->path);
+    fd = open(tmp_path,O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC,0644);
+    if(fd < 0 || write_all(fd,out,size) != 0 || fsync(fd) != 0 || rename(tmp_path,journal->path) != 0){
+        goto unlink;
+    }
+    pthread_mutex_lock(&journal->lock);
+    if(journal->fd >= 0){
+        close(journal->fd);
+        journal->compactions++;
+    }
+    journal->fd = fd;
+    journal->size = size;
+    journal->records = records;
+    pthread_mutex_unlock(&journal->lock);
+    fd = -1;
+    ret = 0;
+unlink:
+    if(fd >= 0){
+        close(fd);
+        unlink(tmp_path);
+    }
+    free(out);
+    return ret;
+}
+
+/**
+ * Rewrites a journal with the last record of each live tunnel, from the thread of the journal. Records
+ * appended meanwhile wait in the queues and go to the new file
+ * @param journal journal to compact
+ * @returns 0 on success, -1 if the new file cannot be written, the old one is then kept
+ */
+static int
+journal_compact(struct tunnel_journal *journal){
+    struct journal_scan scan;
+    uint64_t end, keep_after;
+    uint8_t *data;
+    int ret = -1;
+    pthread_mutex_lock(&journal->lock);
+    keep_after = journal->checkpoint_seq;
+    pthread_mutex_unlock(&journal->lock);
+    if(journal_map(journal->path,journal->size,&data,&end) != 0){
+        return -1;
+    }
+    if(journal_scan(&scan,data,end) == 0){
+        ret = journal_rewrite(journal,data,&scan,keep_after);
+        free(scan.slots);
+    }
+    if(data != NULL){
+        munmap(data,end);
+    }
+    return ret;
+}
+
+/// Checks whether if enough of the records of a journal are of ended or changed tunnels to compact it, with the lock held
+static inline bool
+journal_due(const struct tunnel_journal *journal){
+    return journal->records >= JOURNAL_COMPACT_MIN && journal->records >= journal->live * JOURNAL_COMPACT_RATIO &&
+    journal->records >= journal->retry_at;
+}
+
+/**
+ * Takes the records waiting in the queues of a journal, gives them their seq and CRC and writes them to its file,
+ * from the thread of the journal without the lock held
+ * @param journal journal to write
+ * @returns the number of records taken
+ */
+static uint64_t
+journal_drain(struct tunnel_journal *journal){
+    uint64_t seq = journal->next_seq;
+    uint64_t taken = 0;
+    int64_t live = 0;
+    size_t len = 0;
+    int ret;
+    for(uint16_t q = 0; q < journal->nb_queues; q++){
+        struct journal_queue *queue = &journal->queues[q];
+        const uint64_t head = __atomic_load_n(&queue->head,__ATOMIC_ACQUIRE);
+        uint64_t tail = queue->tail;
+        while(tail != head && len + JOURNAL_RECORD_MAX <= JOURNAL_BUFFER_SIZE){
+            const struct journal_entry *entry = &queue->entries[tail & (JOURNAL_QUEUE_SIZE - 1)];
+            struct journal_record *record = (struct journal_record *)(journal->buffer + len);
+            record->type = entry->type;
+            record->reserved = 0;
+            record->length = entry->type == JOURNAL_DELETE ? JOURNAL_KEY_SIZE : sizeof(struct journal_tunnel);
+            record->seq = seq++;
+            memcpy(record + 1,&entry->tunnel,record->length);
+            record->crc = record_crc(record);
+            live += entry->type == JOURNAL_ADD ? 1 : entry->type == JOURNAL_DELETE ? -1 : 0;
+            len += sizeof(struct journal_record) + record->length;
+            tail++;
+            taken++;
+        }
+        //the entries are copied, the thread appending may reuse them
+        __atomic_store_n(&queue->tail,tail,__ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&journal->next_seq,seq,__ATOMIC_RELEASE);
+    if(taken == 0){
+        return 0;
+    }
+    ret = write_all(journal->fd,journal->buffer,len);
+    if(ret != 0){
+        //a partial record would hide every record appended after it
+        (void)ftruncate(journal->fd,journal->size);
+    }
+    pthread_mutex_lock(&journal->lock);
+    if(ret == 0){
+        journal->size += len;
+        journal->records += taken;
+    }
+    else{
+        journal->errors += taken;
+    }
+    journal->live += live;
+    pthread_mutex_unlock(&journal->lock);
+    return taken;
+}
+
+/**
+ * Writes the records appended to a journal as they come, and compacts it each time they make it due,
+ * until it is closed. Polls the queues so that appending never has to wake the thread
+ * @param arg journal
+ */
+static void *
+journal_thread(void *arg){
+    struct tunnel_journal *journal = arg;
+    pthread_mutex_lock(&journal->lock);
+    for(;;){
+        struct timespec until;
+        uint64_t taken;
+        int ret;
+        pthread_mutex_unlock(&journal->lock);
+        taken = journal_drain(journal);
+        pthread_mutex_lock(&journal->lock);
+        if(taken != 0){
+            continue;
+        }
+        //the workers are done once the journal is closed, every record they appended is written
+        if(journal->stop){
+            break;
+        }
+        if(!journal_due(journal)){
+            clock_gettime(CLOCK_REALTIME,&until);
+            until.tv_nsec += JOURNAL_POLL_MS * 1000000L;
+            if(until.tv_nsec >= 1000000000L){
+                until.tv_sec++;
+                until.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&journal->wake,&journal->lock,&until);
+            continue;
+        }
+        pthread_mutex_unlock(&journal->lock);
+        ret = journal_compact(journal);
+        pthread_mutex_lock(&journal->lock);
+        //neither a file that cannot be written nor one kept long by the deletes after the snapshot is compacted on every append
+        journal->retry_at = ret == 0 && !journal_due(journal) ? 0 : journal->records * 2;
+    }
+    pthread_mutex_unlock(&journal->lock);
+    return NULL;
+}
+
+/**
+ * Reads the file of a journal being opened and opens it for appending. The file is only rewritten if it is
+ * due a compaction, is cut short or is not a journal of this version, so that opening a journal that was
+ * closed cleanly only reads it
+ * @param journal journal being opened
+ * @returns 0 on success, -1 if the file cannot be read or written
+ */
+static int
+journal_load(struct tunnel_journal *journal){
+    struct journal_scan scan;
+    uint64_t end;
+    uint8_t *data;
+    int ret = -1;
+    if(journal_map(journal->path,UINT64_MAX,&data,&end) != 0 || journal_scan(&scan,data,end) != 0){
+        goto unmap;
+    }
+    if(data != NULL && scan.end < end){
+        printf("%s cut short, %" PRIu64 " bytes after its last whole record dropped\n",journal->path,end - scan.end);
+    }
+    journal->records = scan.records;
+    journal->live = scan.live;
+    journal->next_seq = scan.last_seq + 1;
+    //the snapshot holds the tunnels of the records lost, those appended from now on still come after it
+    if(journal->checkpoint_seq != UINT64_MAX && journal->checkpoint_seq > scan.last_seq){
+        printf("%s ends at record %" PRIu64 " before the tunnel snapshot taken at record %" PRIu64 ", "
+        "the tunnels saved in between are only in the snapshot\n",journal->path,scan.last_seq,journal->checkpoint_seq);
+        journal->next_seq = journal->checkpoint_seq + 1;
+    }
+    if(data == NULL || scan.end < end || journal_due(journal)){
+        ret = journal_rewrite(journal,data,&scan,journal->checkpoint_seq);
+    }
+    else{
+        journal->fd = open(journal->path,O_RDWR | O_APPEND | O_CLOEXEC);
+        journal->size = end;
+        ret = journal->fd < 0 ? -1 : 0;
+    }
+    free(scan.slots);
+unmap:
+    if(data != NULL){
+        munmap(data,end);
+    }
+    return ret;
+}
+
+/// Frees the queues and buffer of a journal
+static void
+journal_free_queues(struct tunnel_journal *journal){
+    for(uint16_t q = 0; journal->queues != NULL && q < journal->nb_queues; q++){
+        free(journal->queues[q].entries);
+    }
+    free(journal->queues);
+    free(journal->buffer);
+}
+
+struct tunnel_journal *tunnel_journal_open(const char *path, uint64_t checkpoint_seq, uint16_t nb_queues){
+    struct tunnel_journal *journal = calloc(1,sizeof(struct tunnel_journal));
+    if(journal == NULL){
+        return NULL;
+    }
+    journal->fd = -1;
+    journal->path = strdup(path);
+    journal->buffer = malloc(JOURNAL_BUFFER_SIZE);
+    journal->queues = aligned_alloc(RTE_CACHE_LINE_SIZE,sizeof(struct journal_queue) * nb_queues);
+    journal->checkpoint_seq = checkpoint_seq;
+    pthread_mutex_init(&journal->lock,NULL);
+    pthread_cond_init(&journal->wake,NULL);
+    if(journal->path == NULL || journal->buffer == NULL || journal->queues == NULL){
+        goto fail;
+    }
+    memset(journal->queues,0,sizeof(struct journal_queue) * nb_queues);
+    for(journal->nb_queues = 0; journal->nb_queues < nb_queues; journal->nb_queues++){
+        struct journal_queue *queue = &journal->queues[journal->nb_queues];
+        queue->journal = journal;
+        queue->entries = malloc(sizeof(struct journal_entry) * JOURNAL_QUEUE_SIZE);
+        if(queue->entries == NULL){
+            goto fail;
+        }
+    }
+    if(journal_load(journal) != 0){
+        goto fail;
+    }
+    if(pthread_create(&journal->thread,NULL,journal_thread,journal) != 0){
+        close(journal->fd);
+        goto fail;
+    }
+    return journal;
+fail:
+    pthread_cond_destroy(&journal->wake);
+    pthread_mutex_destroy(&journal->lock);
+    journal_free_queues(journal);
+    free(journal->path);
+    free(journal);
+    return NULL;
+}
+
+struct journal_queue *tunnel_journal_queue(struct tunnel_journal *journal, uint16_t index){
+    return journal == NULL ? NULL : &journal->queues[index];
+}
+
+int64_t tunnel_journal_replay(struct tunnel_journal *journal, void (*restore)(const struct journal_tunnel *tunnel, void *arg),
+void *arg){
+    struct journal_scan scan;
+    uint64_t end;
+    uint8_t *data;
+    int64_t restored = 0;
+    pthread_mutex_lock(&journal->lock);
+    end = journal->size;
+    pthread_mutex_unlock(&journal->lock);
+    //records appended by restore are past the end mapped
+    if(journal_map(journal->path,end,&data,&end) != 0){
+        return -1;
+    }
+    if(journal_scan(&scan,data,end) != 0){
+        restored = -1;
+    }
+    else{
+        for(uint64_t offset = sizeof(struct journal_header); offset < scan.end;){
+            const struct journal_record *record = (const struct journal_record *)(data + offset);
+            if(scan_holds(&scan,record)){
+                restore(record_tunnel(record),arg);
+                restored++;
+            }
+            offset += sizeof(struct journal_record) + record->length;
+        }
+        free(scan.slots);
+    }
+    if(data != NULL){
+        munmap(data,end);
+    }
+    return restored;
+}
+
+int64_t tunnel_journal_replay_after(struct tunnel_journal *journal, uint64_t seq,
+void (*apply)(uint8_t type, const struct journal_tunnel *tunnel, void *arg), void *arg){
+    const struct journal_record *record;
+    uint64_t offset = sizeof(struct journal_header);
+    uint64_t end;
+    uint8_t *data;
+    int64_t applied = 0;
+    pthread_mutex_lock(&journal->lock);
+    end = journal->size;
+    pthread_mutex_unlock(&journal->lock);
+    //records appended by apply are past the end mapped
+    if(journal_map(journal->path,end,&data,&end) != 0){
+        return -1;
+    }
+    while(data != NULL && (record = record_at(data,end,offset)) != NULL){
+        if(record->seq > seq){
+            //a delete only has the key, the spis are read as 0
+            struct journal_tunnel tunnel = {0};
+            memcpy(&tunnel,record_tunnel(record),record->length);
+            apply(record->type,&tunnel,arg);
+            applied++;
+        }
+        offset += sizeof(struct journal_record) + record->length;
+    }
+    if(data != NULL){
+        munmap(data,end);
+    }
+    return applied;
+}
+
+int tunnel_journal_append(struct journal_queue *queue, uint8_t type, const struct journal_tunnel *tunnel){
+    struct journal_entry *entry;
+    while(queue->head - __atomic_load_n(&queue->tail,__ATOMIC_ACQUIRE) == JOURNAL_QUEUE_SIZE){
+        //the workers do not wait for a disk that fell behind
+        if(!__atomic_load_n(&queue->journal->wait,__ATOMIC_RELAXED)){
+            __atomic_store_n(&queue->drops,queue->drops + 1,__ATOMIC_RELAXED);
+            return -1;
+        }
+        pthread_cond_signal(&queue->journal->wake);
+        sched_yield();
+    }
+    entry = &queue->entries[queue->head & (JOURNAL_QUEUE_SIZE - 1)];
+    entry->type = type;
+    memcpy(&entry->tunnel,tunnel,type == JOURNAL_DELETE ? JOURNAL_KEY_SIZE : sizeof(struct journal_tunnel));
+    //publishes the entry to the thread of the journal
+    __atomic_store_n(&queue->head,queue->head + 1,__ATOMIC_RELEASE);
+    return 0;
+}
+
+void tunnel_journal_wait(struct tunnel_journal *journal, bool wait){
+    __atomic_store_n(&journal->wait,wait,__ATOMIC_RELAXED);
+}
+
+uint64_t tunnel_journal_seq(struct tunnel_journal *journal){
+    return __atomic_load_n(&journal->next_seq,__ATOMIC_ACQUIRE) - 1;
+}
+
+void tunnel_journal_checkpoint(struct tunnel_journal *journal, uint64_t seq){
+    pthread_mutex_lock(&journal->lock);
+    journal->checkpoint_seq = seq;
+    //the deletes kept for the previous snapshot may now go
+    journal->retry_at = 0;
+    if(journal_due(journal)){
+        pthread_cond_signal(&journal->wake);
+    }
+    pthread_mutex_unlock(&journal->lock);
+}
+
+void tunnel_journal_get_stats(struct tunnel_journal *journal, struct tunnel_journal_stats *stats){
+    pthread_mutex_lock(&journal->lock);
+    stats->records = journal->records;
+    stats->live = journal->live;
+    stats->compactions = journal->compactions;
+    stats->errors = journal->errors;
+    pthread_mutex_unlock(&journal->lock);
+    for(uint16_t q = 0; q < journal->nb_queues; q++){
+        stats->errors += __atomic_load_n(&journal->queues[q].drops,__ATOMIC_RELAXED);
+    }
+}
+
+void tunnel_journal_close(struct tunnel_journal *journal){
+    pthread_mutex_lock(&journal->lock);
+    journal->stop = true;
+    pthread_cond_signal(&journal->wake);
+    pthread_mutex_unlock(&journal->lock);
+    pthread_join(journal->thread,NULL);
+    close(journal->fd);
+    pthread_cond_destroy(&journal->wake);
+    pthread_mutex_destroy(&journal->lock);
+    journal_free_queues(journal);
+    free(journal->path);
+    free(journal);
+}
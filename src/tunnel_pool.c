@@ -0,0 +1,108 @@
+#include "../include/tunnel_pool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <rte_common.h>
+
+struct rte_rcu_qsbr *tunnel_rcu_create(void){
+    const size_t size = rte_rcu_qsbr_get_memsize(TUNNEL_READER_MAX);
+    struct rte_rcu_qsbr *rcu = aligned_alloc(RTE_CACHE_LINE_SIZE,RTE_ALIGN_CEIL(size,RTE_CACHE_LINE_SIZE));
+    if(rcu == NULL){
+        return NULL;
+    }
+    if(rte_rcu_qsbr_init(rcu,TUNNEL_READER_MAX) != 0){
+        free(rcu);
+        return NULL;
+    }
+    //registered readers start offline, they only hold back reclaiming while they walk a pool
+    for(unsigned reader = 0; reader < TUNNEL_READER_MAX; reader++){
+        rte_rcu_qsbr_thread_register(rcu,reader);
+    }
+    return rcu;
+}
+
+struct tunnel_pool *tunnel_pool_create(uint32_t capacity, struct rte_rcu_qsbr *rcu){
+    struct tunnel_pool *pool = calloc(1,sizeof(struct tunnel_pool));
+    if(pool == NULL){
+        return NULL;
+    }
+    pool->tunnels = aligned_alloc(RTE_CACHE_LINE_SIZE,RTE_ALIGN_CEIL(capacity * sizeof(struct tunnel),RTE_CACHE_LINE_SIZE));
+    pool->ike = malloc(capacity * sizeof(struct tunnel_ike));
+    pool->handles = malloc(capacity * sizeof(uint32_t));
+    pool->positions = malloc(capacity * sizeof(uint32_t));
+    pool->free = malloc(capacity * sizeof(uint32_t));
+    pool->retired = malloc(capacity * sizeof(struct tunnel_retired));
+    if(pool->tunnels == NULL || pool->ike == NULL || pool->handles == NULL || pool->positions == NULL ||
+    pool->free == NULL || pool->retired == NULL){
+        free(pool->tunnels);
+        free(pool->ike);
+        free(pool->handles);
+        free(pool->positions);
+        free(pool->free);
+        free(pool->retired);
+        free(pool);
+        return NULL;
+    }
+    memset(pool->tunnels,0,capacity * sizeof(struct tunnel));
+    memset(pool->ike,0,capacity * sizeof(struct tunnel_ike));
+    //lowest handles on top of the stack
+    for(uint32_t i = 0; i < capacity; i++){
+        pool->free[i] = capacity - 1 - i;
+    }
+    pool->nb_free = capacity;
+    pool->capacity = capacity;
+    pool->rcu = rcu;
+    return pool;
+}
+
+/**
+ * Frees the retired slots no reader can still see, oldest first
+ * @param pool pool of the calling worker
+ */
+static void
+tunnel_pool_reclaim(struct tunnel_pool *pool){
+    while(pool->nb_retired != 0){
+        const struct tunnel_retired *retired = &pool->retired[pool->retired_head];
+        //tokens grow with time, once one is still in use so are the ones after it
+        if(pool->rcu != NULL && rte_rcu_qsbr_check(pool->rcu,retired->token,false) != 1){
+            return;
+        }
+        pool->free[pool->nb_free++] = retired->handle;
+        pool->retired_head = pool->retired_head + 1 == pool->capacity ? 0 : pool->retired_head + 1;
+        pool->nb_retired--;
+    }
+}
+
+struct tunnel *tunnel_pool_alloc(struct tunnel_pool *pool, const struct tunnel *init, const struct tunnel_ike *init_ike){
+    uint32_t handle;
+    if(pool->nb_retired != 0){
+        tunnel_pool_reclaim(pool);
+    }
+    if(pool->nb_free == 0){
+        return NULL;
+    }
+    handle = pool->free[--pool->nb_free];
+    pool->tunnels[handle] = *init;
+    pool->ike[handle] = *init_ike;
+    pool->positions[handle] = pool->count;
+    //a reader that sees the new count sees the handle, and through it the whole tunnel
+    __atomic_store_n(&pool->handles[pool->count],handle,__ATOMIC_RELEASE);
+    __atomic_store_n(&pool->count,pool->count + 1,__ATOMIC_RELEASE);
+    return &pool->tunnels[handle];
+}
+
+void tunnel_pool_free(struct tunnel_pool *pool, struct tunnel *tunnel){
+    const uint32_t handle = tunnel_pool_handle(pool,tunnel);
+    const uint32_t position = pool->positions[handle];
+    const uint32_t last = pool->handles[pool->count - 1];
+    uint32_t tail = pool->retired_head + pool->nb_retired;
+    //the last live tunnel takes the freed position, a reader past it sees the last one twice at worst
+    __atomic_store_n(&pool->handles[position],last,__ATOMIC_RELEASE);
+    pool->positions[last] = position;
+    __atomic_store_n(&pool->count,pool->count - 1,__ATOMIC_RELEASE);
+    if(tail >= pool->capacity){
+        tail -= pool->capacity;
+    }
+    pool->retired[tail].handle = handle;
+    pool->retired[tail].token = pool->rcu != NULL ? rte_rcu_qsbr_start(pool->rcu) : 0;
+    pool->nb_retired++;
+}
@@ -0,0 +1,139 @@
+#include "../include/tunnel_snapshot.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <libgen.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <rte_hash_crc.h>
+
+/// Gets the CRC of the header of a snapshot, over the fields before the CRC itself
+static uint32_t
+header_crc(const struct snapshot_header *header){
+    return rte_hash_crc(header,offsetof(struct snapshot_header,header_crc),0);
+}
+
+/// Gets the CRC of the records of a snapshot, one record at a time as the length of a CRC is 32 bits
+static uint32_t
+records_crc(const struct snapshot_tunnel *tunnels, uint64_t count){
+    uint32_t crc = 0;
+    for(uint64_t i = 0; i < count; i++){
+        crc = rte_hash_crc(&tunnels[i],sizeof(struct snapshot_tunnel),crc);
+    }
+    return crc;
+}
+
+/**
+ * Flushes the directory of a file renamed into it, without which a crash can still leave the previous file
+ * under its name
+ * @param path file renamed
+ * @returns 0 on success, -1 if the directory cannot be flushed
+ */
+static int
+sync_dir(const char *path){
+    char dir_path[PATH_MAX];
+    int fd, ret;
+    snprintf(dir_path,sizeof(dir_path),"%s",path);
+    fd = open(dirname(dir_path),O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd < 0){
+        return -1;
+    }
+    ret = fsync(fd);
+    close(fd);
+    return ret;
+}
+
+int tunnel_snapshot_alloc(struct tunnel_snapshot *snapshot, uint64_t capacity){
+    memset(snapshot,0,sizeof(struct tunnel_snapshot));
+    snapshot->size = sizeof(struct snapshot_header) + capacity * sizeof(struct snapshot_tunnel);
+    snapshot->header = malloc(snapshot->size);
+    if(snapshot->header == NULL){
+        return -1;
+    }
+    snapshot->tunnels = (struct snapshot_tunnel *)(snapshot->header + 1);
+    snapshot->capacity = capacity;
+    return 0;
+}
+
+int tunnel_snapshot_write(struct tunnel_snapshot *snapshot, const char *path, uint64_t count, uint64_t journal_seq){
+    struct snapshot_header *header = snapshot->header;
+    const size_t size = sizeof(struct snapshot_header) + count * sizeof(struct snapshot_tunnel);
+    const uint8_t *bytes = (const uint8_t *)header;
+    char tmp_path[PATH_MAX];
+    size_t written = 0;
+    int fd;
+    memset(header,0,sizeof(struct snapshot_header));
+    header->magic = SNAPSHOT_MAGIC;
+    header->version = SNAPSHOT_VERSION;
+    header->record_size = sizeof(struct snapshot_tunnel);
+    header->count = count;
+    header->journal_seq = journal_seq;
+    header->crc = records_crc(snapshot->tunnels,count);
+    header->header_crc = header_crc(header);
+    snprintf(tmp_path,sizeof(tmp_path),"%s.tmp",path);
+    fd = open(tmp_path,O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,0644);
+    if(fd < 0){
+        return -1;
+    }
+    //a single write unless the kernel takes less at once
+    while(written < size){
+        const ssize_t n = write(fd,bytes + written,size - written);
+        if(n < 0 && errno != EINTR){
+            break;
+        }
+        written += n > 0 ? n : 0;
+    }
+    //the snapshot only takes the place of the previous one once it is whole on disk
+    if(written < size || fsync(fd) != 0 || rename(tmp_path,path) != 0){
+        close(fd);
+        unlink(tmp_path);
+        return -1;
+    }
+    close(fd);
+    return sync_dir(path);
+}
+
+int tunnel_snapshot_map(struct tunnel_snapshot *snapshot, const char *path){
+    struct stat st;
+    const struct snapshot_header *header;
+    int fd = open(path,O_RDONLY | O_CLOEXEC);
+    memset(snapshot,0,sizeof(struct tunnel_snapshot));
+    if(fd < 0){
+        return -1;
+    }
+    if(fstat(fd,&st) != 0 || (uint64_t)st.st_size < sizeof(struct snapshot_header)){
+        close(fd);
+        return -1;
+    }
+    //every record is read right away, faulting them in up front is cheaper than one page at a time
+    header = mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE | MAP_POPULATE,fd,0);
+    close(fd);
+    if(header == MAP_FAILED){
+        return -1;
+    }
+    snapshot->header = (struct snapshot_header *)header;
+    snapshot->tunnels = (struct snapshot_tunnel *)(snapshot->header + 1);
+    snapshot->size = st.st_size;
+    snapshot->mapped = true;
+    if(header->magic != SNAPSHOT_MAGIC || header->version != SNAPSHOT_VERSION ||
+    header->record_size != sizeof(struct snapshot_tunnel) || header->header_crc != header_crc(header) ||
+    header->count != (snapshot->size - sizeof(struct snapshot_header)) / sizeof(struct snapshot_tunnel) ||
+    header->crc != records_crc(snapshot->tunnels,header->count)){
+        printf("%s is not a tunnel snapshot of version %u or is damaged, it is not restored\n",path,SNAPSHOT_VERSION);
+        tunnel_snapshot_free(snapshot);
+        return -1;
+    }
+    snapshot->capacity = header->count;
+    return 0;
+}
+
+void tunnel_snapshot_free(struct tunnel_snapshot *snapshot){
+    if(snapshot->mapped){
+        munmap(snapshot->header,snapshot->size);
+    }
+    else{
+        free(snapshot->header);
+    }
+    memset(snapshot,0,sizeof(struct tunnel_snapshot));
+}